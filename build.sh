@@ -6,3 +6,12 @@ qmake CXX=$CXX ../../software/dbus-cgwacs.pro && make
 if [[ $? -ne 0 ]] ; then
     exit 1
 fi
+
+# Check the register maps compiled into the application. The test runs when
+# it is linked, so a malformed register_maps.xml fails the build.
+mkdir -p ../register_maps
+cd ../register_maps
+qmake CXX=$CXX ../../test/register_maps/register_maps.pro && make
+if [[ $? -ne 0 ]] ; then
+    exit 1
+fi
@@ -22,7 +22,7 @@ unix {
 MOC_DIR=.moc
 OBJECTS_DIR=.obj
 
-QT += core dbus xml
+QT += core dbus network xml
 QT -= gui
 
 TARGET = dbus-cgwacs
@@ -49,14 +49,25 @@ SOURCES += \
     src/ac_sensor.cpp \
     src/ac_sensor_bridge.cpp \
     src/ac_sensor_mediator.cpp \
+    src/ac_sensor_receiver.cpp \
     src/ac_sensor_settings.cpp \
     src/ac_sensor_settings_bridge.cpp \
     src/ac_sensor_updater.cpp \
     src/crc16.cpp \
     src/data_processor.cpp \
     src/dbus_bridge.cpp \
+    src/identity_cache.cpp \
+    src/latency_statistics.cpp \
     src/main.cpp \
+    src/modbus.cpp \
     src/modbus_rtu.cpp \
+    src/modbus_tcp.cpp \
+    src/port_manager.cpp \
+    src/publish_wheel.cpp \
+    src/register_maps.cpp \
+    src/serial_transport.cpp \
+    src/slave_scanner.cpp \
+    src/tcp_transport.cpp \
     src/ac_sensor_phase.cpp
 
 HEADERS += \
@@ -64,6 +75,7 @@ HEADERS += \
     src/ac_sensor.h \
     src/ac_sensor_bridge.h \
     src/ac_sensor_mediator.h \
+    src/ac_sensor_receiver.h \
     src/ac_sensor_settings.h \
     src/ac_sensor_settings_bridge.h \
     src/ac_sensor_updater.h \
@@ -71,9 +83,25 @@ HEADERS += \
     src/data_processor.h \
     src/dbus_bridge.h \
     src/defines.h \
+    src/identity_cache.h \
+    src/latency_statistics.h \
+    src/modbus.h \
     src/modbus_rtu.h \
+    src/modbus_tcp.h \
+    src/modbus_transport.h \
+    src/port_manager.h \
+    src/publish_wheel.h \
+    src/register_maps.h \
+    src/serial_transport.h \
+    src/slave_scanner.h \
+    src/spsc_queue.h \
+    src/tcp_transport.h \
     src/velib/velib_config_app.h \
     src/ac_sensor_phase.h
 
+RESOURCES += \
+    register_maps.qrc
+
 DISTFILES += \
-    ../README.md
+    ../README.md \
+    register_maps.xml
@@ -1,6 +1,8 @@
 #include <QsLog.h>
 #include "ac_sensor.h"
 #include "ac_sensor_phase.h"
+#include "latency_statistics.h"
+#include "register_maps.h"
 
 AcSensor::AcSensor(const QString &portName, int slaveAddress, QObject *parent) :
 	QObject(parent),
@@ -8,6 +10,8 @@ AcSensor::AcSensor(const QString &portName, int slaveAddress, QObject *parent) :
 	mDeviceType(0),
 	mDeviceSubType(0),
 	mErrorCode(0),
+	mResponseTime(qQNaN()),
+	mResponseTimeout(0),
 	mFirmwareVersion(0),
 	mPortName(portName),
 	mSlaveAddress(slaveAddress),
@@ -15,7 +19,8 @@ AcSensor::AcSensor(const QString &portName, int slaveAddress, QObject *parent) :
 	mTotal(new AcSensorPhase(this)),
 	mL1(new AcSensorPhase(this)),
 	mL2(new AcSensorPhase(this)),
-	mL3(new AcSensorPhase(this))
+	mL3(new AcSensorPhase(this)),
+	mModbusLatency(new LatencyStatistics(this))
 {
 	resetValues();
 }
@@ -46,13 +51,12 @@ void AcSensor::setDeviceSubType(int t)
 
 AcSensor::ProtocolTypes AcSensor::protocolType() const
 {
-	if (mDeviceType >= 71 && mDeviceType <= 73)
-		return Em24Protocol;
-	if (mDeviceType >= 102 && mDeviceType <= 121)
-		return Et112Protocol;
-	if (mDeviceType >= 330 && mDeviceType <= 345)
-		return Em340Protocol;
-	return Unknown;
+	return protocolType(mDeviceType);
+}
+
+AcSensor::ProtocolTypes AcSensor::protocolType(int deviceType)
+{
+	return RegisterMaps::protocolType(deviceType);
 }
 
 void AcSensor::setErrorCode(int code)
@@ -63,6 +67,22 @@ void AcSensor::setErrorCode(int code)
 	emit errorCodeChanged();
 }
 
+void AcSensor::setResponseTime(double t)
+{
+	if ((qIsNaN(mResponseTime) && qIsNaN(t)) || mResponseTime == t)
+		return;
+	mResponseTime = t;
+	emit responseTimeChanged();
+}
+
+void AcSensor::setResponseTimeout(int t)
+{
+	if (mResponseTimeout == t)
+		return;
+	mResponseTimeout = t;
+	emit responseTimeoutChanged();
+}
+
 void AcSensor::setSerial(const QString &s)
 {
 	if (mSerial == s)
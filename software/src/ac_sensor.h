@@ -6,6 +6,7 @@
 #include "defines.h"
 
 class AcSensorPhase;
+class LatencyStatistics;
 
 enum ConnectionState {
 	Disconnected,
@@ -31,6 +32,8 @@ class AcSensor : public QObject
 	Q_PROPERTY(int firmwareVersion READ firmwareVersion WRITE setFirmwareVersion NOTIFY firmwareVersionChanged)
 	Q_PROPERTY(int errorCode READ errorCode WRITE setErrorCode NOTIFY errorCodeChanged)
 	Q_PROPERTY(QString portName READ portName)
+	Q_PROPERTY(double responseTime READ responseTime WRITE setResponseTime NOTIFY responseTimeChanged)
+	Q_PROPERTY(int responseTimeout READ responseTimeout WRITE setResponseTimeout NOTIFY responseTimeoutChanged)
 public:
 	AcSensor(const QString &portName, int slaveAddress, QObject *parent = 0);
 
@@ -71,10 +74,13 @@ public:
 
 	/*!
 	 * Returns which set of registers is used by the energy meter.
-	 * The return value is based on the value of `deviceType`.
+	 * The return value is based on the value of `deviceType` and the device
+	 * ID ranges in the register maps (see `RegisterMaps`).
 	 */
 	ProtocolTypes protocolType() const;
 
+	static ProtocolTypes protocolType(int deviceType);
+
 	/*!
 	 * Returned the serial number of the energy meter.
 	 */
@@ -123,6 +129,28 @@ public:
 
 	void setErrorCode(int code);
 
+	/*!
+	 * Returns the smoothed response time of the energy meter in ms. This
+	 * value is for diagnostic purposes only.
+	 */
+	double responseTime() const
+	{
+		return mResponseTime;
+	}
+
+	void setResponseTime(double t);
+
+	/*!
+	 * Returns the response timeout (in ms) currently used for the energy
+	 * meter. The timeout is derived from the response time.
+	 */
+	int responseTimeout() const
+	{
+		return mResponseTimeout;
+	}
+
+	void setResponseTimeout(int t);
+
 	/*!
 	 * Returns the logical name of the communication port. (eg. /dev/ttyUSB1).
 	 */
@@ -158,6 +186,15 @@ public:
 
 	AcSensorPhase *getPhase(Phase phase);
 
+	/*!
+	 * Time between sending a request to the energy meter and receiving the
+	 * response, including the time the request was queued.
+	 */
+	LatencyStatistics *modbusLatency()
+	{
+		return mModbusLatency;
+	}
+
 	/*!
 	 * Reset all measured values to NaN
 	 */
@@ -178,11 +215,17 @@ signals:
 
 	void errorCodeChanged();
 
+	void responseTimeChanged();
+
+	void responseTimeoutChanged();
+
 private:
 	ConnectionState mConnectionState;
 	int mDeviceType;
 	int mDeviceSubType;
 	int mErrorCode;
+	double mResponseTime;
+	int mResponseTimeout;
 	int mFirmwareVersion;
 	QString mPortName;
 	int mSlaveAddress;
@@ -193,6 +236,7 @@ private:
 	AcSensorPhase *mL1;
 	AcSensorPhase *mL2;
 	AcSensorPhase *mL3;
+	LatencyStatistics *mModbusLatency;
 };
 
 #endif // AC_SENSOR_H
@@ -1,12 +1,39 @@
 #include <cmath>
 #include <QCoreApplication>
+#include <QRegExp>
 #include <QStringList>
+#include <QTimer>
 #include <QsLog.h>
 #include <velib/vecan/products.h>
 #include "ac_sensor.h"
 #include "ac_sensor_bridge.h"
 #include "ac_sensor_settings.h"
 #include "ac_sensor_phase.h"
+#include "latency_statistics.h"
+
+/// Interval at which the latency percentiles are recomputed.
+static const int LatencyUpdateInterval = 10 * 1000;
+
+/// Deadbands of the measured values: smaller changes are mostly noise, and
+/// not published (see `DBusBridge::setDeadband`).
+static const double CurrentDeadband = 0.05; // A
+static const double VoltageDeadband = 0.5; // V
+static const double PowerDeadband = 1.0; // W
+/// Relative power deadband of meters not used for feedback control.
+static const double RelativePowerDeadband = 0.005;
+/// Changes within the deadband are published after this interval (ms).
+static const int MaxSilence = 10 * 1000;
+
+/// Publish periods (ms) of the measured values. The power of a grid meter is
+/// used for feedback control, so it is published more often. The energy
+/// counters change slowly, so they are published least often.
+static const int GridPowerPeriod = 1000;
+static const int PowerPeriod = 2500;
+static const int VoltageCurrentPeriod = 2500;
+static const int EnergyPeriod = 10 * 1000;
+/// Publish period (ms) of /Mgmt/SuppressedUpdates. The counter changes with
+/// almost every measurement, but is only of interest for diagnostics.
+static const int SuppressedUpdatesPeriod = 60 * 1000;
 
 static bool roleFromDBus(DBusBridge*, QVariant &v)
 {
@@ -20,32 +47,69 @@ static bool positionFromDBus(DBusBridge*, QVariant &v)
 	return (n >= 0) && (n < 3);
 }
 
+static bool positionToDBus(DBusBridge*, QVariant &v)
+{
+	v = QVariant(static_cast<int>(v.value<Position>()));
+	return true;
+}
+
+static bool connectionStateToDBus(DBusBridge*, QVariant &v)
+{
+	v = QVariant(v.value<ConnectionState>() == Connected ? 1 : 0);
+	return true;
+}
+
 AcSensorBridge::AcSensorBridge(AcSensor *acSensor, AcSensorSettings *settings,
 							   bool isSecondary, QObject *parent) :
-	DBusBridge(getServiceName(acSensor, settings, isSecondary), true, parent)
+	DBusBridge(getServiceName(acSensor, settings, isSecondary), true, parent),
+	mAcSensor(acSensor),
+	mSettings(settings),
+	mIsGridmeter(false)
 {
 	Q_ASSERT(acSensor != 0);
 	Q_ASSERT(settings != 0);
 	connect(acSensor, SIGNAL(destroyed()), this, SLOT(deleteLater()));
 	connect(settings, SIGNAL(destroyed()), this, SLOT(deleteLater()));
 
-	bool isGridmeter =
+	mIsGridmeter =
 		(isSecondary ? settings->l2ServiceType() : settings->serviceType()) == "grid";
-	// Changes in QT properties will not be propagated to the D-Bus at once, but in 1000ms/2500ms
-	// intervals.
-	setUpdateInterval(isGridmeter ? 1000 : 2500);
+	// Changes of the other properties (connection state, error code, response
+	// times) are published at the period of the power. The measured values and
+	// /Mgmt/SuppressedUpdates get their own periods below.
+	setUpdateInterval(mIsGridmeter ? GridPowerPeriod : PowerPeriod);
 
-	produce(acSensor, "connectionState", "/Connected");
+	produce(acSensor, "connectionState", "/Connected", QString(), -1, false, 0,
+			connectionStateToDBus);
 	produce(acSensor, "errorCode", "/ErrorCode");
+	produce(acSensor, "responseTime", "/Mgmt/ResponseTime", "ms", 1);
+	produce(acSensor, "responseTimeout", "/Mgmt/ResponseTimeout", "ms");
+	produce(this, "suppressedUpdates", "/Mgmt/SuppressedUpdates");
+	setPublishPeriod("/Mgmt/SuppressedUpdates", SuppressedUpdatesPeriod);
 
-	producePowerInfo(acSensor->total(), "/Ac", isGridmeter);
-	producePowerInfo(acSensor->l1(), "/Ac/L1", isGridmeter);
-	producePowerInfo(acSensor->l2(), "/Ac/L2", isGridmeter);
-	producePowerInfo(acSensor->l3(), "/Ac/L3", isGridmeter);
+	producePowerInfo(acSensor->total(), "/Ac", mIsGridmeter);
+	producePowerInfo(acSensor->l1(), "/Ac/L1", mIsGridmeter);
+	producePowerInfo(acSensor->l2(), "/Ac/L2", mIsGridmeter);
+	producePowerInfo(acSensor->l3(), "/Ac/L3", mIsGridmeter);
+	produceLatency(acSensor->modbusLatency(), "/Mgmt/Latency/Modbus");
+	QTimer *latencyTimer = new QTimer(this);
+	connect(latencyTimer, SIGNAL(timeout()), this, SLOT(onUpdateLatency()));
+	latencyTimer->start(LatencyUpdateInterval);
+	connect(settings, SIGNAL(powerDeadbandChanged()), this, SLOT(onPowerDeadbandChanged()));
+	connect(settings, SIGNAL(relativePowerDeadbandChanged()),
+			this, SLOT(onPowerDeadbandChanged()));
+	onPowerDeadbandChanged();
+	connect(settings, SIGNAL(currentDeadbandChanged()), this, SLOT(onCurrentDeadbandChanged()));
+	onCurrentDeadbandChanged();
+	connect(settings, SIGNAL(voltageDeadbandChanged()), this, SLOT(onVoltageDeadbandChanged()));
+	onVoltageDeadbandChanged();
+	if (mIsGridmeter && !isSecondary) {
+		connect(settings, SIGNAL(lowLatencyChanged()), this, SLOT(onLowLatencyChanged()));
+		onLowLatencyChanged();
+	}
 
 	if (isSecondary || settings->serviceType() == "pvinverter")
 		produce(settings, isSecondary ? "l2Position" : "position", "/Position",
-			QString(), -1, false, positionFromDBus);
+			QString(), -1, false, positionFromDBus, positionToDBus);
 	produce(settings, isSecondary ? "l2ProductName" : "productName", "/ProductName");
 	produce(settings, isSecondary ? "l2CustomName" : "customName", "/CustomName");
 	produce(settings, isSecondary ? "l2ServiceType" : "serviceType", "/Role",
@@ -93,11 +157,7 @@ AcSensorBridge::AcSensorBridge(AcSensor *acSensor, AcSensorSettings *settings,
 
 bool AcSensorBridge::toDBus(const QString &path, QVariant &value)
 {
-	if (path == "/Connected") {
-		value = QVariant(value.value<ConnectionState>() == Connected ? 1 : 0);
-	} else if (path == "/Position") {
-		value = QVariant(static_cast<int>(value.value<Position>()));
-	}
+	Q_UNUSED(path)
 	if (value.type() == QVariant::Double && !qIsFinite(value.toDouble()))
 		value = QVariant();
 	return true;
@@ -119,15 +179,79 @@ QString AcSensorBridge::toText(const QString &path, const QVariant &value, const
 	return DBusBridge::toText(path, value, unit, precision);
 }
 
+void AcSensorBridge::valuePublished(const QString &path)
+{
+	QHash<QString, LatencyTracker>::iterator it = mLatencyTrackers.find(path);
+	if (it == mLatencyTrackers.end())
+		return;
+	qint64 requestTime = it->phase->requestTime(it->parameter);
+	if (requestTime == 0)
+		return;
+	it->statistics->add(monotonicTime() - requestTime);
+}
+
+void AcSensorBridge::onUpdateLatency()
+{
+	mAcSensor->modbusLatency()->update();
+	for (QHash<QString, LatencyTracker>::iterator it = mLatencyTrackers.begin();
+		 it != mLatencyTrackers.end(); ++it) {
+		it->statistics->update();
+	}
+}
+
+void AcSensorBridge::onLowLatencyChanged()
+{
+	// The power of a grid meter is used for feedback control, so in low
+	// latency mode it should not wait for the update timer.
+	foreach (const QString &path, mPowerPaths)
+		setPublishImmediately(path, mSettings->lowLatency());
+}
+
+void AcSensorBridge::onPowerDeadbandChanged()
+{
+	// A deadband set by the user replaces both default deadbands, so 0 will
+	// publish every change, unless a relative deadband has been set as well.
+	double deadband = mSettings->powerDeadband();
+	double relative = 0;
+	if (deadband < 0) {
+		deadband = PowerDeadband;
+		relative = mIsGridmeter ? 0 : RelativePowerDeadband;
+	}
+	if (mSettings->relativePowerDeadband() >= 0)
+		relative = mSettings->relativePowerDeadband();
+	foreach (const QString &path, mPowerPaths)
+		setDeadband(path, deadband, relative, MaxSilence);
+}
+
+void AcSensorBridge::onCurrentDeadbandChanged()
+{
+	double deadband = mSettings->currentDeadband();
+	if (deadband < 0)
+		deadband = CurrentDeadband;
+	foreach (const QString &path, mPhasePaths)
+		setDeadband(path + "/Current", deadband, 0, MaxSilence);
+}
+
+void AcSensorBridge::onVoltageDeadbandChanged()
+{
+	double deadband = mSettings->voltageDeadband();
+	if (deadband < 0)
+		deadband = VoltageDeadband;
+	foreach (const QString &path, mPhasePaths)
+		setDeadband(path + "/Voltage", deadband, 0, MaxSilence);
+}
+
 QString AcSensorBridge::getServiceName(AcSensor *acSensor, AcSensorSettings *settings,
 									   bool isSecondary)
 {
 	QString serviceType = isSecondary ?
 		settings->l2ServiceType() :
 		settings->serviceType();
+	// Network ports (eg. tcp://192.168.1.10:502) contain characters which are
+	// not allowed in a D-Bus service name.
 	QString portId = acSensor->portName().
 			replace("/dev/", "").
-			replace("/", "_");
+			replace(QRegExp("[^A-Za-z0-9_-]"), "_");
 	QString serviceName = QString("pub/com.victronenergy.%1.cgwacs_%2_mb%3").
 			arg(serviceType).
 			arg(portId).
@@ -139,10 +263,51 @@ QString AcSensorBridge::getServiceName(AcSensor *acSensor, AcSensorSettings *set
 
 void AcSensorBridge::producePowerInfo(AcSensorPhase *pi, const QString &path, bool isGridmeter)
 {
-	produce(pi, "current", path + "/Current", "A", 1);
-	produce(pi, "voltage", path + "/Voltage", "V", 0);
-	produce(pi, "power", path + "/Power", "W", 0);
-	produce(pi, "energyForward", path + "/Energy/Forward", "kWh", 1);
-	if (isGridmeter)
-		produce(pi, "energyReverse", path + "/Energy/Reverse", "kWh", 1);
+	produceMeasurement(pi, "current", &dbusDoubleGetter<AcSensorPhase, &AcSensorPhase::current>,
+					   Current, path + "/Current", "A", 1);
+	setPublishPeriod(path + "/Current", VoltageCurrentPeriod);
+	produceMeasurement(pi, "voltage", &dbusDoubleGetter<AcSensorPhase, &AcSensorPhase::voltage>,
+					   Voltage, path + "/Voltage", "V", 0);
+	setPublishPeriod(path + "/Voltage", VoltageCurrentPeriod);
+	// The deadbands are set in onCurrentDeadbandChanged,
+	// onVoltageDeadbandChanged and onPowerDeadbandChanged.
+	mPhasePaths.append(path);
+	produceMeasurement(pi, "power", &dbusDoubleGetter<AcSensorPhase, &AcSensorPhase::power>,
+					   Power, path + "/Power", "W", 0);
+	setPublishPeriod(path + "/Power", isGridmeter ? GridPowerPeriod : PowerPeriod);
+	mPowerPaths.append(path + "/Power");
+	produceMeasurement(pi, "energyForward",
+					   &dbusDoubleGetter<AcSensorPhase, &AcSensorPhase::energyForward>,
+					   PositiveEnergy, path + "/Energy/Forward", "kWh", 1);
+	setPublishPeriod(path + "/Energy/Forward", EnergyPeriod);
+	if (isGridmeter) {
+		produceMeasurement(pi, "energyReverse",
+						   &dbusDoubleGetter<AcSensorPhase, &AcSensorPhase::energyReverse>,
+						   NegativeEnergy, path + "/Energy/Reverse", "kWh", 1);
+		setPublishPeriod(path + "/Energy/Reverse", EnergyPeriod);
+	}
+}
+
+void AcSensorBridge::produceMeasurement(AcSensorPhase *pi, const char *property,
+										dbus_double_getter_t getter, ParameterType parameter,
+										const QString &path, const QString &unit,
+										int precision)
+{
+	LatencyTracker tracker;
+	tracker.phase = pi;
+	tracker.parameter = parameter;
+	tracker.statistics = new LatencyStatistics(this);
+	mLatencyTrackers.insert(path, tracker);
+	produceLatency(tracker.statistics, "/Mgmt/Latency" + path);
+	produceDouble(pi, property, getter, path, unit, precision);
+}
+
+void AcSensorBridge::produceLatency(LatencyStatistics *statistics, const QString &path)
+{
+	produceDouble(statistics, "p50", &dbusDoubleGetter<LatencyStatistics, &LatencyStatistics::p50>,
+				  path + "/P50", "ms", 0);
+	produceDouble(statistics, "p95", &dbusDoubleGetter<LatencyStatistics, &LatencyStatistics::p95>,
+				  path + "/P95", "ms", 0);
+	produceDouble(statistics, "p99", &dbusDoubleGetter<LatencyStatistics, &LatencyStatistics::p99>,
+				  path + "/P99", "ms", 0);
 }
@@ -1,11 +1,15 @@
 #ifndef AC_SENSOR_BRIDGE_H
 #define AC_SENSOR_BRIDGE_H
 
+#include <QHash>
+#include <QStringList>
 #include "dbus_bridge.h"
+#include "defines.h"
 
 class AcSensor;
 class AcSensorSettings;
 class AcSensorPhase;
+class LatencyStatistics;
 
 /*!
  * @brief Connects data from `AcSensor` to the DBus.
@@ -28,11 +32,49 @@ protected:
 	virtual QString toText(const QString &path, const QVariant &value, const QString &unit,
 						   int precision);
 
+	virtual void valuePublished(const QString &path);
+
+private slots:
+	void onUpdateLatency();
+
+	void onLowLatencyChanged();
+
+	void onPowerDeadbandChanged();
+
+	void onCurrentDeadbandChanged();
+
+	void onVoltageDeadbandChanged();
+
 private:
+	struct LatencyTracker {
+		AcSensorPhase *phase;
+		ParameterType parameter;
+		LatencyStatistics *statistics;
+	};
+
 	void producePowerInfo(AcSensorPhase *pi, const QString &path, bool isGridmeter);
 
+	/*!
+	 * Publishes a measured value, and the percentiles of its age at the time
+	 * it is published under /Mgmt/Latency.
+	 */
+	void produceMeasurement(AcSensorPhase *pi, const char *property,
+							dbus_double_getter_t getter, ParameterType parameter,
+							const QString &path, const QString &unit, int precision);
+
+	void produceLatency(LatencyStatistics *statistics, const QString &path);
+
 	static QString getServiceName(AcSensor *acSensor, AcSensorSettings *settings,
 								  bool isSecondary);
+
+	AcSensor *mAcSensor;
+	AcSensorSettings *mSettings;
+	bool mIsGridmeter;
+	/// Power paths, published without delay in low latency mode.
+	QStringList mPowerPaths;
+	/// Paths of the total and the phases (eg. /Ac/L1).
+	QStringList mPhasePaths;
+	QHash<QString, LatencyTracker> mLatencyTrackers;
 };
 
 #endif // AC_SENSOR_BRIDGE_H
@@ -1,20 +1,33 @@
 #include <QsLog.h>
 #include <QStringList>
+#include <QThread>
 #include <velib/qt/ve_qitem.hpp>
 #include "ac_sensor.h"
 #include "ac_sensor_bridge.h"
 #include "ac_sensor_mediator.h"
+#include "ac_sensor_receiver.h"
 #include "ac_sensor_settings.h"
 #include "ac_sensor_settings_bridge.h"
 #include "ac_sensor_updater.h"
 #include "dbus_bridge.h"
+#include "modbus.h"
+#include "slave_scanner.h"
+
+/// Time between scans of the slave addresses which did not respond (ms). Same
+/// as the interval used by the updaters to reconnect to a lost meter.
+static const int RescanInterval = 15 * 1000;
+static const int ZigbeeRescanInterval = 30 * 1000;
 
 static const QString DeviceIdsPath = "Settings/CGwacs/DeviceIds";
 
-AcSensorMediator::AcSensorMediator(const QString &portName, int timeout, bool isZigbee, VeQItem *settingsRoot,
+AcSensorMediator::AcSensorMediator(const QString &portName, const ModbusTimeouts &timeouts,
+								   bool isZigbee, VeQItem *settingsRoot,
 								   QObject *parent) :
 	QObject(parent),
-	mModbus(new ModbusRtu(portName, 9600, timeout, this)),
+	mPortName(portName),
+	mThread(new QThread(this)),
+	mModbus(Modbus::create(portName, timeouts)),
+	mIsZigbee(isZigbee),
 	mDeviceIdsItem(settingsRoot->itemGetOrCreate(DeviceIdsPath))
 {
 	DBusBridge settingsBridge(settingsRoot, false);
@@ -22,21 +35,55 @@ AcSensorMediator::AcSensorMediator(const QString &portName, int timeout, bool is
 
 	/// @todo EV We assume that this setting is initialized before an AC sensor has been found
 	mDeviceIdsItem->getValue();
-	connect(mModbus, SIGNAL(serialEvent(const char *)), this, SIGNAL(serialEvent(const char *)));
-	for (int i=1; i<=2; ++i) {
-		AcSensor *m = new AcSensor(portName, i, this);
-		AcSensor *pv = new AcSensor(portName, i, this);
-		new AcSensorUpdater(m, pv, mModbus, isZigbee, m);
-		mAcSensors.append(m);
-		connect(m, SIGNAL(connectionStateChanged()),
-				this, SLOT(onConnectionStateChanged()));
-	}
+	connect(mModbus, SIGNAL(serialEvent(QString)), this, SIGNAL(serialEvent(QString)));
+	// The scanner is a child of the modbus object, so it will be moved to the
+	// I/O thread together with the modbus object.
+	SlaveScanner *scanner = new SlaveScanner(
+		mModbus, timeouts.probe, isZigbee ? ZigbeeRescanInterval : RescanInterval, mModbus);
+	connect(scanner, SIGNAL(slaveFound(int)), this, SLOT(onSlaveFound(int)));
+	connect(scanner, SIGNAL(finished(int)), this, SLOT(onScanFinished(int)));
+
+	// All communication with the energy meters takes place in a separate
+	// thread, so it will not be disturbed by (synchronous) D-Bus calls.
+	mModbus->moveToThread(mThread);
+	connect(mThread, SIGNAL(finished()), mModbus, SLOT(deleteLater()));
+	mThread->start();
+	QMetaObject::invokeMethod(scanner, "start", Qt::QueuedConnection);
+}
+
+AcSensorMediator::~AcSensorMediator()
+{
+	// This will also delete the modbus object, the scanner and the updaters.
+	mThread->quit();
+	mThread->wait();
+}
+
+void AcSensorMediator::onSlaveFound(int slaveAddress)
+{
+	AcSensor *m = new AcSensor(mPortName, slaveAddress, this);
+	AcSensor *pv = new AcSensor(mPortName, slaveAddress, this);
+	AcSensorUpdater *mu = new AcSensorUpdater(mPortName, slaveAddress, mModbus, mIsZigbee);
+	new AcSensorReceiver(m, pv, mu, m);
+	mAcSensors.append(m);
+	connect(m, SIGNAL(connectionStateChanged()),
+			this, SLOT(onConnectionStateChanged()));
+	mu->moveToThread(mThread);
+	connect(mThread, SIGNAL(finished()), mu, SLOT(deleteLater()));
+	QMetaObject::invokeMethod(mu, "start", Qt::QueuedConnection);
+}
+
+void AcSensorMediator::onScanFinished(int count)
+{
+	// If a device was found, the silent addresses will be scanned again. The
+	// port is only lost if there is nothing left to wait for.
+	if (count == 0)
+		emit connectionLost();
 }
 
 void AcSensorMediator::onDeviceFound()
 {
 	AcSensor *m = static_cast<AcSensor *>(sender());
-	AcSensorUpdater *mu = m->findChild<AcSensorUpdater *>();
+	AcSensorReceiver *mu = m->findChild<AcSensorReceiver *>();
 	QLOG_INFO() << "Device found:" << m->serial() << '@' << m->portName();
 	AcSensorSettings *settings = mu->settings();
 	settings->setIsMultiPhase(m->protocolType() != AcSensor::Et112Protocol);
@@ -61,16 +108,17 @@ void AcSensorMediator::onDeviceSettingsInitialized()
 	AcSensorSettingsBridge *b = static_cast<AcSensorSettingsBridge *>(sender());
 	AcSensorSettings *s = static_cast<AcSensorSettings *>(b->parent());
 	AcSensor *m = static_cast<AcSensor *>(s->parent());
-	AcSensorUpdater *mu = m->findChild<AcSensorUpdater *>();
+	AcSensorReceiver *mu = m->findChild<AcSensorReceiver *>();
 	mu->startMeasurements();
 }
 
 void AcSensorMediator::onDeviceInitialized()
 {
 	AcSensor *acSensor = static_cast<AcSensor *>(sender());
-	AcSensorUpdater *mu = acSensor->findChild<AcSensorUpdater *>();
+	AcSensorReceiver *mu = acSensor->findChild<AcSensorReceiver *>();
 	AcSensorSettings *sensorSettings = mu->settings();
 	publishSensor(acSensor, mu->pvSensor(), sensorSettings);
+	emit deviceConnected();
 }
 
 void AcSensorMediator::onConnectionLost()
@@ -117,8 +165,8 @@ void AcSensorMediator::onServiceTypeChanged()
 	// Deleting and recreating the bridge will force recreation of the D-Bus
 	// service with another name.
 	delete bridge;
-	AcSensorUpdater *updater = acSensor->findChild<AcSensorUpdater *>();
-	AcSensor *pvSensor = updater->pvSensor();
+	AcSensorReceiver *receiver = acSensor->findChild<AcSensorReceiver *>();
+	AcSensor *pvSensor = receiver->pvSensor();
 	// Just in case pvInverterOnPhase2 was set, in which case we have two bridge objects.
 	delete pvSensor->findChild<AcSensorBridge *>();
 	publishSensor(acSensor, pvSensor, sensorSettings);
@@ -134,12 +182,17 @@ void AcSensorMediator::publishSensor(AcSensor *acSensor, AcSensor *pvSensor,
 
 void AcSensorMediator::registerDevice(const QString &serial)
 {
-	if (mDeviceIds.isEmpty()) {
-		QString ids = mDeviceIdsItem->getValue().toString();
-		mDeviceIds = ids.split(',', QString::SkipEmptyParts);
+	// The mediators of the other ports store their devices in the same
+	// setting, so start from its current value. The devices registered here
+	// are added as well, in case the setting has not been updated yet.
+	if (!mDeviceIds.contains(serial))
+		mDeviceIds.append(serial);
+	QStringList ids = mDeviceIdsItem->getValue().toString().split(',', QString::SkipEmptyParts);
+	int count = ids.size();
+	foreach (const QString &id, mDeviceIds) {
+		if (!ids.contains(id))
+			ids.append(id);
 	}
-	if (mDeviceIds.contains(serial))
-		return;
-	mDeviceIds.append(serial);
-	mDeviceIdsItem->setValue(mDeviceIds.join(","));
+	if (ids.size() != count)
+		mDeviceIdsItem->setValue(ids.join(","));
 }
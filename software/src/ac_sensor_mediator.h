@@ -7,7 +7,9 @@
 
 class AcSensor;
 class AcSensorSettings;
-class ModbusRtu;
+class Modbus;
+struct ModbusTimeouts;
+class QThread;
 class Settings;
 class VeQItem;
 
@@ -15,17 +17,34 @@ class AcSensorMediator : public QObject
 {
 	Q_OBJECT
 public:
-	AcSensorMediator(const QString &portName, int timeout, bool isZigbee, VeQItem *settingsRoot,
+	AcSensorMediator(const QString &portName, const ModbusTimeouts &timeouts, bool isZigbee, VeQItem *settingsRoot,
 					 QObject *parent = 0);
 
+	~AcSensorMediator();
+
+	QString portName() const
+	{
+		return mPortName;
+	}
+
 signals:
 	void gridMeterChanged();
 
-	void serialEvent(const char *);
+	void serialEvent(const QString &description);
 
 	void connectionLost();
 
+	/*!
+	 * Emitted when an energy meter on the port has been initialized, and its
+	 * values are being published on the D-Bus.
+	 */
+	void deviceConnected();
+
 private slots:
+	void onSlaveFound(int slaveAddress);
+
+	void onScanFinished(int count);
+
 	void onDeviceFound();
 
 	void onDeviceSettingsInitialized();
@@ -43,9 +62,13 @@ private:
 
 	void registerDevice(const QString &serial);
 
+	QString mPortName;
 	QList<AcSensor *> mAcSensors;
-	ModbusRtu *mModbus;
+	QThread *mThread;
+	Modbus *mModbus;
+	bool mIsZigbee;
 	VeQItem *mDeviceIdsItem;
+	/// Serials of the devices found on this port (see `registerDevice`).
 	QStringList mDeviceIds;
 };
 
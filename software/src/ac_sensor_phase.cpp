@@ -1,4 +1,5 @@
 #include <qmath.h>
+#include <string.h>
 #include "defines.h"
 #include "ac_sensor_phase.h"
 
@@ -9,6 +10,7 @@ AcSensorPhase::AcSensorPhase(QObject *parent) :
 	mPower(qQNaN()),
 	mEnergyForward(qQNaN())
 {
+	memset(mRequestTimes, 0, sizeof(mRequestTimes));
 }
 
 void AcSensorPhase::setCurrent(double c)
@@ -51,8 +53,23 @@ void AcSensorPhase::setEnergyReverse(double e)
 	emit energyReverseChanged();
 }
 
+qint64 AcSensorPhase::requestTime(ParameterType parameter) const
+{
+	if (parameter < 0 || parameter > NegativeEnergy)
+		return 0;
+	return mRequestTimes[parameter];
+}
+
+void AcSensorPhase::setRequestTime(ParameterType parameter, qint64 t)
+{
+	if (parameter < 0 || parameter > NegativeEnergy)
+		return;
+	mRequestTimes[parameter] = t;
+}
+
 void AcSensorPhase::resetValues()
 {
+	memset(mRequestTimes, 0, sizeof(mRequestTimes));
 	setCurrent(qQNaN());
 	setPower(qQNaN());
 	setVoltage(qQNaN());
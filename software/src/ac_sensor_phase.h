@@ -3,6 +3,7 @@
 
 #include <QObject>
 #include <QTime>
+#include "defines.h"
 
 /*!
  * Contains measurement data from an single AC sensor phase.
@@ -53,6 +54,14 @@ public:
 
 	void setEnergyReverse(double e);
 
+	/*!
+	 * Returns the time (see `monotonicTime`) at which the current value of
+	 * `parameter` was requested from the energy meter, or 0 if unknown.
+	 */
+	qint64 requestTime(ParameterType parameter) const;
+
+	void setRequestTime(ParameterType parameter, qint64 t);
+
 	/*!
 	 * @brief Reset all measured values to NaN
 	 */
@@ -77,6 +86,7 @@ private:
 	double mPower;
 	double mEnergyForward;
 	double mEnergyReverse;
+	qint64 mRequestTimes[NegativeEnergy + 1];
 };
 
 #endif // POWER_INFO_H
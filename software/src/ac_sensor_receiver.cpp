@@ -0,0 +1,270 @@
+#include <QsLog.h>
+#include <QTimer>
+#include "ac_sensor.h"
+#include "ac_sensor_phase.h"
+#include "ac_sensor_receiver.h"
+#include "ac_sensor_settings.h"
+#include "ac_sensor_updater.h"
+#include "data_processor.h"
+#include "latency_statistics.h"
+
+static const int UpdateSettingsInterval = 10 * 60 * 1000; // 10 minutes in ms
+
+AcSensorReceiver::AcSensorReceiver(AcSensor *acSensor, AcSensor *acPvSensor,
+								   AcSensorUpdater *updater, QObject *parent):
+	QObject(parent),
+	mAcSensor(acSensor),
+	mAcPvSensor(acPvSensor),
+	mUpdater(updater),
+	mSettings(0),
+	mDataProcessor(0),
+	mPvDataProcessor(0),
+	mSettingsUpdateTimer(new QTimer(this)),
+	mLastRequestedAt(0)
+{
+	Q_ASSERT(acSensor != 0);
+	Q_ASSERT(acPvSensor != 0);
+	Q_ASSERT(acSensor->slaveAddress() == acPvSensor->slaveAddress());
+	Q_ASSERT(acSensor->slaveAddress() == updater->slaveAddress());
+	connect(mUpdater, SIGNAL(connectionStateChanged(ConnectionState)),
+			this, SLOT(onConnectionStateChanged(ConnectionState)));
+	connect(mUpdater, SIGNAL(deviceIdentified(int, int, QString, int, int)),
+			this, SLOT(onDeviceIdentified(int, int, QString, int, int)));
+	connect(mUpdater, SIGNAL(errorCodeChanged(int)),
+			this, SLOT(onErrorCodeChanged(int)));
+	connect(mUpdater, SIGNAL(measurementsAvailable()),
+			this, SLOT(onMeasurementsAvailable()));
+	connect(mSettingsUpdateTimer, SIGNAL(timeout()),
+			this, SLOT(onUpdateSettings()));
+	mSettingsUpdateTimer->setInterval(UpdateSettingsInterval);
+	mSettingsUpdateTimer->start();
+}
+
+void AcSensorReceiver::startMeasurements()
+{
+	if (mSettings == 0) {
+		QLOG_ERROR() << "Cannot start measurements before device has been detected";
+		return;
+	}
+	onAcquisitionModeChanged();
+	QMetaObject::invokeMethod(mUpdater, "startMeasurements", Qt::QueuedConnection,
+							  Q_ARG(bool, mSettings->isMultiPhase()),
+							  Q_ARG(bool, mSettings->piggyEnabled()));
+}
+
+void AcSensorReceiver::onConnectionStateChanged(ConnectionState state)
+{
+	// Make sure all values retrieved before the state change are processed
+	// first.
+	processMeasurements();
+	switch (state) {
+	case Disconnected:
+		deleteSettings();
+		mAcSensor->setSerial(QString());
+		mAcSensor->resetValues();
+		mAcSensor->setConnectionState(Disconnected);
+		mAcPvSensor->setSerial(QString());
+		mAcPvSensor->resetValues();
+		mAcPvSensor->setConnectionState(Disconnected);
+		break;
+	case Searched:
+		mAcSensor->setConnectionState(Searched);
+		break;
+	case Detected:
+		createSettings();
+		mAcSensor->setConnectionState(Detected);
+		break;
+	case Connected:
+		mAcSensor->setConnectionState(Connected);
+		mAcPvSensor->setConnectionState(Connected);
+		break;
+	}
+}
+
+void AcSensorReceiver::onDeviceIdentified(int deviceType, int deviceSubType,
+										  const QString &serial, int firmwareVersion,
+										  int phaseSequence)
+{
+	mAcSensor->setDeviceType(deviceType);
+	mAcSensor->setDeviceSubType(deviceSubType);
+	mAcSensor->setSerial(serial);
+	mAcSensor->setFirmwareVersion(firmwareVersion);
+	mAcSensor->setPhaseSequence(phaseSequence);
+	mAcPvSensor->setDeviceType(deviceType);
+	mAcPvSensor->setDeviceSubType(deviceSubType);
+	mAcPvSensor->setSerial(serial);
+	mAcPvSensor->setFirmwareVersion(firmwareVersion);
+}
+
+void AcSensorReceiver::onErrorCodeChanged(int errorCode)
+{
+	mAcSensor->setErrorCode(errorCode);
+	mAcPvSensor->setErrorCode(errorCode);
+}
+
+void AcSensorReceiver::onMeasurementsAvailable()
+{
+	processMeasurements();
+}
+
+void AcSensorReceiver::onUpdateSettings()
+{
+	if (mDataProcessor != 0)
+		mDataProcessor->updateEnergySettings();
+	if (mPvDataProcessor != 0)
+		mPvDataProcessor->updateEnergySettings();
+}
+
+void AcSensorReceiver::onSetupChanged()
+{
+	QMetaObject::invokeMethod(mUpdater, "updateSetup", Qt::QueuedConnection,
+							  Q_ARG(bool, mSettings->isMultiPhase()),
+							  Q_ARG(bool, mSettings->piggyEnabled()));
+}
+
+void AcSensorReceiver::onAcquisitionModeChanged()
+{
+	bool isGridMeter = mSettings->serviceType() == "grid";
+	QMetaObject::invokeMethod(mUpdater, "setGridMeter", Qt::QueuedConnection,
+							  Q_ARG(bool, isGridMeter));
+	QMetaObject::invokeMethod(mUpdater, "setLowLatency", Qt::QueuedConnection,
+							  Q_ARG(bool, isGridMeter && mSettings->lowLatency()));
+}
+
+void AcSensorReceiver::processMeasurements()
+{
+	// Clear the flag before emptying the queue, so the updater will notify us
+	// again if a value is added after we're done.
+	mUpdater->clearMeasurementsPending();
+	MeasurementQueue *queue = mUpdater->measurements();
+	MeasurementSample sample;
+	while (queue->pop(sample))
+		processMeasurement(sample);
+}
+
+void AcSensorReceiver::processMeasurement(const MeasurementSample &sample)
+{
+	switch (sample.parameter) {
+	case None:
+		mAcSensor->resetValues();
+		mAcPvSensor->resetValues();
+		return;
+	case ResponseTime:
+		mAcSensor->setResponseTime(sample.value);
+		mAcPvSensor->setResponseTime(sample.value);
+		return;
+	case ResponseTimeout:
+		mAcSensor->setResponseTimeout(qRound(sample.value));
+		mAcPvSensor->setResponseTimeout(qRound(sample.value));
+		return;
+	default:
+		break;
+	}
+	if (mSettings == 0)
+		return;
+	Phase phase = sample.phase;
+	DataProcessor *dest = mDataProcessor;
+	AcSensor *sensor = mAcSensor;
+	if (mSettings->piggyEnabled()) {
+		if (phase == PhaseL2) {
+			dest = mPvDataProcessor;
+			sensor = mAcPvSensor;
+		}
+		phase = MultiPhase;
+	}
+	// All values from a single response have the same timestamps, so add the
+	// time needed to get the response only once.
+	if (sample.requestedAt != mLastRequestedAt) {
+		mLastRequestedAt = sample.requestedAt;
+		sensor->modbusLatency()->add(sample.receivedAt - sample.requestedAt);
+	}
+	if (!mSettings->isMultiPhase() && phase != MultiPhase)
+		return;
+	bool setPhaseL1 = phase == MultiPhase && !mSettings->isMultiPhase();
+	// Set the request time before the value: in low latency mode the setters
+	// publish the value at once, and the latency is computed from the request
+	// time (see `AcSensorBridge::valuePublished`).
+	sensor->getPhase(phase)->setRequestTime(sample.parameter, sample.requestedAt);
+	if (setPhaseL1)
+		sensor->l1()->setRequestTime(sample.parameter, sample.requestedAt);
+	double v = sample.value;
+	switch (sample.parameter) {
+	case Power:
+		dest->setPower(phase, v);
+		if (setPhaseL1)
+			dest->setPower(PhaseL1, v);
+		break;
+	case Voltage:
+		dest->setVoltage(phase, v);
+		if (setPhaseL1)
+			dest->setVoltage(PhaseL1, v);
+		break;
+	case Current:
+		// Some grid meters return a negative current on backfeed, others
+		// don't. In case the meter does not (EM24), we correct the sign of the
+		// current using the sign of the power.
+		if (mAcSensor->protocolType() == AcSensor::Em24Protocol &&
+			dest == mDataProcessor &&
+			mAcSensor->getPhase(phase)->power() < 0) {
+			v = -v;
+		}
+		dest->setCurrent(phase, v);
+		if (setPhaseL1)
+			dest->setCurrent(PhaseL1, v);
+		if (mSettings->isMultiPhase() && phase == PhaseL3) {
+			sensor->total()->setRequestTime(Current, sample.requestedAt);
+			dest->setCurrent(MultiPhase,
+				mAcSensor->l1()->current() +
+				mAcSensor->l2()->current() +
+				mAcSensor->l3()->current());
+		}
+		break;
+	case PositiveEnergy:
+		dest->setPositiveEnergy(phase, v);
+		if (setPhaseL1)
+			dest->setPositiveEnergy(PhaseL1, v);
+		break;
+	case NegativeEnergy:
+		if (mAcSensor->protocolType() == AcSensor::Em24Protocol &&
+			mSettings->isMultiPhase()) {
+			// The total is distributed over the phases.
+			sensor->l1()->setRequestTime(NegativeEnergy, sample.requestedAt);
+			sensor->l2()->setRequestTime(NegativeEnergy, sample.requestedAt);
+			sensor->l3()->setRequestTime(NegativeEnergy, sample.requestedAt);
+			dest->setNegativeEnergy(v);
+		} else {
+			dest->setNegativeEnergy(phase, v);
+			if (setPhaseL1)
+				dest->setNegativeEnergy(PhaseL1, v);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void AcSensorReceiver::createSettings()
+{
+	Q_ASSERT(mSettings == 0);
+	mSettings = new AcSensorSettings(mAcSensor->deviceType(), mAcSensor->serial(), mAcSensor);
+	mDataProcessor = new DataProcessor(mAcSensor, mSettings, this);
+	mPvDataProcessor = new DataProcessor(mAcPvSensor, mSettings, this);
+	connect(mSettings, SIGNAL(isMultiPhaseChanged()),
+			this, SLOT(onSetupChanged()));
+	connect(mSettings, SIGNAL(l2ClassAndVrmInstanceChanged()),
+			this, SLOT(onSetupChanged()));
+	connect(mSettings, SIGNAL(classAndVrmInstanceChanged()),
+			this, SLOT(onAcquisitionModeChanged()));
+	connect(mSettings, SIGNAL(lowLatencyChanged()),
+			this, SLOT(onAcquisitionModeChanged()));
+}
+
+void AcSensorReceiver::deleteSettings()
+{
+	delete mSettings;
+	mSettings = 0;
+	delete mDataProcessor;
+	mDataProcessor = 0;
+	delete mPvDataProcessor;
+	mPvDataProcessor = 0;
+}
@@ -0,0 +1,104 @@
+#ifndef AC_SENSOR_RECEIVER_H
+#define AC_SENSOR_RECEIVER_H
+
+#include <QObject>
+#include "ac_sensor.h"
+#include "defines.h"
+
+class AcSensorSettings;
+class AcSensorUpdater;
+class DataProcessor;
+class QTimer;
+struct MeasurementSample;
+
+/*!
+ * Stores the information retrieved by an `AcSensorUpdater` in `AcSensor`
+ * objects.
+ *
+ * The updater runs in the I/O thread of the communication port, while this
+ * object lives in the thread of the D-Bus objects. Identity and connection
+ * state are received through queued signals, measured values are taken from
+ * the lock-free queue of the updater. This way a slow D-Bus call will never
+ * delay communication with the energy meter.
+ *
+ * When a device has been detected, the receiver will create the settings
+ * object of the device and set the `connectionState` of the `AcSensor` to
+ * `Detected`. Measurements will not start until `startMeasurements` is called.
+ */
+class AcSensorReceiver : public QObject
+{
+	Q_OBJECT
+public:
+	AcSensorReceiver(AcSensor *acSensor, AcSensor *acPvSensor, AcSensorUpdater *updater,
+					 QObject *parent = 0);
+
+	AcSensor *acSensor()
+	{
+		return mAcSensor;
+	}
+
+	AcSensor *pvSensor()
+	{
+		return mAcPvSensor;
+	}
+
+	/*!
+	 * Returns the settings object.
+	 * This object is created when a device has been detected. It will be null
+	 * while the `connectionState` of the `AcSensor` is `Disconnected` or
+	 * `Searched`.
+	 * The information in the settings will be used for data retrieval and can
+	 * be changed while retrieval is active. This may lead to reinitialization
+	 * of the updater (and the energy meter itself).
+	 */
+	AcSensorSettings *settings()
+	{
+		return mSettings;
+	}
+
+	/*!
+	 * Starts actual measurement.
+	 * This function should be called if the `connectionState` is `Detected`
+	 * or later. It was intended to allow the user of this class to change the
+	 * settings before starting measurements.
+	 */
+	void startMeasurements();
+
+private slots:
+	void onConnectionStateChanged(ConnectionState state);
+
+	void onDeviceIdentified(int deviceType, int deviceSubType, const QString &serial,
+							int firmwareVersion, int phaseSequence);
+
+	void onErrorCodeChanged(int errorCode);
+
+	void onMeasurementsAvailable();
+
+	void onUpdateSettings();
+
+	void onSetupChanged();
+
+	void onAcquisitionModeChanged();
+
+private:
+	void processMeasurements();
+
+	void processMeasurement(const MeasurementSample &sample);
+
+	void createSettings();
+
+	void deleteSettings();
+
+	AcSensor *mAcSensor;
+	AcSensor *mAcPvSensor;
+	AcSensorUpdater *mUpdater;
+	AcSensorSettings *mSettings;
+	DataProcessor *mDataProcessor;
+	DataProcessor *mPvDataProcessor;
+	QTimer *mSettingsUpdateTimer;
+	/// Request time of the last sample, used to add the response time of
+	/// each request to the latency statistics once.
+	qint64 mLastRequestedAt;
+};
+
+#endif // AC_SENSOR_RECEIVER_H
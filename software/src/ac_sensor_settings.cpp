@@ -9,6 +9,11 @@ AcSensorSettings::AcSensorSettings(int deviceType, const QString &serial,
 	mSerial(serial),
 	mIsMultiPhase(false),
 	mPiggyEnabled(false),
+	mLowLatency(false),
+	mPowerDeadband(-1),
+	mRelativePowerDeadband(-1),
+	mCurrentDeadband(-1),
+	mVoltageDeadband(-1),
 	mPosition(Input1),
 	mL1Energy(0),
 	mL2Energy(0),
@@ -67,6 +72,46 @@ void AcSensorSettings::setPiggyEnabled(bool b)
 	emit piggyEnabledChanged();
 }
 
+void AcSensorSettings::setLowLatency(bool b)
+{
+	if (mLowLatency == b)
+		return;
+	mLowLatency = b;
+	emit lowLatencyChanged();
+}
+
+void AcSensorSettings::setPowerDeadband(double d)
+{
+	if (mPowerDeadband == d)
+		return;
+	mPowerDeadband = d;
+	emit powerDeadbandChanged();
+}
+
+void AcSensorSettings::setRelativePowerDeadband(double d)
+{
+	if (mRelativePowerDeadband == d)
+		return;
+	mRelativePowerDeadband = d;
+	emit relativePowerDeadbandChanged();
+}
+
+void AcSensorSettings::setCurrentDeadband(double d)
+{
+	if (mCurrentDeadband == d)
+		return;
+	mCurrentDeadband = d;
+	emit currentDeadbandChanged();
+}
+
+void AcSensorSettings::setVoltageDeadband(double d)
+{
+	if (mVoltageDeadband == d)
+		return;
+	mVoltageDeadband = d;
+	emit voltageDeadbandChanged();
+}
+
 const QString AcSensorSettings::l2CustomName() const
 {
 	return mL2CustomName;
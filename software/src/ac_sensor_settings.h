@@ -21,6 +21,11 @@ class AcSensorSettings : public QObject
 	Q_PROPERTY(QString l2ClassAndVrmInstance READ l2ClassAndVrmInstance WRITE setL2ClassAndVrmInstance NOTIFY l2ClassAndVrmInstanceChanged)
 	Q_PROPERTY(bool isMultiPhase READ isMultiPhase WRITE setIsMultiPhase NOTIFY isMultiPhaseChanged)
 	Q_PROPERTY(bool piggyEnabled READ piggyEnabled WRITE setPiggyEnabled NOTIFY piggyEnabledChanged)
+	Q_PROPERTY(bool lowLatency READ lowLatency WRITE setLowLatency NOTIFY lowLatencyChanged)
+	Q_PROPERTY(double powerDeadband READ powerDeadband WRITE setPowerDeadband NOTIFY powerDeadbandChanged)
+	Q_PROPERTY(double relativePowerDeadband READ relativePowerDeadband WRITE setRelativePowerDeadband NOTIFY relativePowerDeadbandChanged)
+	Q_PROPERTY(double currentDeadband READ currentDeadband WRITE setCurrentDeadband NOTIFY currentDeadbandChanged)
+	Q_PROPERTY(double voltageDeadband READ voltageDeadband WRITE setVoltageDeadband NOTIFY voltageDeadbandChanged)
 	Q_PROPERTY(Position position READ position WRITE setPosition NOTIFY positionChanged)
 	Q_PROPERTY(int deviceInstance READ deviceInstance)
 	Q_PROPERTY(double l1ReverseEnergy READ l1ReverseEnergy WRITE setL1ReverseEnergy NOTIFY l1ReverseEnergyChanged)
@@ -99,6 +104,63 @@ public:
 
 	void setIsMultiPhase(bool b);
 
+	/*!
+	 * If set, and the meter is used as grid meter, power is read as often as
+	 * the bus allows, and published on the D-Bus without delay.
+	 */
+	bool lowLatency() const
+	{
+		return mLowLatency;
+	}
+
+	void setLowLatency(bool b);
+
+	/*!
+	 * Changes of the power (W) smaller than this value are not published on
+	 * the D-Bus (see `DBusBridge::setDeadband`). If negative, the default
+	 * deadband is used.
+	 */
+	double powerDeadband() const
+	{
+		return mPowerDeadband;
+	}
+
+	void setPowerDeadband(double d);
+
+	/*!
+	 * Changes of the power smaller than this fraction of the last published
+	 * power are not published either. If negative, the default is used, unless
+	 * `powerDeadband` has been set.
+	 */
+	double relativePowerDeadband() const
+	{
+		return mRelativePowerDeadband;
+	}
+
+	void setRelativePowerDeadband(double d);
+
+	/*!
+	 * Changes of the current (A) smaller than this value are not published. If
+	 * negative, the default deadband is used.
+	 */
+	double currentDeadband() const
+	{
+		return mCurrentDeadband;
+	}
+
+	void setCurrentDeadband(double d);
+
+	/*!
+	 * Changes of the voltage (V) smaller than this value are not published. If
+	 * negative, the default deadband is used.
+	 */
+	double voltageDeadband() const
+	{
+		return mVoltageDeadband;
+	}
+
+	void setVoltageDeadband(double d);
+
 	const QString l2CustomName() const;
 
 	void setL2CustomName(const QString &v);
@@ -150,6 +212,16 @@ signals:
 
 	void piggyEnabledChanged();
 
+	void lowLatencyChanged();
+
+	void powerDeadbandChanged();
+
+	void relativePowerDeadbandChanged();
+
+	void currentDeadbandChanged();
+
+	void voltageDeadbandChanged();
+
 	void hub4ModeChanged();
 
 	void positionChanged();
@@ -178,6 +250,11 @@ private:
 	QString mL2ClassAndVrmInstance;
 	bool mIsMultiPhase;
 	bool mPiggyEnabled;
+	bool mLowLatency;
+	double mPowerDeadband;
+	double mRelativePowerDeadband;
+	double mCurrentDeadband;
+	double mVoltageDeadband;
 	Position mPosition;
 	double mL1Energy;
 	double mL2Energy;
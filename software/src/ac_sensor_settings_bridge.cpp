@@ -42,6 +42,16 @@ AcSensorSettingsBridge::AcSensorSettingsBridge(AcSensorSettings *settings, QObje
 			primaryPath + "/L3ReverseEnergy", true);
 	consume(settings, "supportMultiphase", QVariant(static_cast<int>(settings->supportMultiphase())),
 			primaryPath + "/SupportMultiphase", false);
+	consume(settings, "lowLatency", QVariant(0),
+			primaryPath + "/LowLatency", false);
+	consume(settings, "powerDeadband", -1.0, -1.0, 1000.0,
+			primaryPath + "/PowerDeadband", false);
+	consume(settings, "relativePowerDeadband", -1.0, -1.0, 1.0,
+			primaryPath + "/RelativePowerDeadband", false);
+	consume(settings, "currentDeadband", -1.0, -1.0, 100.0,
+			primaryPath + "/CurrentDeadband", false);
+	consume(settings, "voltageDeadband", -1.0, -1.0, 100.0,
+			primaryPath + "/VoltageDeadband", false);
 
 	consume(settings, "l2ClassAndVrmInstance",
 			secondaryPath + "/ClassAndVrmInstance");
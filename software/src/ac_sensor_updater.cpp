@@ -1,12 +1,12 @@
 #include <cmath>
+#include <QMap>
 #include <QsLog.h>
+#include <QtAlgorithms>
 #include <QTimer>
 #include "ac_sensor.h"
-#include "ac_sensor_settings.h"
 #include "ac_sensor_updater.h"
-#include "data_processor.h"
-#include "modbus_rtu.h"
-#include "ac_sensor_phase.h"
+#include "modbus.h"
+#include "register_maps.h"
 
 static const int MeasurementSystemP1 = 3; // single phase (1P)
 static const int MeasurementSystemP2 = 2; // 2 phase (2P)
@@ -17,8 +17,22 @@ static const int MeasurementSystemP3 = 0; // 3 phase (3Pn)
 static const int MeasurementModeB = 1;
 
 static const int ApplicationH = 7; // show negative power (EM24)
-static const int MaxAcquisitionIndex = 16;
-static const int MaxRegCount = 5;
+/// Maximum number of registers in a single read request (EM24 protocol
+/// specification).
+static const int Em24MaxBlockRegCount = 11;
+/// Maximum number of registers in a single read request (EM100/ET100 and
+/// EM300/ET300 protocol specification).
+static const int Em340MaxBlockRegCount = 50;
+Q_STATIC_ASSERT(Em24MaxBlockRegCount <= Modbus::MaxRegisterCount);
+Q_STATIC_ASSERT(Em340MaxBlockRegCount <= Modbus::MaxRegisterCount);
+// A read of MaxRegCount adjacent values must fit in a single EM24 request.
+Q_STATIC_ASSERT(2 * MaxRegCount <= Em24MaxBlockRegCount);
+/// Maximum number of unused registers between two commands that are merged
+/// into a single read request. A meter typically needs 40ms to answer a
+/// request, which is about the time needed to send 20 registers at 9600
+/// baud, so reading a few registers we do not need is cheaper than an extra
+/// round trip.
+static const int MaxBlockGap = 6;
 static const int MaxTimeoutCount = 5;
 static const int MaxErrorCount = 20;
 
@@ -28,140 +42,88 @@ static const int ErrorFronSelectorLocked = 1;
 static const int FrontSelectorWaitInterval = 5 * 1000; // 5 seconds in ms
 static const int ReconnectInterval = 15 * 1000;  // 15 seconds in ms
 static const int ZigbeeReconnectInterval = 30 * 1000;  // 30 seconds in ms
-static const int UpdateSettingsInterval = 10 * 60 * 1000; // 10 minutes in ms
-
-enum ParameterType {
-	None,
-	Dummy,
-	Power,
-	Voltage,
-	Current,
-	PositiveEnergy,
-	NegativeEnergy
-};
-
-struct RegisterCommand {
-	int regOffset;
-	ParameterType action;
-	Phase phase;
-};
-
-struct CompositeCommand {
-	int reg;
-	int interval;
-	RegisterCommand actions[MaxRegCount];
-};
-
-static const CompositeCommand Em24Commands[] = {
-	{ 0x0028, 0, { { 0, Power, MultiPhase } } },
-	{ 0x0012, 0, { { 0, Power, PhaseL1 }, { 2, Power, PhaseL2 }, { 4, Power, PhaseL3 } } },
-	{ 0x0024, 2, { { 0, Voltage, MultiPhase } } },
-	{ 0x0000, 4, { { 0, Voltage, PhaseL1 }, { 2, Voltage, PhaseL2 }, { 4, Voltage, PhaseL3 } } },
-	{ 0x000C, 8, { { 0, Current, PhaseL1 }, { 2, Current, PhaseL2 }, { 4, Current, PhaseL3 } } },
-	{ 0x003E, 10, { { 0, PositiveEnergy, MultiPhase } } },
-	{ 0x0046, 12, { { 0, PositiveEnergy, PhaseL1 }, { 2, PositiveEnergy, PhaseL2 }, { 4, PositiveEnergy, PhaseL3 } } },
-	{ 0x005C, 14, { { 0, NegativeEnergy, MultiPhase } } }
-};
-
-static const int Em24CommandCount = sizeof(Em24Commands) / sizeof(Em24Commands[0]);
-
-/// We use dummy commands here to vary the number of requested registers. This
-/// way we avoid problems if a response to a modbus request arrives too late.
-/// This may happen when sending modbus packages over zigbee.
-/// If that happens the packages will be interpreted incorrect (eg. voltage
-/// values as power). By varying the number of registers it easier to detect
-/// late packets.
-static const CompositeCommand Em24CommandsP1[] = {
-	{ 0x0028, 0, { { 0, Power, MultiPhase } } },
-	{ 0x0024, 2, { { 0, Voltage, MultiPhase }, { 1, Dummy, MultiPhase } } },
-	{ 0x000C, 8, { { 0, Current, MultiPhase }, { 1, Dummy, MultiPhase } } },
-	{ 0x003E, 10, { { 0, PositiveEnergy, MultiPhase }, { 1, Dummy, MultiPhase } } },
-	{ 0x005C, 14, { { 0, NegativeEnergy, MultiPhase }, { 1, Dummy, MultiPhase } } }
-};
-
-static const int Em24CommandP1Count = sizeof(Em24CommandsP1) / sizeof(Em24CommandsP1[0]);
-
-static const CompositeCommand Em24CommandsP1PV[] = {
-	{ 0x0012, 0, { { 0, Power, PhaseL1 } } },
-	{ 0x0014, 2, { { 0, Power, PhaseL2 }, { 1, Dummy, MultiPhase } } },
-	{ 0x0000, 4, { { 0, Voltage, PhaseL1 }, { 2, Voltage, PhaseL2 } } },
-	{ 0x000C, 6, { { 0, Current, PhaseL1 }, { 2, Current, PhaseL2 } } },
-	{ 0x0046, 8, { { 0, PositiveEnergy, PhaseL1 }, { 2, PositiveEnergy, PhaseL2 } } },
-	// Note that NegativeEnergy will give us the energy of all phases. Right now
-	// we assume that in case of a shared system L1 is a grid meter and L2 a
-	// PV inverter (which always has ReverseEnergy=0 because power and current
-	// are always positive).
-	{ 0x005C, 10, { { 0, NegativeEnergy, PhaseL1 }, { 1, Dummy, MultiPhase } } }
-};
-
-static const int Em24CommandsP1PVCount = sizeof(Em24CommandsP1PV) / sizeof(Em24CommandsP1PV[0]);
-
-static const CompositeCommand Em112Commands[] = {
-	{ 0x0004, 0, { { 0, Power, MultiPhase } } },
-	{ 0x0000, 4, { { 0, Voltage, MultiPhase }, { 2, Current, MultiPhase } } },
-	{ 0x0010, 8, { { 0, PositiveEnergy, MultiPhase }, { 1, Dummy, MultiPhase } } },
-	{ 0x0020, 12, { { 0, NegativeEnergy, MultiPhase }, { 1, Dummy, MultiPhase } } }
-};
-
-static const int Em112CommandCount = sizeof(Em112Commands) / sizeof(Em112Commands[0]);
-
-static const CompositeCommand Em340Commands[] = {
-	{ 0x0028, 0, { { 0, Power, MultiPhase } } },
-	{ 0x0012, 0, { { 0, Power, PhaseL1 }, { 2, Power, PhaseL2 }, { 4, Power, PhaseL3 } } },
-	{ 0x0024, 1, { { 0, Voltage, MultiPhase }, { 2, Dummy, MultiPhase } } },
-	{ 0x0000, 2, { { 0, Voltage, PhaseL1 }, { 2, Voltage, PhaseL2 }, { 4, Voltage, PhaseL3 }, {6, Dummy, MultiPhase } } },
-	{ 0x000C, 4, { { 0, Current, PhaseL1 }, { 2, Current, PhaseL2 }, { 4, Current, PhaseL3 }, {6, Dummy, MultiPhase } } },
-	{ 0x0034, 6, { { 0, PositiveEnergy, MultiPhase }, { 2, Dummy, MultiPhase } } },
-	{ 0x0040, 8, { { 0, PositiveEnergy, PhaseL1 }, { 2, PositiveEnergy, PhaseL2 }, { 4, PositiveEnergy, PhaseL3 }, {6, Dummy, MultiPhase } } },
-	{ 0x004E, 10, { { 0, NegativeEnergy, MultiPhase }, { 2, Dummy, MultiPhase } } },
-	{ 0x0060, 12, { { 0, NegativeEnergy, PhaseL1 }, { 2, NegativeEnergy, PhaseL2 }, { 4, NegativeEnergy, PhaseL3 }, {6, Dummy, MultiPhase } } },
-};
-
-static const int Em340CommandCount = sizeof(Em340Commands) / sizeof(Em340Commands[0]);
-
-static const CompositeCommand Em340P1Commands[] = {
-	{ 0x0012, 0, { { 0, Power, MultiPhase } } },
-	{ 0x0000, 1, { { 0, Voltage, MultiPhase }, { 1, Dummy, MultiPhase } } },
-	{ 0x000C, 3, { { 0, Current, MultiPhase }, { 1, Dummy, MultiPhase } } },
-	{ 0x0040, 5, { { 0, PositiveEnergy, MultiPhase }, { 1, Dummy, MultiPhase } } },
-	{ 0x0060, 7, { { 0, NegativeEnergy, MultiPhase }, { 1, Dummy, MultiPhase } } },
-};
-
-static const int Em340P1CommandCount = sizeof(Em340P1Commands) / sizeof(Em340P1Commands[0]);
-
-static const CompositeCommand Em340CommandsP1PV[] = {
-	{ 0x0012, 0, { { 0, Power, PhaseL1 } } },
-	{ 0x0014, 2, { { 0, Power, PhaseL2 }, { 1, Dummy, MultiPhase } } },
-	{ 0x0000, 4, { { 0, Voltage, PhaseL1 }, { 2, Voltage, PhaseL2 } } },
-	{ 0x000C, 6, { { 0, Current, PhaseL1 }, { 2, Current, PhaseL2 } } },
-	{ 0x0040, 8, { { 0, PositiveEnergy, PhaseL1 }, { 2, PositiveEnergy, PhaseL2 } } },
-	{ 0x0060, 10, { { 0, NegativeEnergy, PhaseL1 }, { 2, NegativeEnergy, PhaseL2 } } }
-};
-
-static const int Em340CommandsP1PVCount = sizeof(Em340CommandsP1PV) / sizeof(Em340CommandsP1PV[0]);
-
-int getMaxOffset(const CompositeCommand &cmd) {
-	int maxOffset = 0;
-	for (int i=0; i<MaxRegCount; ++i) {
-		const RegisterCommand &ra = cmd.actions[i];
-		if (ra.action == None)
-			break;
-		maxOffset = qMax(maxOffset, ra.regOffset);
+static const int ResponseTimeReportInterval = 5 * 1000; // 5 seconds in ms
+static const int PeriodReportInterval = 60 * 1000; // 1 minute in ms
+
+static int getQuantities(const CompositeCommand &cmd)
+{
+	int quantities = 0;
+	for (int i=0; i<cmd.actionCount; ++i) {
+		if (cmd.actions[i].action != Dummy)
+			quantities |= 1 << cmd.actions[i].action;
+	}
+	return quantities;
+}
+
+/*!
+ * Returns true if the command contains dummy values, which are only there to
+ * give the request a register count which differs from the other requests.
+ */
+static bool hasDummy(const CompositeCommand &cmd)
+{
+	for (int i=0; i<cmd.actionCount; ++i) {
+		if (cmd.actions[i].action == Dummy)
+			return true;
+	}
+	return false;
+}
+
+static int getMaxBlockRegCount(AcSensor::ProtocolTypes protocolType)
+{
+	switch (protocolType) {
+	case AcSensor::Em24Protocol:
+		return Em24MaxBlockRegCount;
+	case AcSensor::Et112Protocol:
+	case AcSensor::Em340Protocol:
+		return Em340MaxBlockRegCount;
+	default:
+		return 0;
+	}
+}
+
+static QString decodeSerial(const RegisterView &registers)
+{
+	QString serial;
+	for (int i=0; i<registers.size(); ++i) {
+		serial.append(registers[i] >> 8);
+		serial.append(registers[i] & 0xFF);
 	}
-	return maxOffset;
+	// Some grid meters (ET112, ET340) add zero values in the MSB's of the
+	// registers. Others (EM24) add zero padding at the end.
+	serial.remove(QChar(0));
+	return serial;
 }
 
-AcSensorUpdater::AcSensorUpdater(AcSensor *acSensor, AcSensor *acPvSensor, ModbusRtu *modbus,
+static bool commandLessThan(const CompositeCommand *c1, const CompositeCommand *c2)
+{
+	if (c1->period != c2->period)
+		return c1->period < c2->period;
+	return c1->reg < c2->reg;
+}
+
+static bool blockLessThan(const AcquisitionBlock &b1, const AcquisitionBlock &b2)
+{
+	return b1.commands.first() < b2.commands.first();
+}
+
+AcSensorUpdater::AcSensorUpdater(const QString &portName, int slaveAddress, Modbus *modbus,
 								 bool isZigbee, QObject *parent):
 	QObject(parent),
-	mDataProcessor(0),
-	mPvDataProcessor(0),
-	mAcSensor(acSensor),
-	mAcPvSensor(acPvSensor),
-	mSettings(0),
+	mPortName(portName),
+	mSlaveAddress(slaveAddress),
 	mModbus(0),
 	mAcquisitionTimer(new QTimer(this)),
-	mSettingsUpdateTimer(new QTimer(this)),
+	mReportTimer(new QTimer(this)),
+	mMeasurementsPending(0),
+	mConnectionState(Disconnected),
+	mDeviceType(0),
+	mDeviceSubType(0),
+	mFirmwareVersion(0),
+	mPhaseSequence(-1),
+	mIsMultiPhase(false),
+	mPiggyEnabled(false),
+	mIsGridMeter(false),
+	mLowLatency(false),
 	mTimeoutCount(0),
 	mErrorCount(0),
 	mMeasuringSystem(0),
@@ -169,58 +131,53 @@ AcSensorUpdater::AcSensorUpdater(AcSensor *acSensor, AcSensor *acPvSensor, Modbu
 	mIsZigbee(isZigbee),
 	mSetupRequested(false),
 	mApplication(0),
+	mRequestedAt(0),
+	mReceivedAt(0),
 	mState(DeviceId),
+	mIdentityCacheTried(false),
+	mIdentityFromCache(false),
+	mIdentityStored(false),
+	mRegisterMap(0),
 	mCommands(0),
 	mCommandCount(0),
-	mCommandIndex(0),
-	mAcquisitionIndex(0),
-	mSetCurrentSign(true)
+	mBlockIndex(0),
+	mNextResponseTimeReport(0),
+	mBlockReadsEnabled(true)
 {
-	Q_ASSERT(acSensor != 0);
-	Q_ASSERT(acPvSensor != 0);
-	Q_ASSERT(acSensor->slaveAddress() == acPvSensor->slaveAddress());
 	mModbus = modbus;
-	connect(mModbus, SIGNAL(readCompleted(int, quint8, const QList<quint16> &)),
-			this, SLOT(onReadCompleted(int, quint8, QList<quint16>)));
-	connect(mModbus, SIGNAL(writeCompleted(int, quint8, quint16, quint16)),
-			this, SLOT(onWriteCompleted(int, quint8, quint16, quint16)));
-	connect(mModbus, SIGNAL(errorReceived(int, quint8, int)),
-			this, SLOT(onErrorReceived(int, quint8, int)));
 	connect(mAcquisitionTimer, SIGNAL(timeout()),
 			this, SLOT(onWaitFinished()));
-	connect(mSettingsUpdateTimer, SIGNAL(timeout()),
-			this, SLOT(onUpdateSettings()));
-	mSettingsUpdateTimer->setInterval(UpdateSettingsInterval);
-	mSettingsUpdateTimer->start();
 	mAcquisitionTimer->setSingleShot(true);
-	mStopwatch.start();
-	startNextAction();
-}
-
-AcSensor *AcSensorUpdater::acSensor()
-{
-	return mAcSensor;
+	connect(mReportTimer, SIGNAL(timeout()),
+			this, SLOT(onReportPeriods()));
+	mReportTimer->setInterval(PeriodReportInterval);
 }
 
-AcSensor *AcSensorUpdater::pvSensor()
+void AcSensorUpdater::start()
 {
-	return mAcPvSensor;
-}
-
-AcSensorSettings *AcSensorUpdater::settings()
-{
-	return mSettings;
+	mModbus->setListener(static_cast<quint8>(mSlaveAddress), this);
+	mDetectionTimer.start();
+	mReportTimer->start();
+	startNextAction();
 }
 
-void AcSensorUpdater::startMeasurements()
+void AcSensorUpdater::startMeasurements(bool isMultiPhase, bool piggyEnabled)
 {
-	if (mSettings == 0 || mState != WaitForStart) {
+	if (mState != WaitForStart) {
 		QLOG_ERROR() << "Cannot start measurements before device has been detected";
 		return;
 	}
-	mAcquisitionIndex = 0;
-	mCommandIndex = 0;
-	switch (mAcSensor->protocolType()) {
+	mIsMultiPhase = isMultiPhase;
+	mPiggyEnabled = piggyEnabled;
+	updateRegisterMap();
+	mBlockIndex = 0;
+	if (mIdentityFromCache && mCachedIdentity.system == measuringSystem()) {
+		QLOG_INFO() << "Setup of" << mSerial << "taken from cache";
+		mState = Acquisition;
+		startNextAction();
+		return;
+	}
+	switch (protocolType()) {
 	case AcSensor::Em24Protocol:
 		mState = CheckSetup;
 		break;
@@ -236,27 +193,61 @@ void AcSensorUpdater::startMeasurements()
 	startNextAction();
 }
 
-void AcSensorUpdater::onErrorReceived(int errorType, quint8 addr, int exception)
+void AcSensorUpdater::updateSetup(bool isMultiPhase, bool piggyEnabled)
+{
+	mIsMultiPhase = isMultiPhase;
+	mPiggyEnabled = piggyEnabled;
+	updateRegisterMap();
+	mSetupRequested = true;
+}
+
+void AcSensorUpdater::setGridMeter(bool isGridMeter)
+{
+	mIsGridMeter = isGridMeter;
+}
+
+void AcSensorUpdater::setLowLatency(bool lowLatency)
 {
-	if (addr != mAcSensor->slaveAddress())
+	if (mLowLatency == lowLatency)
 		return;
+	QLOG_INFO() << "Low latency mode" << (lowLatency ? "enabled" : "disabled") << "for"
+				<< mPortName << ':' << mSlaveAddress;
+	mLowLatency = lowLatency;
+}
+
+void AcSensorUpdater::onErrorReceived(int errorType, int exception)
+{
 	QLOG_DEBUG() << "ModBus Error:" << errorType << exception
-				 << "State:" << mState << "Slave Address" << addr
-				 << "Acq State:" << mAcquisitionIndex
+				 << "State:" << mState << "Slave Address" << mSlaveAddress
+				 << "Block:" << mBlockIndex
 				 << "Timeout count:" << mTimeoutCount
 				 << "Error count:" << mErrorCount;
+	if (mState == VerifyIdentity) {
+		// The meter may have been replaced by one with another protocol, or
+		// may not be there at all. Both are handled by regular detection.
+		mState = DeviceId;
+		startNextAction();
+		return;
+	}
+	if (mState == Acquisition && mBlockReadsEnabled && !mPlan.isEmpty() &&
+		errorType == Modbus::Exception && exception == Modbus::IllegalDataAddress &&
+		mBlockIndex < mPlan.size() && mPlan[mBlockIndex].commands.size() > 1) {
+		// The merged request covers registers the meter does not support.
+		// Fall back to a separate request per command.
+		QLOG_WARN() << "Block read rejected by energy meter, using separate requests";
+		mBlockReadsEnabled = false;
+		mCommands = 0;
+	}
 	/* Deliberately treat all errors the same. Possible errors are Timeout,
-	 * Exception, Unsupported, CrcError. If we get any of these 5 times in a
-	 * row we should bail. */
+	 * Exception, Unsupported, ProtocolError, CrcError. If we get any of these
+	 * 5 times in a row we should bail. */
 	if ((mTimeoutCount >= MaxTimeoutCount) || (mErrorCount >= MaxErrorCount)) {
-		if (!mAcSensor->serial().isEmpty()) {
+		if (!mSerial.isEmpty()) {
 			QLOG_ERROR() << "Lost connection to energy meter"
-						 << mAcSensor->serial() << '@'
-						 << mAcSensor->portName() << ':'
-						 << mAcSensor->slaveAddress();
+						 << mSerial << '@' << mPortName << ':' << mSlaveAddress;
 		}
 		disconnectSensor();
-	} else if (errorType == ModbusRtu::Timeout) {
+	} else if (errorType == Modbus::Timeout) {
 		++mTimeoutCount;
 	} else {
 		++mErrorCount;
@@ -264,27 +255,22 @@ void AcSensorUpdater::onErrorReceived(int errorType, quint8 addr, int exception)
 	startNextAction();
 }
 
-void AcSensorUpdater::onReadCompleted(int function, quint8 addr, const QList<quint16> &registers)
+void AcSensorUpdater::onReadCompleted(int function, const RegisterView &registers)
 {
-	if (addr != mAcSensor->slaveAddress())
-		return;
 	Q_UNUSED(function)
 	switch (mState) {
 	case DeviceId:
 		QLOG_INFO() << "Device ID:" << registers[0];
-		mAcSensor->setDeviceType(registers[0]);
-		mAcPvSensor->setDeviceType(registers[0]);
-		switch (mAcSensor->protocolType()) {
+		mDeviceType = registers[0];
+		updateRegisterMap();
+		switch (protocolType()) {
 		case AcSensor::Em24Protocol:
-			mSetCurrentSign = true;
 			mState = VersionCode;
 			break;
 		case AcSensor::Et112Protocol:
-			mSetCurrentSign = false;
 			mState = Serial;
 			break;
 		case AcSensor::Em340Protocol:
-			mSetCurrentSign = false;
 			mState = Serial;
 			break;
 		case AcSensor::Unknown:
@@ -294,41 +280,31 @@ void AcSensorUpdater::onReadCompleted(int function, quint8 addr, const QList<qui
 		}
 		break;
 	case VersionCode:
-		mAcSensor->setDeviceSubType(registers[0]);
-		mAcPvSensor->setDeviceSubType(registers[0]);
+		mDeviceSubType = registers[0];
 		mState = Serial;
 		break;
 	case Serial:
 	{
 		Q_ASSERT(registers.size() == 7);
-		QString serial;
-		foreach (quint16 r, registers) {
-			serial.append(r >> 8);
-			serial.append(r & 0xFF);
-		}
-		// Some grid meters (ET112, ET340) add zero values in the MSB's of the
-		// registers. Others (EM24) add zero padding at the end.
-		serial.remove(QChar(0));
+		QString serial = decodeSerial(registers);
 		// Sometimes the serial reported contains this first character of the
 		// serial number only. If that happens we simulate a timeout to the
 		// detection process will be reset or aborted.
 		if (serial.size() < 2) {
 			QLOG_WARN() << "Incorrect serial reported:" << serial;
-			onErrorReceived(ModbusRtu::Timeout, mAcPvSensor->slaveAddress(), 0);
+			onErrorReceived(Modbus::Timeout, 0);
 			return;
 		}
-		mAcSensor->setSerial(serial);
-		mAcPvSensor->setSerial(serial);
+		mSerial = serial;
 		mState = FirmwareVersion;
 		break;
 	}
 	case FirmwareVersion:
-		mAcSensor->setFirmwareVersion(registers[0]);
-		mAcPvSensor->setFirmwareVersion(registers[0]);
+		mFirmwareVersion = registers[0];
 
 		// For meters that support it, read the phase sequence
-		if ((mAcSensor->protocolType() == AcSensor::Em24Protocol) ||
-				(mAcSensor->protocolType() == AcSensor::Em340Protocol)) {
+		if ((protocolType() == AcSensor::Em24Protocol) ||
+				(protocolType() == AcSensor::Em340Protocol)) {
 			mState = PhaseSequence;
 		} else {
 			mState = WaitForStart;
@@ -336,16 +312,32 @@ void AcSensorUpdater::onReadCompleted(int function, quint8 addr, const QList<qui
 		break;
 	case PhaseSequence:
 		{
-			int seq = (registers[0] == 0 ? PhaseSequenceOk : PhaseSequenceNotOk);
-			mAcSensor->setPhaseSequence(seq);
+			mPhaseSequence = (registers[0] == 0 ? PhaseSequenceOk : PhaseSequenceNotOk);
 			mState = WaitForStart;
 		}
 		break;
+	case VerifyIdentity:
+		if (decodeSerial(registers) == mCachedIdentity.serial) {
+			QLOG_INFO() << "Identity of" << mCachedIdentity.serial << "taken from cache";
+			mDeviceType = mCachedIdentity.deviceType;
+			updateRegisterMap();
+			mDeviceSubType = mCachedIdentity.deviceSubType;
+			mSerial = mCachedIdentity.serial;
+			mFirmwareVersion = mCachedIdentity.firmwareVersion;
+			mPhaseSequence = mCachedIdentity.phaseSequence;
+			mIdentityFromCache = true;
+			mState = WaitForStart;
+		} else {
+			QLOG_INFO() << "Energy meter" << mCachedIdentity.serial << "has been replaced";
+			IdentityCache::remove(mPortName, mSlaveAddress);
+			mState = DeviceId;
+		}
+		break;
 	case CheckSetup:
 		Q_ASSERT(registers.size() == 2);
 		mApplication = registers[0];
 		mDesiredMeasuringSystem =
-			mSettings->isMultiPhase() || mSettings->piggyEnabled() ?
+			mIsMultiPhase || mPiggyEnabled ?
 			MeasurementSystemP3 : MeasurementSystemP1;
 		mMeasuringSystem = registers[1];
 		mState = mApplication == ApplicationH &&
@@ -363,8 +355,7 @@ void AcSensorUpdater::onReadCompleted(int function, quint8 addr, const QList<qui
 			//   flowing back to the grid as negative values.
 			QLOG_ERROR() << "Energy meter Application incorrect";
 			mState = WaitFrontSelector;
-			mAcSensor->setErrorCode(ErrorFronSelectorLocked);
-			mAcPvSensor->setErrorCode(ErrorFronSelectorLocked);
+			emit errorCodeChanged(ErrorFronSelectorLocked);
 		} else {
 			if (mApplication != RegApplication) {
 				mState = SetApplication;
@@ -373,14 +364,13 @@ void AcSensorUpdater::onReadCompleted(int function, quint8 addr, const QList<qui
 			} else {
 				mState = Acquisition;
 			}
-			mAcSensor->setErrorCode(NoError);
-			mAcPvSensor->setErrorCode(NoError);
+			emit errorCodeChanged(NoError);
 		}
 		break;
 	case CheckMeasurementMode:
 		Q_ASSERT(registers.size() == 1);
 		if (registers[0] == MeasurementModeB) {
-			mState = mAcSensor->protocolType() == AcSensor::Em340Protocol ?
+			mState = protocolType() == AcSensor::Em340Protocol ?
 				CheckMeasurementSystem :
 				Acquisition;
 		} else {
@@ -389,23 +379,22 @@ void AcSensorUpdater::onReadCompleted(int function, quint8 addr, const QList<qui
 		break;
 	case CheckMeasurementSystem:
 		Q_ASSERT(registers.size() == 1);
-		Q_ASSERT(mAcSensor->protocolType() == AcSensor::Em340Protocol);
+		Q_ASSERT(protocolType() == AcSensor::Em340Protocol);
 		// Caution: EM3xx meters do not support MeasurementSystemP1
 		// Changing the measurement system also resets the kWh counters.
-		mDesiredMeasuringSystem = mSettings->isMultiPhase() || !mSettings->piggyEnabled() ?
+		mDesiredMeasuringSystem = mIsMultiPhase || !mPiggyEnabled ?
 			MeasurementSystemP3 : MeasurementSystemP2;
 		mState = mDesiredMeasuringSystem == registers[0] ? Acquisition : SetMeasuringSystem;
 		break;
 	case Acquisition:
 		processAcquisitionData(registers);
-		++mCommandIndex;
 		break;
 	case Wait:
 		mState = Acquisition;
 		break;
 	default:
 		QLOG_ERROR() << "Unknown updater state" << mState;
-		mState = mSettings == 0 ? DeviceId : Acquisition;
+		mState = mConnectionState < Detected ? DeviceId : Acquisition;
 		break;
 	}
 	mTimeoutCount = 0;
@@ -413,30 +402,27 @@ void AcSensorUpdater::onReadCompleted(int function, quint8 addr, const QList<qui
 	startNextAction();
 }
 
-void AcSensorUpdater::onWriteCompleted(int function, quint8 addr,
-										  quint16 address, quint16 value)
+void AcSensorUpdater::onWriteCompleted(int function, quint16 address, quint16 value)
 {
-	if (addr != mAcSensor->slaveAddress())
-		return;
 	Q_UNUSED(function)
 	Q_UNUSED(address)
 	Q_UNUSED(value)
 	switch (mState) {
 	case SetApplication:
-		Q_ASSERT(function == ModbusRtu::WriteSingleRegister);
+		Q_ASSERT(function == Modbus::WriteSingleRegister);
 		Q_ASSERT(address == RegApplication);
 		Q_ASSERT(value == ApplicationH);
 		mState = mMeasuringSystem == mDesiredMeasuringSystem ?
 			Acquisition : SetMeasuringSystem;
 		break;
 	case SetMeasuringSystem:
-		Q_ASSERT(function == ModbusRtu::WriteSingleRegister);
+		Q_ASSERT(function == Modbus::WriteSingleRegister);
 		Q_ASSERT(address == RegMeasurementSystem);
 		Q_ASSERT(value == mDesiredMeasuringSystem);
 		mState = Acquisition;
 		break;
 	case SetMeasurementMode:
-		mState = mAcSensor->protocolType() == AcSensor::Em340Protocol ?
+		mState = protocolType() == AcSensor::Em340Protocol ?
 			CheckMeasurementSystem :
 			Acquisition;
 		break;
@@ -445,7 +431,7 @@ void AcSensorUpdater::onWriteCompleted(int function, quint8 addr,
 		mState = Serial;
 		break;
 	default:
-		mState = mAcSensor->protocolType() == AcSensor::Em24Protocol ?
+		mState = protocolType() == AcSensor::Em24Protocol ?
 			CheckSetup :
 			Acquisition;
 		break;
@@ -459,17 +445,17 @@ void AcSensorUpdater::onWaitFinished()
 {
 	switch (mState) {
 	case Wait:
-		mStopwatch.restart();
 		mState = Acquisition;
 		break;
 	case WaitFrontSelector:
 		mState = CheckSetup;
 		break;
 	case WaitOnConnectionLost:
+		mDetectionTimer.restart();
 		mState = DeviceId;
 		break;
 	default:
-		mState = mAcSensor->protocolType() == AcSensor::Em24Protocol ?
+		mState = protocolType() == AcSensor::Em24Protocol ?
 			CheckSetup :
 			Acquisition;
 		break;
@@ -477,31 +463,47 @@ void AcSensorUpdater::onWaitFinished()
 	startNextAction();
 }
 
-void AcSensorUpdater::onUpdateSettings()
-{
-	if (mDataProcessor != 0)
-		mDataProcessor->updateEnergySettings();
-	if (mPvDataProcessor != 0)
-		mPvDataProcessor->updateEnergySettings();
-}
-
-void AcSensorUpdater::onIsMultiPhaseChanged()
-{
-	mSetupRequested = true;
-}
-
-void AcSensorUpdater::onL2ServiceTypeChanged()
+void AcSensorUpdater::onReportPeriods()
 {
-	mSetupRequested = true;
+	static const char *Names[] = {
+		0, 0, "power", "voltage", "current", "positive energy", "negative energy"
+	};
+	for (int q=Power; q<=NegativeEnergy; ++q) {
+		// A quantity may be read with more than one period, eg. the power of a
+		// PV inverter on L2 is read less often than the power on L1.
+		QMap<int, PeriodStatistics> periods;
+		for (QList<AcquisitionBlock>::const_iterator it = mPlan.begin();
+			 it != mPlan.end(); ++it) {
+			if ((it->quantities & (1 << q)) == 0 || it->periods.count == 0)
+				continue;
+			PeriodStatistics &p = periods[targetPeriod(*it)];
+			p.count += it->periods.count;
+			p.total += it->periods.total;
+			p.maximum = qMax(p.maximum, it->periods.maximum);
+		}
+		for (QMap<int, PeriodStatistics>::const_iterator it = periods.begin();
+			 it != periods.end(); ++it) {
+			QLOG_DEBUG() << "Acquisition of" << Names[q] << "from" << mPortName << ':'
+						 << mSlaveAddress << "target period:" << it.key()
+						 << "ms average:" << it.value().total / it.value().count
+						 << "ms maximum:" << it.value().maximum << "ms";
+		}
+	}
+	for (QList<AcquisitionBlock>::iterator it = mPlan.begin(); it != mPlan.end(); ++it) {
+		it->periods.count = 0;
+		it->periods.total = 0;
+		it->periods.maximum = 0;
+	}
 }
 
 void AcSensorUpdater::startNextAction()
 {
 	if (mSetupRequested) {
 		mSetupRequested = false;
-		mAcSensor->resetValues();
-		mAcPvSensor->resetValues();
-		switch (mAcSensor->protocolType()) {
+		mIdentityFromCache = false;
+		mIdentityStored = false;
+		addMeasurement(None, MultiPhase, 0);
+		switch (protocolType()) {
 		case AcSensor::Em24Protocol:
 			mState = CheckSetup;
 			break;
@@ -514,26 +516,33 @@ void AcSensorUpdater::startNextAction()
 	}
 	switch (mState) {
 	case DeviceId:
-		mAcSensor->setConnectionState(Searched);
+		setConnectionState(Searched);
+		if (!mIdentityCacheTried) {
+			mIdentityCacheTried = true;
+			if (IdentityCache::find(mPortName, mSlaveAddress, mCachedIdentity) &&
+				AcSensor::protocolType(mCachedIdentity.deviceType) != AcSensor::Unknown) {
+				mState = VerifyIdentity;
+				startNextAction();
+				break;
+			}
+		}
 		readRegisters(RegDeviceId, 1);
 		break;
+	case VerifyIdentity:
+		readRegisters(serialRegister(mCachedIdentity.deviceType), 7);
+		break;
 	case VersionCode:
 		readRegisters(RegEm24VersionCode, 1);
 		break;
 	case Serial:
-		if (mAcSensor->protocolType() == AcSensor::Em24Protocol) {
-			readRegisters(RegEm24Serial, 7);
-		} else {
-			// Also works for EM3xx
-			readRegisters(RegEm112Serial, 7);
-		}
+		readRegisters(serialRegister(mDeviceType), 7);
 		break;
 	case FirmwareVersion:
 		readRegisters(RegFirmwareVersion, 1);
 		break;
 	case PhaseSequence:
 		readRegisters(
-			mAcSensor->protocolType() == AcSensor::Em24Protocol ?
+			protocolType() == AcSensor::Em24Protocol ?
 				RegEm24PhaseSequence :
 				RegEm340PhaseSequence, 1);
 		break;
@@ -554,7 +563,7 @@ void AcSensorUpdater::startNextAction()
 	case SetMeasuringSystem:
 		QLOG_INFO() << "Change measuring system to:" << mDesiredMeasuringSystem;
 		writeRegister(
-			mAcSensor->protocolType() == AcSensor::Em24Protocol ?
+			protocolType() == AcSensor::Em24Protocol ?
 				RegMeasurementSystem :
 				RegEm340MeasurementSystem,
 			mDesiredMeasuringSystem);
@@ -564,7 +573,7 @@ void AcSensorUpdater::startNextAction()
 		break;
 	case CheckMeasurementSystem:
 		readRegisters(
-			mAcSensor->protocolType() == AcSensor::Em24Protocol ?
+			protocolType() == AcSensor::Em24Protocol ?
 				RegMeasurementSystem :
 				RegEm340MeasurementSystem,
 			1);
@@ -576,66 +585,33 @@ void AcSensorUpdater::startNextAction()
 		writeRegister(RegEm112MeasurementMode, MeasurementModeB);
 		break;
 	case WaitForStart:
-		Q_ASSERT(mSettings == 0);
-		mSettings = new AcSensorSettings(mAcSensor->deviceType(),
-											mAcSensor->serial(),
-											mAcSensor);
-		mDataProcessor = new DataProcessor(mAcSensor, mSettings, this);
-		mPvDataProcessor = new DataProcessor(mAcPvSensor, mSettings, this);
-		connect(mSettings, SIGNAL(isMultiPhaseChanged()),
-				this, SLOT(onIsMultiPhaseChanged()));
-		connect(mSettings, SIGNAL(l2ClassAndVrmInstanceChanged()),
-				this, SLOT(onL2ServiceTypeChanged()));
-		mAcSensor->setConnectionState(Detected);
+		emit deviceIdentified(mDeviceType, mDeviceSubType, mSerial, mFirmwareVersion,
+							  mPhaseSequence);
+		setConnectionState(Detected);
 		break;
 	case Acquisition:
-		switch (mAcSensor->protocolType()) {
-		case AcSensor::Em24Protocol:
-			if (mSettings->isMultiPhase()) {
-				mCommands = Em24Commands;
-				mCommandCount = Em24CommandCount;
-			} else if (mSettings->piggyEnabled()) {
-				mCommands = Em24CommandsP1PV;
-				mCommandCount = Em24CommandsP1PVCount;
-			} else {
-				mCommands = Em24CommandsP1;
-				mCommandCount = Em24CommandP1Count;
-			}
-			break;
-		case AcSensor::Et112Protocol:
-			mCommands = Em112Commands;
-			mCommandCount = Em112CommandCount;
-			break;
-		case AcSensor::Em340Protocol:
-			if (mSettings->isMultiPhase()) {
-				mCommands = Em340Commands;
-				mCommandCount = Em340CommandCount;
-			} else if (mSettings->piggyEnabled()) {
-				mCommands = Em340CommandsP1PV;
-				mCommandCount = Em340CommandsP1PVCount;
-			} else {
-				mCommands = Em340P1Commands;
-				mCommandCount = Em340P1CommandCount;
-			}
-			break;
-		case AcSensor::Unknown:
-			Q_ASSERT(false);
+	{
+		if (mRegisterMap == 0) {
+			QLOG_ERROR() << "No register map for device type" << mDeviceType
+						 << "measuring system" << measuringSystem();
+			disconnectSensor();
+			startNextAction();
 			break;
 		}
+		const CompositeCommand *commands = mRegisterMap->commands.constData();
+		int commandCount = mRegisterMap->commands.size();
+		if (commands != mCommands) {
+			mCommands = commands;
+			mCommandCount = commandCount;
+			mBlockIndex = 0;
+			buildAcquisitionPlan();
+		}
 		startNextAcquisition();
 		break;
+	}
 	case Wait:
-	{
-		int sleep = mStopwatch.elapsed();
-		sleep = 250 - sleep;
-		if (sleep > 50) {
-			mAcquisitionTimer->setInterval(sleep);
-			mAcquisitionTimer->start();
-		} else {
-			onWaitFinished();
-		}
+		// The timer started by startNextAcquisition will resume acquisition.
 		break;
-	}
 	case WaitOnConnectionLost:
 		mAcquisitionTimer->setInterval(mIsZigbee ? ZigbeeReconnectInterval : ReconnectInterval);
 		mAcquisitionTimer->start();
@@ -654,146 +630,269 @@ void AcSensorUpdater::startNextAction()
 
 void AcSensorUpdater::startNextAcquisition()
 {
-	const CompositeCommand *cmd = 0;
-	for (;;) {
-		if (mCommandIndex < mCommandCount)
-			cmd = &mCommands[mCommandIndex];
-		if (cmd !=0 && (cmd->interval == 0 || mAcquisitionIndex == cmd->interval)) {
-			break;
-		} else {
-			++mCommandIndex;
-			if (mCommandIndex >= mCommandCount) {
-				mState = Wait;
-				mCommandIndex = 0;
-				++mAcquisitionIndex;
-				if (mAcquisitionIndex == MaxAcquisitionIndex) {
-					mAcquisitionIndex = 0;
-					mAcSensor->setConnectionState(Connected);
-					mAcPvSensor->setConnectionState(Connected);
-				}
-				startNextAction();
-				return;
+	qint64 now = monotonicTime();
+	if (mConnectionState == Connected && now >= mNextResponseTimeReport) {
+		mNextResponseTimeReport = now + ResponseTimeReportInterval;
+		quint8 addr = static_cast<quint8>(mSlaveAddress);
+		addMeasurement(ResponseTime, MultiPhase, mModbus->responseTime(addr));
+		addMeasurement(ResponseTimeout, MultiPhase, mModbus->responseTimeout(addr));
+	}
+	// Read the block which is most overdue. Blocks due at the same time are
+	// read in command table order.
+	mBlockIndex = 0;
+	for (int i=1; i<mPlan.size(); ++i) {
+		if (mPlan[i].dueAt < mPlan[mBlockIndex].dueAt)
+			mBlockIndex = i;
+	}
+	const AcquisitionBlock &block = mPlan[mBlockIndex];
+	if (block.dueAt > now) {
+		mState = Wait;
+		mAcquisitionTimer->setInterval(static_cast<int>(block.dueAt - now));
+		mAcquisitionTimer->start();
+		return;
+	}
+	mRequestedAt = now;
+	readRegisters(block.reg, block.count,
+				  mIsGridMeter && (block.quantities & (1 << Power)) != 0 ?
+					  Modbus::HighPriority : Modbus::NormalPriority);
+}
+
+void AcSensorUpdater::buildAcquisitionPlan()
+{
+	int maxRegCount = mBlockReadsEnabled ? getMaxBlockRegCount(protocolType()) : 0;
+	double commandRate = 0;
+	double blockRate = 0;
+	QList<const CompositeCommand *> commands;
+	for (int i=0; i<mCommandCount; ++i)
+		commands.append(&mCommands[i]);
+	qStableSort(commands.begin(), commands.end(), commandLessThan);
+	mPlan.clear();
+	// On a zigbee link a response may arrive after the request has timed out,
+	// and be taken for the response of the next request. The dummy values
+	// give each request its own register count, so such a response is
+	// rejected. Merging would make the counts equal again.
+	bool isMergeable = true;
+	foreach (const CompositeCommand *cmd, commands) {
+		int index = static_cast<int>(cmd - mCommands);
+		commandRate += 1000.0 / cmd->period;
+		bool wasMergeable = isMergeable;
+		isMergeable = !mIsZigbee || !hasDummy(*cmd);
+		if (!mPlan.isEmpty() && wasMergeable && isMergeable) {
+			AcquisitionBlock &block = mPlan.last();
+			int blockEnd = block.reg + block.count;
+			int end = qMax(blockEnd, cmd->reg + cmd->count);
+			if (block.period == cmd->period && cmd->reg - blockEnd <= MaxBlockGap &&
+				end - block.reg <= maxRegCount) {
+				block.count = static_cast<quint16>(end - block.reg);
+				block.commands.append(index);
+				block.quantities |= getQuantities(*cmd);
+				continue;
 			}
 		}
+		AcquisitionBlock block;
+		block.reg = static_cast<quint16>(cmd->reg);
+		block.count = static_cast<quint16>(cmd->count);
+		block.commands.append(index);
+		block.quantities = getQuantities(*cmd);
+		block.period = cmd->period;
+		mPlan.append(block);
+	}
+	// Process the data in the order of the command table, because some
+	// values depend on others (eg. the sign of the current is taken from
+	// the power).
+	qint64 now = monotonicTime();
+	for (QList<AcquisitionBlock>::iterator it = mPlan.begin(); it != mPlan.end(); ++it) {
+		qSort(it->commands);
+		it->dueAt = now;
+		it->requestedAt = 0;
+		it->periods.count = 0;
+		it->periods.total = 0;
+		it->periods.maximum = 0;
+		blockRate += 1000.0 / it->period;
 	}
-	int maxOffset = getMaxOffset(*cmd);
-	readRegisters(cmd->reg, maxOffset + 2);
+	qStableSort(mPlan.begin(), mPlan.end(), blockLessThan);
+	QLOG_INFO() << "Acquisition plan for" << mPortName << ':'
+				<< mSlaveAddress << "uses" << blockRate
+				<< "requests per second instead of" << commandRate;
 }
 
 void AcSensorUpdater::disconnectSensor()
 {
 	mState = WaitOnConnectionLost;
-	delete mSettings;
-	mSettings = 0;
-	delete mDataProcessor;
-	mDataProcessor = 0;
-	delete mPvDataProcessor;
-	mPvDataProcessor = 0;
 	mTimeoutCount = MaxTimeoutCount;
 	mErrorCount = MaxErrorCount;
-	mAcSensor->setSerial(QString());
-	mAcSensor->resetValues();
-	mAcSensor->setConnectionState(Disconnected);
-	mAcPvSensor->setSerial(QString());
-	mAcPvSensor->resetValues();
-	mAcPvSensor->setConnectionState(Disconnected);
+	mCommands = 0;
+	mCommandCount = 0;
+	mPlan.clear();
+	mIdentityCacheTried = false;
+	mIdentityFromCache = false;
+	mIdentityStored = false;
+	mBlockReadsEnabled = true;
+	mDeviceType = 0;
+	mRegisterMap = 0;
+	mDeviceSubType = 0;
+	mSerial.clear();
+	mFirmwareVersion = 0;
+	mPhaseSequence = -1;
+	setConnectionState(Disconnected);
 }
 
-void AcSensorUpdater::readRegisters(quint16 startReg, quint16 count)
+void AcSensorUpdater::readRegisters(quint16 startReg, quint16 count,
+									Modbus::Priority priority)
 {
-	mModbus->readRegisters(ModbusRtu::ReadHoldingRegisters,
-						   mAcSensor->slaveAddress(), startReg, count);
+	mModbus->readRegisters(Modbus::ReadHoldingRegisters,
+						   mSlaveAddress, startReg, count, priority);
 }
 
 void AcSensorUpdater::writeRegister(quint16 reg, quint16 value)
 {
-	mModbus->writeRegister(ModbusRtu::WriteSingleRegister,
-						   mAcSensor->slaveAddress(), reg, value);
+	mModbus->writeRegister(Modbus::WriteSingleRegister,
+						   mSlaveAddress, reg, value, Modbus::LowPriority);
 }
 
-void AcSensorUpdater::processAcquisitionData(const QList<quint16> &registers)
+void AcSensorUpdater::processAcquisitionData(const RegisterView &registers)
 {
-	const CompositeCommand &cmd = mCommands[mCommandIndex];
-	int regCount = getMaxOffset(cmd) + 2;
-	if (regCount != registers.size()) {
+	if (mBlockIndex >= mPlan.size())
+		return;
+	mReceivedAt = monotonicTime();
+	AcquisitionBlock &block = mPlan[mBlockIndex];
+	if (block.requestedAt != 0) {
+		qint64 period = mRequestedAt - block.requestedAt;
+		++block.periods.count;
+		block.periods.total += period;
+		block.periods.maximum = qMax(block.periods.maximum, period);
+	}
+	block.requestedAt = mRequestedAt;
+	// Keep the reads evenly spaced, but do not try to catch up on reads which
+	// are late. Those would only delay the other blocks.
+	block.dueAt = qMax(block.dueAt + targetPeriod(block), mReceivedAt);
+	if (block.count != registers.size()) {
 		QLOG_WARN() << "Incorrect number of registers received"
-					<< regCount << registers.size() << mCommandIndex;
+					<< block.count << registers.size() << mBlockIndex;
 		return;
 	}
-	for (int i=0; i<=regCount; ++i) {
-		RegisterCommand ra = cmd.actions[i];
-		if (ra.action == None)
-			break;
-		DataProcessor *dest = mDataProcessor;
-		if (mSettings->piggyEnabled()) {
-			if (ra.phase == PhaseL2)
-				dest = mPvDataProcessor;
-			ra.phase = MultiPhase;
+	foreach (int index, block.commands) {
+		const CompositeCommand &cmd = mCommands[index];
+		processCommand(cmd, registers, cmd.reg - block.reg);
+	}
+	if (mConnectionState != Connected) {
+		// All values have been retrieved once.
+		foreach (const AcquisitionBlock &b, mPlan) {
+			if (b.requestedAt == 0)
+				return;
 		}
-		if (mSettings->isMultiPhase() || ra.phase == MultiPhase) {
-			bool setPhaseL1 = ra.phase == MultiPhase && !mSettings->isMultiPhase();
-			double v = 0;
-			switch (ra.action) {
-			case Power:
-				v = getDouble(registers, ra.regOffset, 0.1);
-				dest->setPower(ra.phase, v);
-				if (setPhaseL1)
-					dest->setPower(PhaseL1, v);
-				break;
-			case Voltage:
-				v = getDouble(registers, ra.regOffset, 0.1);
-				dest->setVoltage(ra.phase, v);
-				if (setPhaseL1)
-					dest->setVoltage(PhaseL1, v);
-				break;
-			case Current:
-				v = getDouble(registers, ra.regOffset, 1e-3);
-				if (mSetCurrentSign &&
-					dest == mDataProcessor &&
-					mAcSensor->getPhase(ra.phase)->power() < 0) {
-					v = -v;
-				}
-				dest->setCurrent(ra.phase, v);
-				if (setPhaseL1)
-					dest->setCurrent(PhaseL1, v);
-				if (mSettings->isMultiPhase() && ra.phase == PhaseL3) {
-					dest->setCurrent(MultiPhase,
-						mAcSensor->l1()->current() +
-						mAcSensor->l2()->current() +
-						mAcSensor->l3()->current());
-				}
-				break;
-			case PositiveEnergy:
-				v = getDouble(registers, ra.regOffset, 0.1);
-				dest->setPositiveEnergy(ra.phase, v);
-				if (setPhaseL1)
-					dest->setPositiveEnergy(PhaseL1, v);
-				break;
-			case NegativeEnergy:
-				// ET112 seems to return negative values for kWh(-), unlike the
-				// other meters.
-				v = qAbs(getDouble(registers, ra.regOffset, 0.1));
-				if (mAcSensor->protocolType() == AcSensor::Em24Protocol &&
-					mSettings->isMultiPhase()) {
-					dest->setNegativeEnergy(v);
-				} else {
-					dest->setNegativeEnergy(ra.phase, v);
-					if (setPhaseL1)
-						dest->setNegativeEnergy(PhaseL1, v);
-				}
-				break;
-			default:
-				break;
-			}
+		setConnectionState(Connected);
+		QLOG_INFO() << "First measurement from" << mSerial << '@' << mPortName << ':'
+					<< mSlaveAddress << "completed" << mDetectionTimer.elapsed()
+					<< "ms after detection started"
+					<< (mIdentityFromCache ? "(identity from cache)" : "");
+	}
+	if (!mIdentityStored)
+		storeIdentity();
+}
+
+void AcSensorUpdater::processCommand(const CompositeCommand &cmd,
+									 const RegisterView &registers, int offset)
+{
+	for (int i=0; i<cmd.actionCount; ++i) {
+		const RegisterCommand &ra = cmd.actions[i];
+		double v = 0;
+		switch (ra.action) {
+		case None:
+			return;
+		case Power:
+		case Voltage:
+		case Current:
+		case PositiveEnergy:
+			v = getDouble(registers, offset + ra.regOffset, ra.factor, ra.msbFirst);
+			break;
+		case NegativeEnergy:
+			// ET112 seems to return negative values for kWh(-), unlike the
+			// other meters.
+			v = qAbs(getDouble(registers, offset + ra.regOffset, ra.factor, ra.msbFirst));
+			break;
+		default:
+			continue;
 		}
+		addMeasurement(ra.action, ra.phase, v);
+	}
+}
+
+void AcSensorUpdater::addMeasurement(ParameterType parameter, Phase phase, double value)
+{
+	MeasurementSample sample;
+	sample.parameter = parameter;
+	sample.phase = phase;
+	sample.value = value;
+	sample.requestedAt = mRequestedAt;
+	sample.receivedAt = mReceivedAt;
+	if (!mMeasurements.push(sample)) {
+		QLOG_WARN() << "Measurement queue full, dropping value from"
+					<< mPortName << ':' << mSlaveAddress;
+		return;
 	}
+	if (mMeasurementsPending.testAndSetOrdered(0, 1))
+		emit measurementsAvailable();
+}
+
+int AcSensorUpdater::targetPeriod(const AcquisitionBlock &block) const
+{
+	// In low latency mode the next power read is due as soon as the previous
+	// one has completed. Other reads will still be sent when they are overdue,
+	// because they have an earlier deadline by then.
+	if (mLowLatency && (block.quantities & (1 << Power)) != 0)
+		return 0;
+	return block.period;
+}
+
+void AcSensorUpdater::updateRegisterMap()
+{
+	mRegisterMap = mDeviceType == 0 ? 0 : RegisterMaps::find(mDeviceType, measuringSystem());
+}
+
+MeasuringSystem AcSensorUpdater::measuringSystem() const
+{
+	return mIsMultiPhase ? MultiPhaseSystem :
+		   mPiggyEnabled ? PiggybackSystem :
+		   SinglePhaseSystem;
+}
+
+quint16 AcSensorUpdater::serialRegister(int deviceType)
+{
+	// RegEm112Serial also works for EM3xx
+	return AcSensor::protocolType(deviceType) == AcSensor::Em24Protocol ?
+		RegEm24Serial : RegEm112Serial;
+}
+
+void AcSensorUpdater::storeIdentity()
+{
+	DeviceIdentity identity;
+	identity.deviceType = mDeviceType;
+	identity.deviceSubType = mDeviceSubType;
+	identity.serial = mSerial;
+	identity.firmwareVersion = mFirmwareVersion;
+	identity.phaseSequence = mPhaseSequence;
+	identity.system = measuringSystem();
+	IdentityCache::store(mPortName, mSlaveAddress, identity);
+	mIdentityStored = true;
+}
+
+void AcSensorUpdater::setConnectionState(ConnectionState state)
+{
+	if (mConnectionState == state)
+		return;
+	mConnectionState = state;
+	emit connectionStateChanged(state);
 }
 
-double AcSensorUpdater::getDouble(const QList<quint16> &registers,
-									 int offset, double factor)
+double AcSensorUpdater::getDouble(const RegisterView &registers,
+									 int offset, double factor, bool msbFirst)
 {
 	double value = 0;
-	value = (int32_t)(registers[offset] | registers[offset + 1] << 16);
+	if (msbFirst)
+		value = (int32_t)(registers[offset] << 16 | registers[offset + 1]);
+	else
+		value = (int32_t)(registers[offset] | registers[offset + 1] << 16);
 	if (value == 0x7FFFFFFF) return qQNaN();
 	return value * factor;
 }
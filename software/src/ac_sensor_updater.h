@@ -1,66 +1,141 @@
 #ifndef AC_SENSOR_UPDATER_H
 #define AC_SENSOR_UPDATER_H
 
+#include <QAtomicInt>
 #include <QElapsedTimer>
+#include <QList>
 #include <QObject>
+#include "ac_sensor.h"
 #include "defines.h"
-#include "modbus_rtu.h"
+#include "identity_cache.h"
+#include "modbus.h"
+#include "spsc_queue.h"
 
-class DataProcessor;
-class AcSensor;
-class AcSensorSettings;
-class AcSensorPhase;
 struct CompositeCommand;
 
+/*!
+ * Achieved time between reads of an `AcquisitionBlock`, in ms.
+ */
+struct PeriodStatistics {
+	int count;
+	qint64 total;
+	qint64 maximum;
+};
+
+/*!
+ * A single read request covering the registers of one or more commands with
+ * the same read period.
+ */
+struct AcquisitionBlock {
+	quint16 reg;
+	quint16 count;
+	/// Indices of the commands in the command table, in table order.
+	QList<int> commands;
+	/// Bit mask of the quantities retrieved (`1 << ParameterType`).
+	int quantities;
+	/// Target time between reads, in ms.
+	int period;
+	/// Time (see `monotonicTime`) at which the block should be read next.
+	qint64 dueAt;
+	/// Time (see `monotonicTime`) of the last read request, 0 if the block
+	/// has not been read yet.
+	qint64 requestedAt;
+	/// Achieved periods since the last report.
+	PeriodStatistics periods;
+};
+
+/*!
+ * A single value decoded from the energy meter.
+ * A sample with `parameter` set to `None` indicates that all measured values
+ * should be reset.
+ */
+struct MeasurementSample {
+	ParameterType parameter;
+	Phase phase;
+	double value;
+	/// Time (see `monotonicTime`) at which the value was requested from the
+	/// energy meter. This includes the time the request was queued.
+	qint64 requestedAt;
+	/// Time (see `monotonicTime`) at which the response was received.
+	qint64 receivedAt;
+};
+
+/// Size of the queue between an `AcSensorUpdater` and its `AcSensorReceiver`.
+/// A second of acquisition yields about 20 samples, so this allows the
+/// receiving thread to be blocked for several seconds.
+static const int MeasurementQueueSize = 256;
+
+typedef SpscQueue<MeasurementSample, MeasurementQueueSize> MeasurementQueue;
+
 /*!
  * Retrieves data from a Carlo Gavazzi energy meter.
- * This class will setup a connection (modbus RTU) to an energy meter and
- * retrieve data from the device. The value will be stored in an `AcSensor`
- * object.
+ * This class will setup a connection (modbus RTU or TCP) to an energy meter and
+ * retrieve data from the device.
+ *
+ * The updater lives in the same thread as the `Modbus` object of the port,
+ * and never touches the `AcSensor` objects published on the D-Bus. Identity
+ * and connection state are reported through (queued) signals. Measured values
+ * are passed through a lock-free queue (see `measurements`), and are stored in
+ * the `AcSensor` objects by an `AcSensorReceiver`.
+ *
+ * During acquisition each read has a target period (see `CompositeCommand`).
+ * The read which is most overdue is sent next, and if no read is due the
+ * updater waits until the first one is. The achieved periods per quantity are
+ * logged once a minute (debug level).
+ *
+ * If the identity of the meter is found in the `IdentityCache`, it is verified
+ * by reading the serial number only. The setup of the meter is skipped if the
+ * cached measuring system matches the settings.
  *
  * This class is implemented as a state engine. The diagram below shows the
  * progress through the states.
  * @dotfile ac_sensor_updater_states.dot
  */
-class AcSensorUpdater : public QObject
+class AcSensorUpdater : public QObject, public ModbusListener
 {
 	Q_OBJECT
 public:
 	/*!
-	 * Creates an instance of `AcSensorUpdater`, and starts the setup
-	 * process.
-	 * If the setup succeeds, the `connectionState` of the `acSensor` will be
-	 * set to `Detected`, otherwise to `disconnected` signal.
-	 * Once the state is `Detected`, the object will become idle until
+	 * Creates an instance of `AcSensorUpdater`. The setup process will begin
+	 * when `start` is called, which must be done in the thread of the `modbus`
+	 * object.
+	 * If the setup succeeds, the `connectionStateChanged` signal will be
+	 * emitted with `Detected`. After that the object will become idle until
 	 * `startMeasurement` is called.
-	 * @param acSensor. The storage object. All retrieved values will be
-	 * stored here. The `portName` property of this object should be set before
-	 * calling this contructor.
 	 * @param modbus. The modbus connection object. This object may be shared
 	 * between multiple `AcSensorUpdater` objects. The `modbus` object will not
 	 * be deleted in the destructor.
 	 */
-	AcSensorUpdater(AcSensor *acSensor, AcSensor *acPvSensor, ModbusRtu *modbus, bool isZigbee,
+	AcSensorUpdater(const QString &portName, int slaveAddress, Modbus *modbus, bool isZigbee,
 					QObject *parent = 0);
 
+	int slaveAddress() const
+	{
+		return mSlaveAddress;
+	}
+
 	/*!
-	 * Returns the storage object.
-	 * This is the object passed to the constructor.
+	 * Returns the queue with measured values. Values are added from the
+	 * thread of the updater, and may be removed from one other thread.
+	 * The `measurementsAvailable` signal is emitted when values are added to
+	 * an empty queue. The consumer should call `clearMeasurementsPending`
+	 * before emptying the queue.
 	 */
-	AcSensor *acSensor();
+	MeasurementQueue *measurements()
+	{
+		return &mMeasurements;
+	}
 
-	AcSensor *pvSensor();
+	void clearMeasurementsPending()
+	{
+		mMeasurementsPending.storeRelease(0);
+	}
 
+public slots:
 	/*!
-	 * Returns the settings object.
-	 * This object is created by the `AcSensorUpdater` when a device has been
-	 * detected. It will be null while the `connectionState` of the `AcSensor`
-	 * is `Disconnected` or `Searched`.
-	 * The information in the settings will be used for data retrieval and can
-	 * be changed while retrieval is active. This may lead to reinitialization
-	 * of the updater (and the energy meter itself).
+	 * Starts the setup process.
 	 */
-	AcSensorSettings *settings();
+	void start();
 
 	/*!
 	 * Starts actual measurement.
@@ -68,37 +143,108 @@ public:
 	 * or later. It was intended to allow the user of this class to change the
 	 * settings before starting measurements.
 	 */
-	void startMeasurements();
+	void startMeasurements(bool isMultiPhase, bool piggyEnabled);
 
-private slots:
-	void onErrorReceived(int errorType, quint8 addr, int exception);
+	/*!
+	 * Should be called when the measurement settings have changed. This will
+	 * cause reinitialization of the energy meter.
+	 */
+	void updateSetup(bool isMultiPhase, bool piggyEnabled);
 
-	void onReadCompleted(int function, quint8 addr, const QList<quint16> &registers);
+	/*!
+	 * Should be called when the role of the energy meter has changed. The
+	 * power of a grid meter is used for feedback control, so its power
+	 * values are retrieved with high priority.
+	 */
+	void setGridMeter(bool isGridMeter);
 
-	void onWriteCompleted(int function, quint8 addr, quint16 address, quint16 value);
+	/*!
+	 * Enables or disables low latency mode. In this mode the reads containing
+	 * power values are sent back to back, as fast as the bus allows. The
+	 * other reads keep their period.
+	 */
+	void setLowLatency(bool lowLatency);
 
-	void onWaitFinished();
+signals:
+	void connectionStateChanged(ConnectionState state);
 
-	void onUpdateSettings();
+	/*!
+	 * Emitted when the identity of the energy meter has been retrieved, just
+	 * before the connection state changes to `Detected`.
+	 */
+	void deviceIdentified(int deviceType, int deviceSubType, const QString &serial,
+						  int firmwareVersion, int phaseSequence);
 
-	void onIsMultiPhaseChanged();
+	void errorCodeChanged(int errorCode);
 
-	void onL2ServiceTypeChanged();
+	void measurementsAvailable();
+
+private slots:
+	void onWaitFinished();
+
+	void onReportPeriods();
 
 private:
+	virtual void onErrorReceived(int errorType, int exception);
+
+	virtual void onReadCompleted(int function, const RegisterView &registers);
+
+	virtual void onWriteCompleted(int function, quint16 address, quint16 value);
+
 	void startNextAction();
 
 	void startNextAcquisition();
 
+	/*!
+	 * Merges the commands from `mCommands` with the same period into the
+	 * smallest number of contiguous register reads the energy meter supports.
+	 */
+	void buildAcquisitionPlan();
+
 	void disconnectSensor();
 
-	void readRegisters(quint16 startReg, quint16 count);
+	/*!
+	 * Sends a read request to the energy meter. Identification and setup
+	 * requests use the default (low) priority, so they do not delay the
+	 * measurements of other meters on the same port.
+	 */
+	void readRegisters(quint16 startReg, quint16 count,
+					   Modbus::Priority priority = Modbus::LowPriority);
 
 	void writeRegister(quint16 reg, quint16 value);
 
-	void processAcquisitionData(const QList<quint16> &registers);
+	void processAcquisitionData(const RegisterView &registers);
+
+	void processCommand(const CompositeCommand &cmd, const RegisterView &registers,
+						int offset);
+
+	void addMeasurement(ParameterType parameter, Phase phase, double value);
+
+	/// Returns the target time between reads of `block` in ms.
+	int targetPeriod(const AcquisitionBlock &block) const;
+
+	MeasuringSystem measuringSystem() const;
+
+	/*!
+	 * Looks up the register map of the device type and measuring system. Must
+	 * be called when either changes, so acquisition does not have to search
+	 * the maps on each read.
+	 */
+	void updateRegisterMap();
+
+	static quint16 serialRegister(int deviceType);
+
+	void storeIdentity();
+
+	void setConnectionState(ConnectionState state);
+
+	AcSensor::ProtocolTypes protocolType() const
+	{
+		return AcSensor::protocolType(mDeviceType);
+	}
 
-	double getDouble(const QList<quint16> &registers, int offset, double factor);
+	double getDouble(const RegisterView &registers, int offset, double factor,
+					 bool msbFirst);
 
 	enum State {
 		DeviceId,
@@ -119,7 +265,8 @@ private:
 		WaitOnConnectionLost,
 
 		SetAddress,
-		PhaseSequence
+		PhaseSequence,
+		VerifyIdentity
 	};
 
 	enum Registers {
@@ -142,14 +289,25 @@ private:
 		PhaseSequenceNotOk
 	};
 
-	DataProcessor *mDataProcessor;
-	DataProcessor *mPvDataProcessor;
-	AcSensor *mAcSensor;
-	AcSensor *mAcPvSensor;
-	AcSensorSettings *mSettings;
-	ModbusRtu *mModbus;
+	QString mPortName;
+	int mSlaveAddress;
+	Modbus *mModbus;
 	QTimer *mAcquisitionTimer;
-	QTimer *mSettingsUpdateTimer;
+	QTimer *mReportTimer;
+	MeasurementQueue mMeasurements;
+	/// Set when `measurementsAvailable` has been emitted, and the queue has
+	/// not been emptied yet.
+	QAtomicInt mMeasurementsPending;
+	ConnectionState mConnectionState;
+	int mDeviceType;
+	int mDeviceSubType;
+	QString mSerial;
+	int mFirmwareVersion;
+	int mPhaseSequence;
+	bool mIsMultiPhase;
+	bool mPiggyEnabled;
+	bool mIsGridMeter;
+	bool mLowLatency;
 	int mTimeoutCount;
 	int mErrorCount;
 	int mMeasuringSystem;
@@ -157,16 +315,35 @@ private:
 	bool mIsZigbee;
 	bool mSetupRequested;
 	int mApplication;
-	QElapsedTimer mStopwatch;
+	/// Timestamps of the current acquisition request, see `MeasurementSample`.
+	qint64 mRequestedAt;
+	qint64 mReceivedAt;
 	State mState;
+	/// Identity read from the `IdentityCache`.
+	DeviceIdentity mCachedIdentity;
+	/// Set once the `IdentityCache` has been consulted during detection.
+	bool mIdentityCacheTried;
+	/// Set if the identity has been taken from the cache.
+	bool mIdentityFromCache;
+	/// Set if the identity and setup have been stored in the cache.
+	bool mIdentityStored;
+	/// Measures the time between the start of detection and the first
+	/// complete measurement.
+	QElapsedTimer mDetectionTimer;
+	/// Register map of the device type and measuring system, 0 if there is
+	/// none (see `updateRegisterMap`).
+	const RegisterMap *mRegisterMap;
 	const CompositeCommand *mCommands;
 	int mCommandCount;
-	int mCommandIndex;
-	int mAcquisitionIndex;
-	/// Some grid meters return a negative current on backfeed, others don't.
-	/// In case the meter does not, we correct the sing of the current using the
-	/// sign of the power.
-	bool mSetCurrentSign;
+	/// Index in `mPlan` of the block being read.
+	int mBlockIndex;
+	/// Time (see `monotonicTime`) at which the response time should be
+	/// reported next.
+	qint64 mNextResponseTimeReport;
+	/// Read requests, in command table order (see `buildAcquisitionPlan`).
+	QList<AcquisitionBlock> mPlan;
+	/// Cleared if the energy meter rejects a merged read request.
+	bool mBlockReadsEnabled;
 };
 
 #endif // AC_SENSOR_UPDATER_H
@@ -45,8 +45,32 @@ static uint8_t CrcLo[] =
 	0x40
 };
 
+/*
+ * Tables for the slice-by-8 algorithm. CrcSlices[0] holds the CRC of a single
+ * byte (CrcLo and CrcHi combined, with the value of CrcHi in the low order
+ * byte). CrcSlices[k][n] holds the CRC of byte n followed by k zero bytes.
+ * This allows us to process 8 bytes with 8 independent table lookups.
+ */
+static uint16_t CrcSlices[8][256];
+
+static bool initCrcSlices()
+{
+	for (int n=0; n<256; ++n)
+		CrcSlices[0][n] = toUInt16(CrcLo[n], CrcHi[n]);
+	for (int k=1; k<8; ++k) {
+		for (int n=0; n<256; ++n) {
+			uint16_t crc = CrcSlices[k - 1][n];
+			CrcSlices[k][n] = (crc >> 8) ^ CrcSlices[0][crc & 0xFF];
+		}
+	}
+	return true;
+}
+
+static const bool CrcSlicesInitialized = initCrcSlices();
+
 Crc16::Crc16()
 {
+	Q_UNUSED(CrcSlicesInitialized);
 	reset();
 }
 
@@ -57,10 +81,30 @@ void Crc16::add(uint8_t byte)
 	mCrcLo = CrcLo[index];
 }
 
+void Crc16::add(const uint8_t *bytes, int count)
+{
+	// Note that mCrcHi contains the low order byte of the CRC register, which
+	// is combined with the next data byte.
+	uint16_t crc = toUInt16(mCrcLo, mCrcHi);
+	for (; count >= 8; count -= 8, bytes += 8) {
+		crc = CrcSlices[7][lsb(crc) ^ bytes[0]] ^
+			CrcSlices[6][msb(crc) ^ bytes[1]] ^
+			CrcSlices[5][bytes[2]] ^
+			CrcSlices[4][bytes[3]] ^
+			CrcSlices[3][bytes[4]] ^
+			CrcSlices[2][bytes[5]] ^
+			CrcSlices[1][bytes[6]] ^
+			CrcSlices[0][bytes[7]];
+	}
+	mCrcHi = lsb(crc);
+	mCrcLo = msb(crc);
+	for (; count > 0; --count, ++bytes)
+		add(*bytes);
+}
+
 void Crc16::add(const QByteArray &bytes)
 {
-	foreach (uint8_t b, bytes)
-		add(b);
+	add(reinterpret_cast<const uint8_t *>(bytes.constData()), bytes.size());
 }
 
 uint16_t Crc16::getValue(const QByteArray &bytes)
@@ -69,3 +113,10 @@ uint16_t Crc16::getValue(const QByteArray &bytes)
 	crc.add(bytes);
 	return crc.getValue();
 }
+
+uint16_t Crc16::getValue(const uint8_t *bytes, int count)
+{
+	Crc16 crc;
+	crc.add(bytes, count);
+	return crc.getValue();
+}
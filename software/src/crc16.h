@@ -25,6 +25,13 @@ public:
 
 	void add(uint8_t byte);
 
+	/*!
+	 * Adds a block of bytes to the checksum. This is considerably faster than
+	 * adding the bytes one at a time, because 8 bytes are processed per
+	 * iteration (slice-by-8). The result is identical.
+	 */
+	void add(const uint8_t *bytes, int count);
+
 	void add(const QByteArray &bytes);
 
 	void reset()
@@ -40,6 +47,8 @@ public:
 	 */
 	static uint16_t getValue(const QByteArray &bytes);
 
+	static uint16_t getValue(const uint8_t *bytes, int count);
+
 private:
 	uint8_t mCrcLo;
 	uint8_t mCrcHi;
@@ -1,30 +1,46 @@
+#include <QDBusArgument>
+#include <QDBusConnection>
 #include <QDBusVariant>
 #include <QDBusMessage>
-#include <QsLog.h>
 #include <QTimer>
+#include <qmath.h>
+#include <QsLog.h>
 #include <velib/qt/ve_qitem.hpp>
 #include <velib/qt/ve_qitems_dbus.hpp>
 #include "dbus_bridge.h"
+#include "defines.h"
+#include "publish_wheel.h"
 
 DBusBridge::DBusBridge(const QString &serviceName, bool isProducer, QObject *parent):
 	QObject(parent),
-	mUpdateTimer(0),
+	mSilenceTimer(new QTimer(this)),
+	mSilenceCheckAt(0),
+	mUpdateInterval(0),
 	mIsProducer(isProducer),
-	mIsInitialized(false)
+	mIsInitialized(false),
+	mSuppressedUpdates(0)
 {
 	mServiceRoot = VeQItems::getRoot()->itemGetOrCreate(serviceName);
+	mSilenceTimer->setSingleShot(true);
+	connect(mSilenceTimer, SIGNAL(timeout()), this, SLOT(onSilenceTimeout()));
 }
 
 DBusBridge::DBusBridge(VeQItem *serviceRoot, bool isProducer, QObject *parent):
 	QObject(parent),
 	mServiceRoot(serviceRoot),
-	mUpdateTimer(0),
-	mIsProducer(isProducer)
+	mSilenceTimer(new QTimer(this)),
+	mSilenceCheckAt(0),
+	mUpdateInterval(0),
+	mIsProducer(isProducer),
+	mSuppressedUpdates(0)
 {
+	mSilenceTimer->setSingleShot(true);
+	connect(mSilenceTimer, SIGNAL(timeout()), this, SLOT(onSilenceTimeout()));
 }
 
 DBusBridge::~DBusBridge()
 {
+	PublishWheel::instance()->remove(this);
 	if (mServiceRoot == 0 || !mIsProducer)
 		return;
 	mServiceRoot->produceValue(QVariant(), VeQItem::Offline);
@@ -33,19 +49,41 @@ DBusBridge::~DBusBridge()
 
 void DBusBridge::setUpdateInterval(int interval)
 {
-	if (interval <= 0) {
-		if (mUpdateTimer != 0) {
-			delete mUpdateTimer;
-			mUpdateTimer = 0;
+	mUpdateInterval = qMax(0, interval);
+	for (int i=0; i<mBusItems.size(); ++i)
+		setItemPeriod(i, mUpdateInterval);
+}
+
+void DBusBridge::setPublishPeriod(const QString &path, int period)
+{
+	for (int i=0; i<mBusItems.size(); ++i) {
+		if (mBusItems[i].path == path)
+			setItemPeriod(i, qMax(0, period));
+	}
+}
+
+void DBusBridge::setPublishImmediately(const QString &path, bool immediately)
+{
+	for (QList<BusItemBridge>::iterator it = mBusItems.begin(); it != mBusItems.end(); ++it) {
+		if (it->path == path) {
+			it->immediately = immediately;
+			if (immediately && it->changed)
+				it->changed = !publishValue(*it);
 		}
-		return;
 	}
-	if (mUpdateTimer == 0) {
-		mUpdateTimer = new QTimer(this);
-		connect(mUpdateTimer, SIGNAL(timeout()), this, SLOT(onUpdateTimer()));
+	sendItemsChanged();
+}
+
+void DBusBridge::setDeadband(const QString &path, double absolute, double relative,
+							 int maxSilence)
+{
+	for (QList<BusItemBridge>::iterator it = mBusItems.begin(); it != mBusItems.end(); ++it) {
+		if (it->path == path) {
+			it->deadband = absolute;
+			it->relativeDeadband = relative;
+			it->maxSilence = maxSilence;
+		}
 	}
-	mUpdateTimer->setInterval(interval);
-	mUpdateTimer->start();
 }
 
 void DBusBridge::produce(QObject *src, const char *property, const QString &path,
@@ -58,6 +96,18 @@ void DBusBridge::produce(QObject *src, const char *property, const QString &path
 	publishValue(b);
 }
 
+void DBusBridge::produceDouble(QObject *src, const char *property,
+							   dbus_double_getter_t getter, const QString &path,
+							   const QString &unit, int precision)
+{
+	Q_ASSERT(mIsProducer);
+	Q_ASSERT(getter != 0);
+	VeQItem *vbi = mServiceRoot->itemGetOrCreate(path);
+	BusItemBridge &b = connectItem(vbi, src, property, path, unit, precision, true, false);
+	b.getDouble = getter;
+	publishValue(b);
+}
+
 void DBusBridge::produce(const QString &path, const QVariant &value,
 						 const QString &unit, int precision,
 						 dbus_transform_t _fromDBus, dbus_transform_t _toDBus)
@@ -121,6 +171,14 @@ bool DBusBridge::alwaysNotify(BridgeItem *item)
 	return bridge != 0 && bridge->alwaysNotify;
 }
 
+QString DBusBridge::itemText(BridgeItem *item)
+{
+	BusItemBridge *bridge = findBridge(item);
+	if (bridge == 0)
+		return QString();
+	return toText(bridge->path, item->getValue(), bridge->unit, bridge->precision);
+}
+
 bool DBusBridge::toDBus(const QString &, QVariant &)
 {
 	return true;
@@ -131,6 +189,10 @@ bool DBusBridge::fromDBus(const QString &, QVariant &)
 	return true;
 }
 
+void DBusBridge::valuePublished(const QString &)
+{
+}
+
 QString DBusBridge::toText(const QString &path, const QVariant &value, const QString &unit,
 						   int precision)
 {
@@ -231,18 +293,36 @@ void DBusBridge::initDeviceInstance(const QString &uniqueId, const QString &devi
 
 void DBusBridge::onPropertyChanged()
 {
-	QObject *src = sender();
-	int signalIndex = senderSignalIndex();
+	QHash<QPair<QObject *, int>, int>::const_iterator index =
+		mSignalIndices.find(qMakePair(sender(), senderSignalIndex()));
+	if (index == mSignalIndices.end())
+		return;
+	BusItemBridge &item = mBusItems[index.value()];
+	item.suppressionCounted = false;
+	if (item.period == 0 || item.immediately) {
+		item.changed = !publishValue(item);
+		sendItemsChanged();
+	} else {
+		item.changed = true;
+	}
+}
+
+void DBusBridge::onSilenceTimeout()
+{
+	qint64 now = monotonicTime();
+	qint64 next = 0;
 	for (QList<BusItemBridge>::iterator it = mBusItems.begin(); it != mBusItems.end(); ++it) {
-		if (it->src == src && it->property.isValid() &&
-				it->property.notifySignalIndex() == signalIndex) {
-			if (mUpdateTimer == 0)
-				publishValue(*it);
-			else
-				it->changed = true;
-			break;
-		}
+		if (!it->changed || it->maxSilence <= 0 || (it->period > 0 && !it->immediately))
+			continue;
+		qint64 due = it->publishedAt + it->maxSilence;
+		if (due <= now)
+			it->changed = !publishValue(*it);
+		else if (next == 0 || due < next)
+			next = due;
 	}
+	sendItemsChanged();
+	if (next > 0)
+		scheduleSilenceCheck(next);
 }
 
 void DBusBridge::onVBusItemChanged(VeQItem *item)
@@ -255,16 +335,6 @@ void DBusBridge::onVBusItemChanged(VeQItem *item)
 	updateIsInitialized();
 }
 
-void DBusBridge::onUpdateTimer()
-{
-	for (QList<BusItemBridge>::iterator it = mBusItems.begin(); it != mBusItems.end(); ++it) {
-		if (it->changed) {
-			publishValue(*it);
-			it->changed = false;
-		}
-	}
-}
-
 DBusBridge::BusItemBridge & DBusBridge::connectItem(VeQItem *busItem, QObject *src,
 													const char *property, const QString &path,
 													const QString &unit, int precision,
@@ -277,16 +347,28 @@ DBusBridge::BusItemBridge & DBusBridge::connectItem(VeQItem *busItem, QObject *s
 	bib.src = src;
 	bib.path = path;
 	bib.changed = false;
+	bib.immediately = false;
+	bib.period = 0;
 	bib.unit = unit;
 	bib.precision = precision;
 	bib.busy = false;
 	bib.alwaysNotify = alwaysNotify;
+	bib.lazyText = false;
+	bib.deadband = 0;
+	bib.relativeDeadband = 0;
+	bib.maxSilence = 0;
+	bib.suppressionCounted = false;
+	bib.publishedValue = qQNaN();
+	bib.publishedAt = 0;
 	bib.fromDBus = _fromDBus;
 	bib.toDBus = _toDBus;
+	bib.getDouble = 0;
 	if (produce) {
 		BridgeItem *bi = qobject_cast<BridgeItem *>(busItem);
-		if (bi != 0)
+		if (bi != 0) {
 			bi->setBridge(this);
+			bib.lazyText = true;
+		}
 	}
 	if (src == 0) {
 		if (property != 0) {
@@ -312,39 +394,127 @@ DBusBridge::BusItemBridge & DBusBridge::connectItem(VeQItem *busItem, QObject *s
 					int index = metaObject()->indexOfSlot("onPropertyChanged()");
 					QMetaMethod slot = metaObject()->method(index);
 					connect(src, signal, this, slot);
+					// Only the first property connected to a signal is
+					// published when the signal is emitted.
+					QPair<QObject *, int> key = qMakePair(src, mp.notifySignalIndex());
+					if (!mSignalIndices.contains(key))
+						mSignalIndices.insert(key, mBusItems.size());
 				}
 				bib.property = mp;
 			}
 		}
 	}
+	if (!mItemIndices.contains(busItem))
+		mItemIndices.insert(busItem, mBusItems.size());
 	mBusItems.push_back(bib);
+	setItemPeriod(mBusItems.size() - 1, mUpdateInterval);
 	return mBusItems.last();
 }
 
-void DBusBridge::publishValue(BusItemBridge &item)
+bool DBusBridge::publishValue(BusItemBridge &item)
 {
+	if (item.getDouble != 0) {
+		double v = item.getDouble(item.src);
+		if (!acceptChange(item, v))
+			return false;
+		writeValue(item, qIsFinite(v) ? QVariant(v) : QVariant());
+		setPublished(item, v);
+		return true;
+	}
 	QVariant value = item.src->property(item.property.name());
-	publishValue(item, value);
+	double v = value.type() == QVariant::Double ? value.toDouble() : qQNaN();
+	if (!acceptChange(item, v))
+		return false;
+	// A value rejected by `toDBus` is not published, so the deadband keeps
+	// comparing with the value on the D-Bus.
+	if (publishValue(item, value))
+		setPublished(item, v);
+	return true;
 }
 
-void DBusBridge::publishValue(DBusBridge::BusItemBridge &item, QVariant value)
+bool DBusBridge::publishValue(DBusBridge::BusItemBridge &item, QVariant value)
 {
-	Q_ASSERT(!item.busy);
-	if (item.busy)
-		return;
 	if (item.toDBus && !item.toDBus(this, value))
-		return;
+		return false;
 	if (!toDBus(item.path, value))
+		return false;
+	writeValue(item, value);
+	return true;
+}
+
+void DBusBridge::writeValue(BusItemBridge &item, const QVariant &value)
+{
+	Q_ASSERT(!item.busy);
+	if (item.busy)
 		return;
 	item.busy = true;
 	if (mIsProducer) {
 		item.item->produceValue(value);
-		QString text = toText(item.path, value, item.unit, item.precision);
-		item.item->produceText(text);
+		if (!item.lazyText)
+			item.item->produceText(toText(item.path, value, item.unit, item.precision));
+		mItemsChanged.insert(item.path, item.item);
 	} else {
 		item.item->setValue(value);
 	}
 	item.busy = false;
+	valuePublished(item.path);
+}
+
+void DBusBridge::sendItemsChanged()
+{
+	if (mItemsChanged.isEmpty())
+		return;
+	// The publisher registers each service on a connection named after the
+	// service, so the signal has the same sender as the PropertiesChanged
+	// signals of the objects.
+	QDBusConnection connection(serviceName());
+	if (!connection.isConnected() || mServiceRoot->getState() != VeQItem::Synchronized) {
+		mItemsChanged.clear();
+		return;
+	}
+	QDBusArgument argument;
+	argument.beginMap(QVariant::String, qMetaTypeId<QVariantMap>());
+	for (QMap<QString, VeQItem *>::const_iterator it = mItemsChanged.begin();
+		 it != mItemsChanged.end(); ++it) {
+		QVariant value = it.value()->getValue();
+		QVariantMap change;
+		// Invalid values are sent as an empty array, like GetValue does.
+		change.insert("Value", value.isValid() ? value : QVariant(QVariantList()));
+		// The text is left out, so it is only formatted when a client asks
+		// for it (GetText, see `BridgeItem::getText`).
+		argument.beginMapEntry();
+		argument << it.key() << change;
+		argument.endMapEntry();
+	}
+	argument.endMap();
+	mItemsChanged.clear();
+	QDBusMessage m = QDBusMessage::createSignal("/", "com.victronenergy.BusItem", "ItemsChanged")
+		<< QVariant::fromValue(argument);
+	connection.send(m);
+}
+
+void DBusBridge::setItemPeriod(int index, int period)
+{
+	BusItemBridge &item = mBusItems[index];
+	// Only properties with a notify signal will ever be changed.
+	if (item.period == period || !item.property.hasNotifySignal())
+		return;
+	if (item.period > 0)
+		PublishWheel::instance()->remove(this, index);
+	item.period = period;
+	if (period > 0) {
+		PublishWheel::instance()->add(this, index, period);
+	} else if (item.changed) {
+		item.changed = !publishValue(item);
+		sendItemsChanged();
+	}
+}
+
+void DBusBridge::publishDue(int index)
+{
+	BusItemBridge &item = mBusItems[index];
+	if (item.changed)
+		item.changed = !publishValue(item);
 }
 
 void DBusBridge::setValue(BusItemBridge &bridge, QVariant &value)
@@ -373,13 +543,54 @@ void DBusBridge::updateIsInitialized()
 	emit initialized();
 }
 
-DBusBridge::BusItemBridge *DBusBridge::findBridge(VeQItem *item)
+bool DBusBridge::acceptChange(BusItemBridge &item, double value)
 {
-	for (QList<BusItemBridge>::iterator it = mBusItems.begin(); it != mBusItems.end(); ++it) {
-		if (it->item == item)
-			return &*it;
+	if (isWithinDeadband(item, value)) {
+		if (!item.suppressionCounted) {
+			item.suppressionCounted = true;
+			++mSuppressedUpdates;
+			emit suppressedUpdatesChanged();
+		}
+		if (item.maxSilence > 0 && (item.period == 0 || item.immediately))
+			scheduleSilenceCheck(item.publishedAt + item.maxSilence);
+		return false;
 	}
-	return 0;
+	return true;
+}
+
+void DBusBridge::setPublished(BusItemBridge &item, double value)
+{
+	item.publishedValue = value;
+	item.publishedAt = monotonicTime();
+}
+
+void DBusBridge::scheduleSilenceCheck(qint64 due)
+{
+	if (mSilenceTimer->isActive() && mSilenceCheckAt <= due)
+		return;
+	mSilenceCheckAt = due;
+	mSilenceTimer->start(static_cast<int>(qMax(Q_INT64_C(0), due - monotonicTime())));
+}
+
+bool DBusBridge::isWithinDeadband(const BusItemBridge &item, double v)
+{
+	if (item.deadband <= 0 && item.relativeDeadband <= 0)
+		return false;
+	// Changes from or to NaN (no value) are always published.
+	if (!qIsFinite(v) || !qIsFinite(item.publishedValue))
+		return false;
+	if (item.maxSilence > 0 && monotonicTime() - item.publishedAt >= item.maxSilence)
+		return false;
+	double deadband = qMax(item.deadband, item.relativeDeadband * qAbs(item.publishedValue));
+	return qAbs(v - item.publishedValue) < deadband;
+}
+
+DBusBridge::BusItemBridge *DBusBridge::findBridge(VeQItem *item)
+{
+	QHash<VeQItem *, int>::const_iterator it = mItemIndices.find(item);
+	if (it == mItemIndices.end())
+		return 0;
+	return &mBusItems[it.value()];
 }
 
 void BridgeItem::produceValue(QVariant value, VeQItem::State state)
@@ -389,9 +600,22 @@ void BridgeItem::produceValue(QVariant value, VeQItem::State state)
 
 	mState = state;
 	mValue = value;
+	if (valueIsChanged)
+		mTextValid = false;
 
 	if (stateIsChanged)
 		emit stateChanged(this, state);
 	if (valueIsChanged)
 		emit valueChanged(this, value);
 }
+
+QString BridgeItem::getText(bool force)
+{
+	if (mBridge == 0)
+		return VeQItem::getText(force);
+	if (!mTextValid) {
+		mCachedText = mBridge->itemText(this);
+		mTextValid = true;
+	}
+	return mCachedText;
+}
@@ -1,9 +1,12 @@
 #ifndef DBUS_BRIDGE_H
 #define DBUS_BRIDGE_H
 
+#include <QHash>
 #include <QList>
+#include <QMap>
 #include <QMetaProperty>
 #include <QObject>
+#include <QPair>
 #include <QPointer>
 #include <QString>
 #include <velib/qt/ve_qitem.hpp>
@@ -16,6 +19,18 @@ class DBusBridge;
 
 typedef bool (*dbus_transform_t) (DBusBridge*, QVariant &v);
 
+typedef double (*dbus_double_getter_t) (const QObject *src);
+
+/*!
+ * \brief Reads a floating point property of `T` by calling `Getter`, for use
+ * with `DBusBridge::produceDouble`.
+ */
+template<typename T, double (T::*Getter)() const>
+double dbusDoubleGetter(const QObject *src)
+{
+	return (static_cast<const T *>(src)->*Getter)();
+}
+
 /*!
  * \brief Synchronizes QT properties with DBus objects.
  * This class synchronizes properties defined by Q_PROPERTY with objects on the
@@ -26,10 +41,16 @@ typedef bool (*dbus_transform_t) (DBusBridge*, QVariant &v);
  * This class assumes that the DBus object has the usual victron layout. So
  * each object should have the methods GetValue, SetValue, and GetText as well
  * as the PropertiesChanged signal.
+ * When producing, all values published within one tick of the
+ * `PublishWheel` are also sent as a single ItemsChanged signal on the root
+ * object of the service, so clients which understand it do not need to handle
+ * the signals of each object. The signal only contains the values: the text
+ * of an item is formatted when it is asked for.
  */
 class DBusBridge : public QObject
 {
 	Q_OBJECT
+	Q_PROPERTY(int suppressedUpdates READ suppressedUpdates NOTIFY suppressedUpdatesChanged)
 public:
 	DBusBridge(const QString &serviceName, bool isProducer, QObject *parent = 0);
 
@@ -37,8 +58,53 @@ public:
 
 	~DBusBridge();
 
+	/*!
+	 * \brief Sets the publish period (ms) of all properties, including the
+	 * properties connected later on.
+	 * Changes of a property are published at the end of its period, so a
+	 * property which changes often is published once per period. If
+	 * `interval` is 0, changes are published at once.
+	 * \sa setPublishPeriod
+	 */
 	void setUpdateInterval(int interval);
 
+	/*!
+	 * \brief Sets the publish period (ms) of the property connected to `path`,
+	 * overriding the update interval.
+	 * The periods are rounded up to `PublishWheel::TickInterval`.
+	 */
+	void setPublishPeriod(const QString &path, int period);
+
+	/*!
+	 * \brief Sets whether changes of the property connected to `path` are
+	 * published at once, instead of at the end of its publish period (see
+	 * `setPublishPeriod`).
+	 */
+	void setPublishImmediately(const QString &path, bool immediately);
+
+	/*!
+	 * \brief Sets the deadband of the (floating point) property connected to
+	 * `path`.
+	 * A change is not published while the difference with the last published
+	 * value is smaller than `absolute`, or `relative` times the last published
+	 * value, whichever is larger. Suppressed changes are checked again at the
+	 * end of each publish period, and published anyway once the last value was published
+	 * more than `maxSilence` ms ago (0 for no limit). Properties published at
+	 * once have no publish period: their suppressed changes are checked again
+	 * when `maxSilence` has passed.
+	 */
+	void setDeadband(const QString &path, double absolute, double relative, int maxSilence);
+
+	/*!
+	 * \brief Returns the number of property changes which were not published
+	 * because they were within the deadband. A suppressed change is counted
+	 * once, although it is checked again at the end of each publish period.
+	 */
+	int suppressedUpdates() const
+	{
+		return mSuppressedUpdates;
+	}
+
 	/*!
 	 * \brief Connects a QT property to a DBus object, and registers the object.
 	 * Connects the QT property specified by `src` and `property` to the
@@ -56,6 +122,21 @@ public:
 				 const QString &unit = QString(), int precision = -1, bool alwaysNotify = false,
 				 dbus_transform_t _fromDBus = 0, dbus_transform_t _toDBus = 0);
 
+	/*!
+	 * \brief Connects a floating point QT property to a DBus object, and
+	 * registers the object.
+	 * Like `produce`, but the value is read with `getter` (see
+	 * `dbusDoubleGetter`) instead of the meta object system. The value is not
+	 * passed through `toDBus`: NaN is published as an invalid value, other
+	 * values as they are. Intended for measurements, which are published
+	 * often.
+	 * \param property The name of the property. Only used to find its notify
+	 * signal.
+	 */
+	void produceDouble(QObject *src, const char *property, dbus_double_getter_t getter,
+					   const QString &path, const QString &unit = QString(),
+					   int precision = -1);
+
 	/*!
 	 * \brief Pushes a constant value to the DBus, and registers the object.
 	 * `value` will be pushed (SetValue) to the DBus object specified by
@@ -110,6 +191,12 @@ public:
 
 	bool alwaysNotify(BridgeItem *item);
 
+	/*!
+	 * \brief Returns the text (GetText) of a produced item, formatted from its
+	 * current value using `toText`.
+	 */
+	QString itemText(BridgeItem *item);
+
 	bool addSetting(const QString &path, const QVariant &defaultValue,
 					const QVariant &minValue, const QVariant &maxValue, bool silent);
 
@@ -118,6 +205,8 @@ public:
 signals:
 	void initialized();
 
+	void suppressedUpdatesChanged();
+
 protected:
 	/*!
 	 * \brief Allows conversion of values sent to DBus.
@@ -148,12 +237,23 @@ protected:
 	virtual QString toText(const QString &path, const QVariant &value, const QString &unit,
 						   int precision);
 
+	/*!
+	 * \brief Called after a value has been sent to the DBus.
+	 * The default implementation of this function is empty.
+	 * \param path The path to the DBus object.
+	 */
+	virtual void valuePublished(const QString &path);
+
 private slots:
 	void onPropertyChanged();
 
 	void onVBusItemChanged(VeQItem *item);
 
-	void onUpdateTimer();
+	/*!
+	 * \brief Publishes the suppressed changes of the properties published at
+	 * once, whose `maxSilence` has passed.
+	 */
+	void onSilenceTimeout();
 
 private:
 	struct BusItemBridge
@@ -166,9 +266,25 @@ private:
 		int precision;
 		bool busy;
 		bool changed;
+		bool immediately;
+		/// Publish period in ms, 0 if changes are published at once.
+		int period;
 		bool alwaysNotify;
+		/// The text is formatted by the item on demand (see `BridgeItem::getText`).
+		bool lazyText;
+		double deadband;
+		double relativeDeadband;
+		int maxSilence;
+		/// Set when the pending change has been counted as suppressed.
+		bool suppressionCounted;
+		/// Last published value of the property, NaN if not a number.
+		double publishedValue;
+		/// Time (see `monotonicTime`) at which `publishedValue` was published.
+		qint64 publishedAt;
 		dbus_transform_t fromDBus;
 		dbus_transform_t toDBus;
+		/// Set for items connected with `produceDouble`.
+		dbus_double_getter_t getDouble;
 	};
 
 	BusItemBridge &connectItem(VeQItem *item, QObject *src, const char *property,
@@ -176,19 +292,83 @@ private:
 							   bool publish, bool alwaysNotify,
 							   dbus_transform_t _fromDBus = 0, dbus_transform_t _toDBus = 0);
 
-	void publishValue(BusItemBridge &item);
+	/*!
+	 * \brief Publishes the current value of the property of `item`.
+	 * \retval false if the change was within the deadband, and not published.
+	 */
+	bool publishValue(BusItemBridge &item);
+
+	/*!
+	 * \brief Publishes `value`, after converting it with `toDBus`.
+	 * \retval false if the conversion rejected the value, and it was not
+	 * published.
+	 */
+	bool publishValue(BusItemBridge &item, QVariant value);
+
+	/*!
+	 * \brief Sends a value, which has been converted by `toDBus` already, to
+	 * the DBus.
+	 */
+	void writeValue(BusItemBridge &item, const QVariant &value);
+
+	/*!
+	 * \brief Checks the deadband of `item`.
+	 * A suppressed change of a property published at once is checked again
+	 * when the `maxSilence` of the property has passed.
+	 * \retval false if the change is within the deadband, and should not be
+	 * published.
+	 */
+	bool acceptChange(BusItemBridge &item, double value);
 
-	void publishValue(BusItemBridge &item, QVariant value);
+	/*!
+	 * \brief Stores `value` as the last published value of `item`. Called
+	 * after the value has been published.
+	 */
+	static void setPublished(BusItemBridge &item, double value);
+
+	/*!
+	 * \brief Makes sure `onSilenceTimeout` is called at `due` (see
+	 * `monotonicTime`) or earlier.
+	 */
+	void scheduleSilenceCheck(qint64 due);
+
+	/*!
+	 * \brief Sends the values published since the last call as a single
+	 * ItemsChanged signal.
+	 */
+	void sendItemsChanged();
+
+	void setItemPeriod(int index, int period);
+
+	/*!
+	 * \brief Called by the `PublishWheel` at the end of each publish period
+	 * of the item at `index`.
+	 */
+	void publishDue(int index);
 
 	void setValue(BusItemBridge &bridge, QVariant &value);
 
 	BusItemBridge *findBridge(VeQItem *item);
 
+	static bool isWithinDeadband(const BusItemBridge &item, double value);
+
 	QList<BusItemBridge> mBusItems;
+	/// Index in `mBusItems` by D-Bus item.
+	QHash<VeQItem *, int> mItemIndices;
+	/// Index in `mBusItems` by source object and (notify) signal index.
+	QHash<QPair<QObject *, int>, int> mSignalIndices;
+	/// Items published since the last ItemsChanged signal, by path.
+	QMap<QString, VeQItem *> mItemsChanged;
 	QPointer<VeQItem> mServiceRoot;
-	QTimer *mUpdateTimer;
+	/// Calls `onSilenceTimeout` at `mSilenceCheckAt`.
+	QTimer *mSilenceTimer;
+	qint64 mSilenceCheckAt;
+	int mUpdateInterval;
 	bool mIsProducer;
 	bool mIsInitialized;
+	int mSuppressedUpdates;
+
+	friend class PublishWheel;
 };
 
 class BridgeItem : public VeQItem
@@ -197,13 +377,15 @@ class BridgeItem : public VeQItem
 public:
 	explicit BridgeItem(VeQItemProducer *producer, QObject *parent = 0):
 		VeQItem(producer, parent),
-		mBridge(0)
+		mBridge(0),
+		mTextValid(false)
 	{
 	}
 
 	void setBridge(DBusBridge *bridge)
 	{
 		mBridge = bridge;
+		mTextValid = false;
 	}
 
 	virtual int setValue(QVariant const &value)
@@ -217,8 +399,18 @@ public:
 
 	virtual void produceValue(QVariant value, State state = Synchronized);
 
+	/*!
+	 * \brief Returns the text of the item.
+	 * If the item is connected to a bridge, the text is formatted by the bridge
+	 * when it is first asked for, and cached until the value changes. Most
+	 * values are published far more often than their text is requested.
+	 */
+	virtual QString getText(bool force = false);
+
 private:
 	DBusBridge *mBridge;
+	QString mCachedText;
+	bool mTextValid;
 };
 
 class BridgeItemProducer: public VeQItemProducer
@@ -2,6 +2,7 @@
 #define DEFINES_H
 
 #include <QByteArray>
+#include <QElapsedTimer>
 #include <QtGlobal>
 #include <qnumeric.h>
 
@@ -12,6 +13,20 @@ enum Phase {
 	PhaseL3 = 3
 };
 
+/// Quantities retrieved from an energy meter.
+enum ParameterType {
+	None,
+	Dummy,
+	Power,
+	Voltage,
+	Current,
+	PositiveEnergy,
+	NegativeEnergy,
+	// Diagnostics, these are not retrieved from the energy meter.
+	ResponseTime,
+	ResponseTimeout
+};
+
 enum Position {
 	Input1 = 0,
 	Output = 1,
@@ -38,6 +53,18 @@ inline quint16 toUInt16(const QByteArray &a, int offset)
 	return toUInt16(static_cast<quint8>(a[offset]), static_cast<quint8>(a[offset + 1]));
 }
 
+/*!
+ * Returns the time of the monotonic clock in milliseconds. Unlike
+ * `QElapsedTimer::elapsed`, the result can be compared between objects and
+ * threads. Used to timestamp measurements.
+ */
+inline qint64 monotonicTime()
+{
+	QElapsedTimer timer;
+	timer.start();
+	return timer.msecsSinceReference();
+}
+
 /// This value is used to indicate that the correct device instance has not been set yet.
 const int InvalidDeviceInstance = -1;
 const int MinDeviceInstance = 30;
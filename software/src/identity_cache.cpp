@@ -0,0 +1,66 @@
+#include <QRegExp>
+#include <QSettings>
+#include <QsLog.h>
+#include "identity_cache.h"
+
+static QString cacheFileName;
+
+void IdentityCache::setFileName(const QString &fileName)
+{
+	cacheFileName = fileName;
+}
+
+bool IdentityCache::find(const QString &portName, int slaveAddress, DeviceIdentity &identity)
+{
+	if (cacheFileName.isEmpty())
+		return false;
+	QSettings settings(cacheFileName, QSettings::IniFormat);
+	settings.beginGroup(getGroup(portName, slaveAddress));
+	if (!settings.contains("Serial"))
+		return false;
+	identity.deviceType = settings.value("DeviceType").toInt();
+	identity.deviceSubType = settings.value("DeviceSubType").toInt();
+	identity.serial = settings.value("Serial").toString();
+	identity.firmwareVersion = settings.value("FirmwareVersion").toInt();
+	identity.phaseSequence = settings.value("PhaseSequence", -1).toInt();
+	int system = settings.value("MeasuringSystem").toInt();
+	identity.system = system >= MultiPhaseSystem && system <= PiggybackSystem ?
+		static_cast<MeasuringSystem>(system) : AnySystem;
+	return !identity.serial.isEmpty();
+}
+
+void IdentityCache::store(const QString &portName, int slaveAddress,
+						  const DeviceIdentity &identity)
+{
+	if (cacheFileName.isEmpty())
+		return;
+	QSettings settings(cacheFileName, QSettings::IniFormat);
+	settings.beginGroup(getGroup(portName, slaveAddress));
+	settings.setValue("DeviceType", identity.deviceType);
+	settings.setValue("DeviceSubType", identity.deviceSubType);
+	settings.setValue("Serial", identity.serial);
+	settings.setValue("FirmwareVersion", identity.firmwareVersion);
+	settings.setValue("PhaseSequence", identity.phaseSequence);
+	settings.setValue("MeasuringSystem", static_cast<int>(identity.system));
+	settings.endGroup();
+	settings.sync();
+	if (settings.status() != QSettings::NoError)
+		QLOG_WARN() << "Could not write identity cache" << cacheFileName;
+}
+
+void IdentityCache::remove(const QString &portName, int slaveAddress)
+{
+	if (cacheFileName.isEmpty())
+		return;
+	QSettings settings(cacheFileName, QSettings::IniFormat);
+	settings.remove(getGroup(portName, slaveAddress));
+}
+
+QString IdentityCache::getGroup(const QString &portName, int slaveAddress)
+{
+	// Port names (eg. /dev/ttyUSB0) contain slashes, which QSettings uses to
+	// separate groups.
+	QString port = portName;
+	port.replace(QRegExp("[^A-Za-z0-9_-]"), "_");
+	return QString("%1_mb%2").arg(port).arg(slaveAddress);
+}
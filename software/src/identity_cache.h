@@ -0,0 +1,59 @@
+#ifndef IDENTITY_CACHE_H
+#define IDENTITY_CACHE_H
+
+#include <QString>
+#include "register_maps.h"
+
+/*!
+ * Identity and setup state of an energy meter, as found during the last
+ * detection.
+ */
+struct DeviceIdentity {
+	int deviceType;
+	int deviceSubType;
+	QString serial;
+	int firmwareVersion;
+	int phaseSequence;
+	/// The measuring system the meter has been set up for.
+	MeasuringSystem system;
+};
+
+/*!
+ * Persistent cache of the identities of the energy meters, keyed by port name
+ * and slave address.
+ *
+ * Detecting an energy meter takes up to 6 requests, which may take several
+ * seconds on a zigbee link. With the cache the identity is verified by reading
+ * the serial number only, and the setup of the meter is skipped if the
+ * measuring system has not changed.
+ *
+ * The cache is stored in an ini file. Each call opens the file with its own
+ * `QSettings` object, so the cache may be used from the serial port threads.
+ */
+class IdentityCache
+{
+public:
+	/*!
+	 * Sets the file used to store the identities. The cache is disabled if
+	 * the file name is empty (default). Must be called before the serial port
+	 * threads are started.
+	 */
+	static void setFileName(const QString &fileName);
+
+	/*!
+	 * Retrieves the identity of the meter last seen on the port and slave
+	 * address.
+	 * @retval false if there is no identity stored.
+	 */
+	static bool find(const QString &portName, int slaveAddress, DeviceIdentity &identity);
+
+	static void store(const QString &portName, int slaveAddress,
+					  const DeviceIdentity &identity);
+
+	static void remove(const QString &portName, int slaveAddress);
+
+private:
+	static QString getGroup(const QString &portName, int slaveAddress);
+};
+
+#endif // IDENTITY_CACHE_H
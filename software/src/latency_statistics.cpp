@@ -0,0 +1,68 @@
+#include <cmath>
+#include <qnumeric.h>
+#include <string.h>
+#include "latency_statistics.h"
+
+LatencyStatistics::LatencyStatistics(QObject *parent):
+	QObject(parent),
+	mCount(0),
+	mP50(qQNaN()),
+	mP95(qQNaN()),
+	mP99(qQNaN())
+{
+	memset(mBuckets, 0, sizeof(mBuckets));
+}
+
+void LatencyStatistics::add(qint64 latency)
+{
+	int index = 0;
+	if (latency > 1) {
+		index = static_cast<int>(std::ceil(BucketsPerOctave * std::log(static_cast<double>(latency)) /
+										   std::log(2.0)));
+		index = qMin(index, BucketCount - 1);
+	}
+	++mBuckets[index];
+	++mCount;
+	if (mCount >= MaxCount) {
+		mCount = 0;
+		for (int i=0; i<BucketCount; ++i) {
+			mBuckets[i] /= 2;
+			mCount += mBuckets[i];
+		}
+	}
+}
+
+void LatencyStatistics::update()
+{
+	double p50 = percentile(0.50);
+	double p95 = percentile(0.95);
+	double p99 = percentile(0.99);
+	if (!(p50 == mP50 || (qIsNaN(p50) && qIsNaN(mP50)))) {
+		mP50 = p50;
+		emit p50Changed();
+	}
+	if (!(p95 == mP95 || (qIsNaN(p95) && qIsNaN(mP95)))) {
+		mP95 = p95;
+		emit p95Changed();
+	}
+	if (!(p99 == mP99 || (qIsNaN(p99) && qIsNaN(mP99)))) {
+		mP99 = p99;
+		emit p99Changed();
+	}
+}
+
+double LatencyStatistics::percentile(double fraction) const
+{
+	if (mCount == 0)
+		return qQNaN();
+	quint32 rank = static_cast<quint32>(std::ceil(fraction * mCount));
+	quint32 sum = 0;
+	for (int i=0; i<BucketCount; ++i) {
+		sum += mBuckets[i];
+		if (sum >= rank) {
+			// Upper bound of the bucket, rounded to whole milliseconds.
+			return qRound(std::pow(2.0, static_cast<double>(i) / BucketsPerOctave));
+		}
+	}
+	return qQNaN();
+}
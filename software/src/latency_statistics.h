@@ -0,0 +1,75 @@
+#ifndef LATENCY_STATISTICS_H
+#define LATENCY_STATISTICS_H
+
+#include <QObject>
+
+/*!
+ * Histogram of latencies, with the 50th, 95th and 99th percentile as
+ * properties, so they can be published on the D-Bus.
+ *
+ * The buckets are spaced logarithmically (8 per power of 2, so the
+ * resolution is about 9%), from 1ms to about a minute. Values outside this
+ * range are added to the first or last bucket. Once the histogram contains
+ * `MaxCount` values, all buckets are halved, so older values gradually lose
+ * their weight.
+ *
+ * The percentiles are not updated when a value is added, but when `update`
+ * is called.
+ */
+class LatencyStatistics : public QObject
+{
+	Q_OBJECT
+	Q_PROPERTY(double p50 READ p50 NOTIFY p50Changed)
+	Q_PROPERTY(double p95 READ p95 NOTIFY p95Changed)
+	Q_PROPERTY(double p99 READ p99 NOTIFY p99Changed)
+public:
+	explicit LatencyStatistics(QObject *parent = 0);
+
+	/*!
+	 * Adds a latency (ms) to the histogram.
+	 */
+	void add(qint64 latency);
+
+	/*!
+	 * Recomputes the percentiles from the histogram. The percentiles are NaN
+	 * while the histogram is empty.
+	 */
+	void update();
+
+	double p50() const
+	{
+		return mP50;
+	}
+
+	double p95() const
+	{
+		return mP95;
+	}
+
+	double p99() const
+	{
+		return mP99;
+	}
+
+signals:
+	void p50Changed();
+
+	void p95Changed();
+
+	void p99Changed();
+
+private:
+	double percentile(double fraction) const;
+
+	static const int BucketsPerOctave = 8;
+	static const int BucketCount = 16 * BucketsPerOctave;
+	static const quint32 MaxCount = 10000;
+
+	quint32 mBuckets[BucketCount];
+	quint32 mCount;
+	double mP50;
+	double mP95;
+	double mP99;
+};
+
+#endif // LATENCY_STATISTICS_H
@@ -9,8 +9,13 @@
 #include <velib/qt/ve_qitems_dbus.hpp>
 #include <velib/qt/ve_qitem_dbus_publisher.hpp>
 #include "dbus_bridge.h"
+#include "identity_cache.h"
 #include "ac_sensor.h"
 #include "ac_sensor_mediator.h"
+#include "modbus.h"
+#include "port_manager.h"
+#include "register_maps.h"
+#include "slave_scanner.h"
 
 bool initDBus(QDBusConnection &dbus)
 {
@@ -51,16 +56,6 @@ void initLogger(QsLogging::Level logLevel)
 	logger.setLoggingLevel(logLevel);
 }
 
-extern "C"
-{
-// This function is called by the serial port API from velib when the device is
-// disconnected from the serial port.
-void pltExit(int ret)
-{
-	QCoreApplication::exit(ret);
-}
-}
-
 int main(int argc, char *argv[])
 {
 	QCoreApplication app(argc, argv);
@@ -69,10 +64,23 @@ int main(int argc, char *argv[])
 
 	initLogger(QsLogging::InfoLevel);
 
+	// Needed for queued connections between the serial port threads and the
+	// main thread.
+	qRegisterMetaType<ConnectionState>();
+
 	bool isZigbee = false;
-	QString portName;
+	bool keepRunning = false;
+	QStringList portNames;
+	QString portsFile;
+	QString registerMapsFile = ":/register_maps.xml";
+	QString identityCacheFile;
 	QString dbusAddress = "system";
 	int timeout = 250;
+	int minTimeout = -1;
+	int maxTimeout = -1;
+	int probeTimeout = -1;
+	int firstAddress = 1;
+	int lastAddress = 2;
 	QStringList args = app.arguments();
 	args.pop_front();
 
@@ -90,9 +98,37 @@ int main(int argc, char *argv[])
 			QLOG_INFO() << "\t-d level, --debug level";
 			QLOG_INFO() << "\t Set log level";
 			QLOG_INFO() << "\t--timeout milliseconds";
-			QLOG_INFO() << "\t Timeout in milliseconds for RS485 responses";
-			QLOG_INFO() << "\t <Port Name>";
-			QLOG_INFO() << "\t Name of communication port (eg. /dev/ttyUSB0)";
+			QLOG_INFO() << "\t Timeout in milliseconds for RS485 responses. This value is used until";
+			QLOG_INFO() << "\t a meter has responded. After that the timeout is based on the measured";
+			QLOG_INFO() << "\t response times.";
+			QLOG_INFO() << "\t--min-timeout milliseconds";
+			QLOG_INFO() << "\t Lower limit of the response timeout (default 100, 500 for zigbee)";
+			QLOG_INFO() << "\t--max-timeout milliseconds";
+			QLOG_INFO() << "\t Upper limit of the response timeout (default 1000, 5000 for zigbee)";
+			QLOG_INFO() << "\t--probe-timeout milliseconds";
+			QLOG_INFO() << "\t Timeout used while looking for energy meters (default 100, 1000 for";
+			QLOG_INFO() << "\t zigbee)";
+			QLOG_INFO() << "\t--slave-addresses first-last";
+			QLOG_INFO() << "\t Range of slave addresses scanned for energy meters (default 1-2)";
+			QLOG_INFO() << "\t--register-maps path";
+			QLOG_INFO() << "\t XML file with the register maps of the energy meters. Default is the";
+			QLOG_INFO() << "\t built-in file (see register_maps.xml in the source code).";
+			QLOG_INFO() << "\t--identity-cache path";
+			QLOG_INFO() << "\t File used to remember the identity and setup of the energy meters, so";
+			QLOG_INFO() << "\t detection is faster after a restart or reconnect. Disabled by default.";
+			QLOG_INFO() << "\t--ports-file path";
+			QLOG_INFO() << "\t File with the names of the communication ports to use, one per line.";
+			QLOG_INFO() << "\t Changes to the file are applied while running.";
+			QLOG_INFO() << "\t--keep-running";
+			QLOG_INFO() << "\t Do not terminate when the energy meters or the port are lost, but";
+			QLOG_INFO() << "\t retry the port with increasing intervals. Implied if more than one port";
+			QLOG_INFO() << "\t is used.";
+			QLOG_INFO() << "\t <Port Name> [<Port Name> ...]";
+			QLOG_INFO() << "\t Name of communication port (eg. /dev/ttyUSB0). Use tcp://host[:port]";
+			QLOG_INFO() << "\t for Modbus TCP, or rtu-tcp://host:port for an Ethernet to RS485";
+			QLOG_INFO() << "\t gateway (Modbus RTU over TCP). If more than one port";
+			QLOG_INFO() << "\t is specified (or --ports-file is used), all ports are served by this";
+			QLOG_INFO() << "\t process, and the process will not terminate when a port is lost.";
 			exit(1);
 		} else if (arg == "-V" || arg == "--version") {
 			QLOG_INFO() << VERSION;
@@ -113,24 +149,66 @@ int main(int argc, char *argv[])
 		} else if (arg == "--timeout") {
 			if (!args.isEmpty())
 				timeout = qBound(150, args.takeFirst().toInt(), 10000);
+		} else if (arg == "--min-timeout") {
+			if (!args.isEmpty())
+				minTimeout = qBound(20, args.takeFirst().toInt(), 10000);
+		} else if (arg == "--max-timeout") {
+			if (!args.isEmpty())
+				maxTimeout = qBound(150, args.takeFirst().toInt(), 30000);
+		} else if (arg == "--probe-timeout") {
+			if (!args.isEmpty())
+				probeTimeout = qBound(20, args.takeFirst().toInt(), 10000);
+		} else if (arg == "--slave-addresses") {
+			if (!args.isEmpty()) {
+				QStringList range = args.takeFirst().split('-');
+				firstAddress = qBound(1, range.first().toInt(), 247);
+				lastAddress = qBound(firstAddress, range.last().toInt(), 247);
+			}
 		} else if (arg == "-b" || arg == "--dbus") {
 			if (!args.isEmpty())
 				dbusAddress = args.takeFirst();
 		} else if (arg == "-z" || arg == "--zigbee") {
 			timeout = qMax(2000, timeout);
 			isZigbee = true;
+		} else if (arg == "--register-maps") {
+			if (!args.isEmpty())
+				registerMapsFile = args.takeFirst();
+		} else if (arg == "--identity-cache") {
+			if (!args.isEmpty())
+				identityCacheFile = args.takeFirst();
+		} else if (arg == "--keep-running") {
+			keepRunning = true;
+		} else if (arg == "--ports-file") {
+			if (!args.isEmpty())
+				portsFile = args.takeFirst();
 		} else if (!arg.startsWith('-')) {
-			portName = arg;
+			portNames.append(arg);
 		}
 	}
 
-	if (portName.isEmpty()) {
+	if (portNames.isEmpty() && portsFile.isEmpty()) {
 		QLOG_ERROR() << "No communication port specified on command line";
 		exit(2);
-	} else {
-		QLOG_INFO() << "Connecting to" << portName;
 	}
 
+	// Must be done before the serial port threads are started.
+	if (!RegisterMaps::load(registerMapsFile))
+		exit(2);
+	IdentityCache::setFileName(identityCacheFile);
+	SlaveScanner::setAddressRange(firstAddress, lastAddress);
+
+	ModbusTimeouts timeouts;
+	timeouts.initial = timeout;
+	if (minTimeout < 0)
+		minTimeout = isZigbee ? 500 : 100;
+	timeouts.minimum = qMin(minTimeout, timeout);
+	if (maxTimeout < 0)
+		maxTimeout = isZigbee ? 5000 : 1000;
+	timeouts.maximum = qMax(maxTimeout, timeout);
+	if (probeTimeout < 0)
+		probeTimeout = isZigbee ? 1000 : 100;
+	timeouts.probe = qMin(probeTimeout, timeout);
+
 	VeQItemDbusProducer producer(VeQItems::getRoot(), "sub", false, false);
 	producer.setListenIndividually(true);
 	producer.open(dbusAddress);
@@ -139,17 +217,28 @@ int main(int argc, char *argv[])
 	VeQItemDbusPublisher publisher(dbusExportProducer.services());
 	publisher.open(dbusAddress);
 
-	qRegisterMetaType<ConnectionState>();
-
 	if (!initDBus(producer.dbusConnection())) {
 		return 1; // Not success
 	}
 
 	VeQItem *settingsRoot = VeQItems::getRoot()->itemGetOrCreate("sub/com.victronenergy.settings", false);
-	AcSensorMediator m(portName, timeout, isZigbee, settingsRoot);
 
-	app.connect(&m, SIGNAL(connectionLost()), &app, SLOT(quit()));
-	app.connect(&m, SIGNAL(serialEvent(const char *)), &app, SLOT(quit()));
+	if (portNames.size() == 1 && portsFile.isEmpty() && !keepRunning) {
+		// Single port mode: terminate when the energy meters are lost, so
+		// serial-starter can try another driver on the port.
+		QLOG_INFO() << "Connecting to" << portNames.first();
+		AcSensorMediator m(portNames.first(), timeouts, isZigbee, settingsRoot);
+
+		app.connect(&m, SIGNAL(connectionLost()), &app, SLOT(quit()));
+		app.connect(&m, SIGNAL(serialEvent(QString)), &app, SLOT(quit()));
+
+		return app.exec();
+	}
+
+	PortManager portManager(timeouts, isZigbee, settingsRoot);
+	portManager.setPorts(portNames);
+	if (!portsFile.isEmpty())
+		portManager.setPortsFile(portsFile);
 
 	return app.exec();
 }
@@ -0,0 +1,215 @@
+#include <QsLog.h>
+#include <QTimer>
+#include <QUrl>
+#include <qnumeric.h>
+#include <string.h>
+#include "defines.h"
+#include "modbus.h"
+#include "modbus_rtu.h"
+#include "modbus_tcp.h"
+#include "serial_transport.h"
+#include "tcp_transport.h"
+
+static const int DefaultTcpPort = 502;
+/// Limits the timeout backoff to 2^MaxBackoff times the computed timeout.
+static const int MaxBackoff = 4;
+/// Maximum time (ms) a request may wait in the queue before requests with a
+/// higher priority are postponed, per priority.
+static const int MaxWaitTime[Modbus::PriorityCount] = { 0, 250, 1000 };
+static const int ReportWaitTimesInterval = 60000;
+
+Modbus::Modbus(const ModbusTimeouts &timeouts, QObject *parent):
+	QObject(parent),
+	mTimeouts(timeouts),
+	mReportTimer(new QTimer(this))
+{
+	memset(mListeners, 0, sizeof(mListeners));
+	memset(mWaitTimes, 0, sizeof(mWaitTimes));
+	mRequests.reserve(16);
+	mQueueClock.start();
+	mReportTimer->setInterval(ReportWaitTimesInterval);
+	connect(mReportTimer, SIGNAL(timeout()), this, SLOT(onReportWaitTimes()));
+	mReportTimer->start();
+	for (int i=0; i<256; ++i) {
+		ResponseTimeEstimate &e = mEstimates[i];
+		e.average = qQNaN();
+		e.deviation = 0;
+		e.timeoutCount = 0;
+	}
+}
+
+Modbus *Modbus::create(const QString &portName, const ModbusTimeouts &timeouts,
+					   QObject *parent)
+{
+	QUrl url(portName);
+	QString scheme = url.scheme();
+	Modbus *modbus = 0;
+	if (scheme == "tcp") {
+		TcpTransport *transport = new TcpTransport(url.host(), url.port(DefaultTcpPort));
+		modbus = new ModbusTcp(transport, timeouts, parent);
+	} else if (scheme == "rtu-tcp") {
+		TcpTransport *transport = new TcpTransport(url.host(), url.port(DefaultTcpPort));
+		modbus = new ModbusRtu(transport, timeouts, parent);
+	} else {
+		SerialTransport *transport = new SerialTransport(portName, 9600);
+		modbus = new ModbusRtu(transport, timeouts, parent);
+	}
+	modbus->setObjectName(portName);
+	return modbus;
+}
+
+void Modbus::setListener(quint8 slaveAddress, ModbusListener *listener)
+{
+	mListeners[slaveAddress] = listener;
+}
+
+void Modbus::readRegisters(FunctionCode function, quint8 slaveAddress, quint16 startReg,
+						   quint16 count, Priority priority, int timeout)
+{
+	if (count > MaxRegisterCount) {
+		QLOG_ERROR() << "Too many registers requested:" << count;
+		count = MaxRegisterCount;
+	}
+	addRequest(function, slaveAddress, startReg, count, priority, timeout);
+}
+
+void Modbus::writeRegister(FunctionCode function, quint8 slaveAddress, quint16 reg,
+						   quint16 value, Priority priority)
+{
+	addRequest(function, slaveAddress, reg, value, priority, 0);
+}
+
+double Modbus::responseTime(quint8 slaveAddress) const
+{
+	return mEstimates[slaveAddress].average;
+}
+
+int Modbus::responseTimeout(quint8 slaveAddress) const
+{
+	const ResponseTimeEstimate &e = mEstimates[slaveAddress];
+	// No backoff for slaves which have never responded. Otherwise probing an
+	// absent slave would block the bus longer and longer.
+	if (qIsNaN(e.average))
+		return mTimeouts.initial;
+	double timeout = e.average + 4 * e.deviation;
+	timeout = qBound<double>(mTimeouts.minimum, timeout, mTimeouts.maximum);
+	timeout *= 1 << qMin(e.timeoutCount, MaxBackoff);
+	return qMin(qRound(timeout), mTimeouts.maximum);
+}
+
+int Modbus::requestTimeout(const Request &request) const
+{
+	return request.timeout > 0 ? request.timeout : responseTimeout(request.slaveAddress);
+}
+
+void Modbus::onReportWaitTimes()
+{
+	static const char *names[PriorityCount] = { "high", "normal", "low" };
+	for (int i=0; i<PriorityCount; ++i) {
+		WaitTimes &w = mWaitTimes[i];
+		if (w.count == 0)
+			continue;
+		QLOG_DEBUG() << "Modbus queue" << objectName() << names[i] << "priority:"
+					 << w.count << "requests, average wait" << w.total / w.count
+					 << "ms, maximum" << w.maximum << "ms";
+		w.count = 0;
+		w.total = 0;
+		w.maximum = 0;
+	}
+}
+
+bool Modbus::takeRequest(Request &request)
+{
+	if (mRequests.isEmpty())
+		return false;
+	// The queue is short (one or two requests per slave), so a linear search
+	// is fine. Requests with the same deadline are sent in FIFO order.
+	int index = 0;
+	for (int i=1; i<mRequests.size(); ++i) {
+		if (mRequests[i].deadline < mRequests[index].deadline)
+			index = i;
+	}
+	request = mRequests[index];
+	mRequests.remove(index);
+	qint64 wait = mQueueClock.elapsed() - request.queuedAt;
+	WaitTimes &w = mWaitTimes[request.priority];
+	++w.count;
+	w.total += wait;
+	w.maximum = qMax(w.maximum, wait);
+	return true;
+}
+
+void Modbus::processPdu(quint8 slaveAddress, int function, const quint8 *pdu, int size,
+						int registerCount)
+{
+	ModbusListener *listener = mListeners[slaveAddress];
+	if (listener == 0)
+		return;
+	int responseFunction = size > 0 ? pdu[0] : 0;
+	if ((responseFunction & 0x7F) != function) {
+		listener->onErrorReceived(ProtocolError, responseFunction);
+		return;
+	}
+	if ((responseFunction & 0x80) != 0) {
+		listener->onErrorReceived(Exception, size > 1 ? pdu[1] : 0);
+		return;
+	}
+	switch (function) {
+	case ReadHoldingRegisters:
+	case ReadInputRegisters:
+		if (size < 2 || pdu[1] != 2 * registerCount || size != 2 + pdu[1] ||
+			registerCount > MaxRegisterCount) {
+			break;
+		}
+		for (int i=0; i<registerCount; ++i)
+			mRegisters[i] = toUInt16(pdu[2 + 2 * i], pdu[3 + 2 * i]);
+		listener->onReadCompleted(function, RegisterView(mRegisters, registerCount));
+		return;
+	case WriteSingleRegister:
+		if (size != 5)
+			break;
+		listener->onWriteCompleted(function, toUInt16(pdu[1], pdu[2]), toUInt16(pdu[3], pdu[4]));
+		return;
+	default:
+		break;
+	}
+	listener->onErrorReceived(Unsupported, function);
+}
+
+void Modbus::reportError(quint8 slaveAddress, ErrorType errorType, int exception)
+{
+	if (errorType == Timeout)
+		++mEstimates[slaveAddress].timeoutCount;
+	ModbusListener *listener = mListeners[slaveAddress];
+	if (listener != 0)
+		listener->onErrorReceived(errorType, exception);
+}
+
+void Modbus::addResponseTime(quint8 slaveAddress, double time)
+{
+	ResponseTimeEstimate &e = mEstimates[slaveAddress];
+	if (qIsNaN(e.average)) {
+		e.average = time;
+		e.deviation = time / 2;
+	} else {
+		e.deviation = 0.75 * e.deviation + 0.25 * qAbs(e.average - time);
+		e.average = 0.875 * e.average + 0.125 * time;
+	}
+	e.timeoutCount = 0;
+}
+
+void Modbus::addRequest(FunctionCode function, quint8 slaveAddress, quint16 reg, quint16 value,
+						Priority priority, int timeout)
+{
+	Request r;
+	r.function = function;
+	r.slaveAddress = slaveAddress;
+	r.reg = reg;
+	r.value = value;
+	r.priority = priority;
+	r.queuedAt = mQueueClock.elapsed();
+	r.deadline = r.queuedAt + MaxWaitTime[priority];
+	r.timeout = timeout;
+	mRequests.append(r);
+	onRequestQueued();
+}
@@ -0,0 +1,293 @@
+#ifndef MODBUS_H
+#define MODBUS_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QVector>
+
+class QTimer;
+
+/*!
+ * Read-only view on the register values of a response.
+ *
+ * The values are owned by the `Modbus` object which created the view, and
+ * are only valid while the callback receiving the view is running.
+ */
+class RegisterView
+{
+public:
+	RegisterView(const quint16 *values, int count):
+		mValues(values),
+		mCount(count)
+	{
+	}
+
+	int size() const
+	{
+		return mCount;
+	}
+
+	quint16 operator[](int i) const
+	{
+		Q_ASSERT(i >= 0 && i < mCount);
+		return mValues[i];
+	}
+
+private:
+	const quint16 *mValues;
+	int mCount;
+};
+
+/*!
+ * Limits of the response timeout, in milliseconds.
+ */
+struct ModbusTimeouts {
+	/// Used until the first response of a slave has been received.
+	int initial;
+	int minimum;
+	int maximum;
+	/// Used for the requests sent to find the slaves on the bus.
+	int probe;
+};
+
+/*!
+ * Receives the results of the requests sent to a single slave.
+ * @sa Modbus::setListener
+ */
+class ModbusListener
+{
+public:
+	virtual ~ModbusListener() {}
+
+	virtual void onReadCompleted(int function, const RegisterView &registers) = 0;
+
+	virtual void onWriteCompleted(int function, quint16 address, quint16 value) = 0;
+
+	virtual void onErrorReceived(int errorType, int exception) = 0;
+};
+
+/*!
+ * Base class of the modbus implementations (RTU and TCP).
+ *
+ * Supported functions: `ReadHoldingRegisters`, `ReadInputRegisters`,
+ * and `WriteSingleRegister`.
+ *
+ * Communication is implemented asynchronously. It is allowed to add multiple
+ * request at once. They will be queued and sent to the device whenever it is
+ * ready.
+ *
+ * Results are reported to the listener registered for the slave address of
+ * the request. The data of the responses is kept in fixed size buffers, so no
+ * memory is allocated while handling a request.
+ *
+ * The response timeout is computed per slave from the measured response
+ * times, using the algorithm TCP uses for its retransmission timeout
+ * (RFC 6298): the timeout is the smoothed response time plus 4 times its
+ * mean deviation, kept within the limits set in the `ModbusTimeouts`. After
+ * a timeout, the timeout of the slave is doubled until a response is
+ * received. Slaves which have not responded yet use the initial timeout.
+ *
+ * Requests waiting to be sent are kept in a priority queue. Each request gets
+ * a deadline, which is the time it was queued plus the maximum waiting time
+ * for its priority. The request with the earliest deadline is sent first, so
+ * high priority requests go first, while low priority requests will not
+ * starve. The waiting times per priority are logged once a minute (debug
+ * level).
+ */
+class Modbus : public QObject
+{
+	Q_OBJECT
+public:
+	enum FunctionCode
+	{
+		ReadCoils						= 1,
+		ReadDiscreteInputs				= 2,
+		ReadHoldingRegisters			= 3,
+		ReadInputRegisters				= 4,
+		WriteSingleCoil					= 5,
+		WriteSingleRegister				= 6,
+		WriteMultipleCoils				= 15,
+		WriteMultipleRegisters			= 16,
+		ReadFileRecord					= 20,
+		WriteFileRecord					= 21,
+		MaskWriteRegister				= 22,
+		ReadWriteMultipleRegisters		= 23,
+		ReadFIFOQueue					= 24,
+		EncapsulatedInterfaceTransport	= 43,
+	};
+
+	enum ExceptionCode
+	{
+		NoExeption							= 0,
+		IllegalFunction						= 1,
+		IllegalDataAddress					= 2,
+		IllegalDataValue					= 3,
+		SlaveDeviceFailure					= 4,
+		Acknowledge							= 5,
+		SlaveDeviceBusy						= 6,
+		MemoryParityError					= 7,
+		GatewayPathUnavailable				= 10,
+		GatewayTargetDeviceFailedToRespond	= 11
+	};
+
+	enum ErrorType {
+		CrcError,
+		Timeout,
+		Exception,
+		Unsupported,
+		/// The response does not belong to the request, eg. because its
+		/// function code or slave address is different.
+		ProtocolError
+	};
+
+	enum Priority {
+		/// Time critical requests, eg. the power of a grid meter
+		HighPriority,
+		NormalPriority,
+		/// Requests which may be postponed, like identification and setup
+		LowPriority,
+		PriorityCount
+	};
+
+	/// Maximum number of registers in a single read request.
+	static const int MaxRegisterCount = 125;
+
+	Modbus(const ModbusTimeouts &timeouts, QObject *parent = 0);
+
+	/*!
+	 * Creates a modbus connection for the given port.
+	 * Supported port names:
+	 * - `tcp://host[:port]`: Modbus TCP. The default port is 502.
+	 * - `rtu-tcp://host:port`: Modbus RTU frames sent over a TCP connection,
+	 *   as used by most Ethernet to RS485 gateways.
+	 * - Anything else is taken to be a serial port (eg. /dev/ttyUSB0).
+	 */
+	static Modbus *create(const QString &portName, const ModbusTimeouts &timeouts,
+						  QObject *parent = 0);
+
+	/*!
+	 * Sets the object which will receive the results of all requests sent to
+	 * `slaveAddress`. The listener must outlive this object, or be removed by
+	 * setting a null listener.
+	 */
+	void setListener(quint8 slaveAddress, ModbusListener *listener);
+
+	/*!
+	 * Returns the smoothed response time of the slave in milliseconds, or
+	 * NaN if the slave has not responded yet. For modbus RTU the time needed
+	 * to send the request and the response is not included.
+	 */
+	double responseTime(quint8 slaveAddress) const;
+
+	/*!
+	 * Returns the timeout currently used for requests sent to the slave, in
+	 * milliseconds.
+	 */
+	int responseTimeout(quint8 slaveAddress) const;
+
+	/*!
+	 * Adds a read request to the queue.
+	 * @param timeout The response timeout in ms. If 0, the timeout is derived
+	 * from the response times of the slave (see `responseTimeout`).
+	 */
+	void readRegisters(FunctionCode function, quint8 slaveAddress, quint16 startReg,
+					   quint16 count, Priority priority = NormalPriority, int timeout = 0);
+
+	void writeRegister(FunctionCode function, quint8 slaveAddress, quint16 reg,
+					   quint16 value, Priority priority = NormalPriority);
+
+signals:
+	/*!
+	 * Emitted when the connection with the device(s) has been lost.
+	 */
+	void serialEvent(const QString &description);
+
+private slots:
+	void onReportWaitTimes();
+
+protected:
+	struct Request {
+		FunctionCode function;
+		quint8 slaveAddress;
+		quint16 reg;
+		/// Register count (read) or value (write)
+		quint16 value;
+		Priority priority;
+		/// Time (relative to `mQueueClock`) at which the request was queued, in ms.
+		qint64 queuedAt;
+		/// Time (relative to `mQueueClock`) at which the request should be sent, in ms.
+		qint64 deadline;
+		/// Response timeout in ms, 0 to use `responseTimeout`.
+		int timeout;
+	};
+
+	/*!
+	 * Called when a request has been added to the queue. Implementations
+	 * should take requests from the queue (using `takeRequest`) as soon as
+	 * they are able to send them.
+	 */
+	virtual void onRequestQueued() = 0;
+
+	/*!
+	 * Removes the request with the earliest deadline from the queue.
+	 * @retval false if the queue is empty.
+	 */
+	bool takeRequest(Request &request);
+
+	/// Returns the response timeout of the request in ms.
+	int requestTimeout(const Request &request) const;
+
+	/*!
+	 * Decodes the PDU (function code and data) of a response, and passes the
+	 * result to the listener of `slaveAddress`. A response with another
+	 * function code than `function` is reported as `ProtocolError`.
+	 * @param function The function code of the request.
+	 * @param registerCount The number of registers requested, used to check
+	 * the response of read requests.
+	 */
+	void processPdu(quint8 slaveAddress, int function, const quint8 *pdu, int size,
+					int registerCount);
+
+	/*!
+	 * Reports an error to the listener of `slaveAddress`. If `errorType` is
+	 * `Timeout`, the response timeout of the slave will be increased.
+	 */
+	void reportError(quint8 slaveAddress, ErrorType errorType, int exception);
+
+	/*!
+	 * Updates the response time estimate of a slave.
+	 * @param time The time between the request and the response in ms.
+	 */
+	void addResponseTime(quint8 slaveAddress, double time);
+
+private:
+	struct ResponseTimeEstimate {
+		/// Smoothed response time (ms), NaN if no response was received yet.
+		double average;
+		/// Smoothed mean deviation of the response time (ms).
+		double deviation;
+		/// Number of consecutive timeouts, used to back off the timeout.
+		int timeoutCount;
+	};
+
+	struct WaitTimes {
+		int count;
+		qint64 total;
+		qint64 maximum;
+	};
+
+	void addRequest(FunctionCode function, quint8 slaveAddress, quint16 reg, quint16 value,
+					Priority priority, int timeout);
+
+	ModbusTimeouts mTimeouts;
+	QVector<Request> mRequests;
+	QElapsedTimer mQueueClock;
+	QTimer *mReportTimer;
+	WaitTimes mWaitTimes[PriorityCount];
+	ResponseTimeEstimate mEstimates[256];
+	ModbusListener *mListeners[256];
+	/// Register values of the last read response.
+	quint16 mRegisters[MaxRegisterCount];
+};
+
+#endif // MODBUS_H
@@ -1,294 +1,281 @@
-#include <QSocketNotifier>
+#include <QsLog.h>
 #include <QTimer>
-#include <unistd.h>
+#include <string.h>
 #include "defines.h"
 #include "modbus_rtu.h"
+#include "modbus_transport.h"
 
-ModbusRtu::ModbusRtu(const QString &portName, int baudrate, int timeout, QObject *parent):
-	QObject(parent),
-	mSerialPort(veSerialAllocate(portName.toLatin1().data())),
+ModbusRtu::ModbusRtu(ModbusTransport *transport, const ModbusTimeouts &timeouts,
+					 QObject *parent):
+	Modbus(timeouts, parent),
+	mTransport(transport),
 	mTimer(new QTimer(this)),
-	mCurrentSlave(0)
+	mGapTimer(new QTimer(this)),
+	mBusIdleAt(0),
+	mRequestSentAt(0),
+	mCurrentSlave(0),
+	mCurrentTimeout(0),
+	mRxCount(0)
 {
-	veSerialSetBaud(mSerialPort, static_cast<un32>(baudrate));
-	veSerialSetKind(mSerialPort, 0); // Requires external event pump
-	veSerialOpen(mSerialPort, 0);
+	mTransport->setParent(this);
+	connect(mTransport, SIGNAL(dataReceived(const quint8 *, int)),
+			this, SLOT(onDataReceived(const quint8 *, int)));
+	connect(mTransport, SIGNAL(errorOccurred(QString)),
+			this, SIGNAL(serialEvent(QString)));
 
-	QSocketNotifier *readNotifier =
-		new QSocketNotifier(mSerialPort->fh, QSocketNotifier::Read, this);
-	connect(readNotifier, SIGNAL(activated(int)), this, SLOT(onReadyRead()));
-
-	QSocketNotifier *errorNotifier =
-		new QSocketNotifier(mSerialPort->fh, QSocketNotifier::Exception, this);
-	connect(errorNotifier, SIGNAL(activated(int)), this, SLOT(onError()));
-
-	mData.reserve(16);
+	// Modbus requires a pause between frames of 3.5 times the interval needed
+	// to send a character.
+	mCharTime = mTransport->charTime();
+	mBusClock.start();
 
 	resetStateEngine();
-	mTimer->setInterval(timeout);
+	mTimer->setSingleShot(true);
 	connect(mTimer, SIGNAL(timeout()), this, SLOT(onTimeout()));
+	mGapTimer->setSingleShot(true);
+#if QT_VERSION >= 0x050000
+	// Qt 4 has no timer types: its timers are always precise.
+	mGapTimer->setTimerType(Qt::PreciseTimer);
+#endif
+	connect(mGapTimer, SIGNAL(timeout()), this, SLOT(onGapElapsed()));
 }
 
-ModbusRtu::~ModbusRtu()
+void ModbusRtu::onRequestQueued()
 {
-	veSerialClose(mSerialPort);
-	VeSerialPortFree(mSerialPort);
+	if (mState == Idle)
+		processPending();
 }
 
-void ModbusRtu::readRegisters(FunctionCode function, quint8 slaveAddress, quint16 startReg,
-							  quint16 count)
+void ModbusRtu::onTimeout()
 {
-	if (mState == Idle) {
-		_readRegisters(function, slaveAddress, startReg, count);
-	} else {
-		Cmd cmd;
-		cmd.function = function;
-		cmd.slaveAddress = slaveAddress;
-		cmd.reg = startReg;
-		cmd.value = count;
-		mPendingCommands.append(cmd);
-	}
+	if (mState == Idle)
+		return;
+	reportError(mCurrentSlave, Timeout, 0);
+	resetStateEngine();
+	processPending();
 }
 
-void ModbusRtu::writeRegister(FunctionCode function, quint8 slaveAddress, quint16 reg,
-							  quint16 value)
+void ModbusRtu::onDataReceived(const quint8 *data, int size)
 {
-	if (mState == Idle) {
-		_writeRegister(function, slaveAddress, reg, value);
-	} else {
-		Cmd cmd;
-		cmd.function = function;
-		cmd.slaveAddress = slaveAddress;
-		cmd.reg	= reg;
-		cmd.value = value;
-		mPendingCommands.append(cmd);
-	}
+	markBusActivity(0);
+	handleBytesRead(data, size);
 }
 
-void ModbusRtu::onTimeout()
+void ModbusRtu::onGapElapsed()
 {
-	if (mState == Idle)
+	if (mState != Gap)
 		return;
-	emit errorReceived(Timeout, mCurrentSlave, 0);
-	resetStateEngine();
-	processPending();
+	transmit();
 }
 
-void ModbusRtu::processPacket()
+void ModbusRtu::handleBytesRead(const quint8 *bytes, int count)
 {
-	if (mCrc != mCrcBuilder.getValue()) {
-		emit errorReceived(CrcError, mCurrentSlave, 0);
-		return;
-	}
-	if ((mFunction & 0x80) != 0) {
-		quint8 errorCode = static_cast<quint8>(mData[0]);
-		emit errorReceived(Exception, mCurrentSlave, errorCode);
-		return;
-	}
-	if (mState == Function) {
-		emit errorReceived(Unsupported, mCurrentSlave, mFunction);
-		return;
-	}
-	switch (mFunction) {
-	case ReadHoldingRegisters:
-	case ReadInputRegisters:
-	{
-		QList<quint16> registers;
-		for (int i=0; i<mData.length(); i+=2) {
-			registers.append(toUInt16(mData, i));
-		}
-		emit readCompleted(mFunction, mCurrentSlave, registers);
-		return;
-	}
-	case WriteSingleRegister:
-	{
-		quint16 value = toUInt16(mData, 0);
-		emit writeCompleted(mFunction, mCurrentSlave, mStartAddress, value);
+	if (mState != WaitForResponse) {
+		// We received data when we were not expecting any. Ignore the data.
 		return;
 	}
-	default:
-		break;
+	if (mRxCount + count > MaxFrameSize) {
+		// Too much data for a single frame. This cannot happen with a valid
+		// response, so drop the oldest data.
+		int drop = qMin(mRxCount + count - MaxFrameSize, mRxCount);
+		mRxCount -= drop;
+		memmove(mRxBuffer, mRxBuffer + drop, mRxCount);
+		count = qMin(count, MaxFrameSize - mRxCount);
 	}
+	memcpy(mRxBuffer + mRxCount, bytes, count);
+	mRxCount += count;
+	parseResponse();
 }
 
-void ModbusRtu::onReadyRead()
+void ModbusRtu::parseResponse()
 {
-	quint8 buf[64];
-	bool first = true;
-	for (;;) {
-		ssize_t len = read(mSerialPort->fh, buf, sizeof(buf));
-		if (len < 0) {
-			emit serialEvent("serial read failure");
-			return;
+	const quint8 *data = mRxBuffer;
+	int size = mRxCount;
+	// Position of the first (possible) response which has not been received
+	// completely.
+	int partial = -1;
+	// Look for a complete frame with a valid CRC. If the data at the current
+	// position cannot be the start of the response, or the CRC is wrong, we
+	// move forward one byte and try again. This way we will find the response
+	// even if it is preceded by garbage or the remains of an earlier frame.
+	for (int pos = 0; pos < size; ++pos) {
+		int length = getFrameLength(data + pos, size - pos);
+		if (length < 0)
+			continue;
+		if (length == 0 || pos + length > size) {
+			// This may be the start of the response, but we need more data
+			// before we can tell.
+			if (partial < 0)
+				partial = pos;
+			continue;
 		}
-		if (first && len == 0) {
-			emit serialEvent("Ready for reading but read 0 bytes. Device removed?");
+		quint16 crc = toUInt16(data[pos + length - 2], data[pos + length - 1]);
+		if (crc == Crc16::getValue(data + pos, length - 2)) {
+			// Do not include the time needed to transfer request and response
+			// in the response time.
+			qint64 elapsed = mBusClock.nsecsElapsed() - mRequestSentAt -
+				(TxFrameSize + length) * mCharTime;
+			addResponseTime(mCurrentSlave, qMax(Q_INT64_C(0), elapsed) / 1e6);
+			processPdu(mCurrentSlave, mTxFrame[1], data + pos + 1, length - 3,
+					   toUInt16(mTxFrame[4], mTxFrame[5]));
+			resetStateEngine();
+			processPending();
 			return;
 		}
-		for (ssize_t i = 0; i<len; ++i)
-			handleByteRead(buf[i]);
-		if (len < static_cast<int>(sizeof(buf)))
-			break;
-		first = false;
+		mCrcErrorFound = true;
+	}
+	if (partial >= 0) {
+		mRxCount -= partial;
+		memmove(mRxBuffer, mRxBuffer + partial, mRxCount);
+	} else if (mCrcErrorFound) {
+		// We have seen a corrupted response, and there is nothing left which
+		// may be the start of another one. No need to wait for the timeout.
+		reportError(mCurrentSlave, CrcError, 0);
+		resetStateEngine();
+		processPending();
+	} else {
+		mRxCount = 0;
 	}
 }
 
-void ModbusRtu::onError()
-{
-	emit serialEvent("Serial error");
-}
-
-void ModbusRtu::handleByteRead(quint8 b)
+int ModbusRtu::getFrameLength(const quint8 *frame, int size) const
 {
-	if (mAddToCrc)
-		mCrcBuilder.add(b);
-	switch (mState) {
-	case Idle:
-		// We received data when we were not expecting any. Ignore the data.
-		break;
-	case Address:
-		if (b == mCurrentSlave)
-			mState = Function;
-		break;
-	case Function:
-		mFunction = static_cast<FunctionCode>(b);
-		if ((mFunction & 0x80) != 0) {
-			// Exception
-			mCount = 1;
-			mState = Data;
-		} else {
-			switch (mFunction) {
-			case ReadHoldingRegisters:
-			case ReadInputRegisters:
-				mState = ByteCount;
-				break;
-			case WriteSingleRegister:
-				mState = StartAddressMsb;
-				break;
-			default:
-				mState = Address;
-				break;
-			}
-		}
-		break;
-	case ByteCount:
-		mCount = b;
-		if (mCount == 0) {
-			mState = CrcMsb;
-			mAddToCrc = false;
-		} else {
-			mState = Data;
-		}
-		break;
-	case StartAddressMsb:
-		mStartAddress = static_cast<quint16>(b << 8);
-		mState = StartAddressLsb;
-		break;
-	case StartAddressLsb:
-		mStartAddress |= b;
-		mCount = 2;
-		mState = Data;
-		break;
-	case Data:
-		if (mCount > 0) {
-			mData.append(static_cast<char>(b));
-			--mCount;
-		}
-		if (mCount == 0) {
-			mState = CrcMsb;
-			mAddToCrc = false;
-		}
-		break;
-	case CrcMsb:
-		mCrc = static_cast<quint16>(b << 8);
-		mState = CrcLsb;
-		break;
-	case CrcLsb:
-		mCrc |= b;
-		processPacket();
-		resetStateEngine();
-		processPending();
-		break;
+	Q_ASSERT(size > 0);
+	if (frame[0] != mCurrentSlave)
+		return -1;
+	if (size < 2)
+		return 0;
+	quint8 function = mTxFrame[1];
+	if (frame[1] == (function | 0x80)) {
+		// Exception: address, function, exception code and CRC.
+		return 5;
+	}
+	if (frame[1] != function)
+		return -1;
+	switch (function) {
+	case ReadHoldingRegisters:
+	case ReadInputRegisters:
+	{
+		if (size < 3)
+			return 0;
+		// The byte count must match the number of registers requested.
+		int byteCount = 2 * toUInt16(mTxFrame[4], mTxFrame[5]);
+		if (frame[2] != byteCount)
+			return -1;
+		return 5 + byteCount;
+	}
+	case WriteSingleRegister:
+		// The response is an echo of the request.
+		return TxFrameSize;
+	default:
+		return -1;
 	}
 }
 
 void ModbusRtu::resetStateEngine()
 {
 	mState = Idle;
-	mCrcBuilder.reset();
-	mAddToCrc = true;
 	mCurrentSlave = 0;
-	mData.clear();
+	mCrcErrorFound = false;
+	mRxCount = 0;
 	mTimer->stop();
 }
 
 void ModbusRtu::processPending()
 {
-	if (mPendingCommands.isEmpty())
+	Request request;
+	if (!takeRequest(request))
 		return;
-	const Cmd &cmd = mPendingCommands.first();
-	switch (cmd.function) {
+	mCurrentTimeout = requestTimeout(request);
+	switch (request.function) {
 	case ReadHoldingRegisters:
 	case ReadInputRegisters:
-		_readRegisters(cmd.function, cmd.slaveAddress, cmd.reg, cmd.value);
+		_readRegisters(request.function, request.slaveAddress, request.reg, request.value);
 		break;
 	case WriteSingleRegister:
-		_writeRegister(cmd.function, cmd.slaveAddress, cmd.reg, cmd.value);
+		_writeRegister(request.function, request.slaveAddress, request.reg, request.value);
 		break;
 	default:
 		break;
 	}
-	mPendingCommands.removeFirst();
 }
 
-void ModbusRtu::_readRegisters(ModbusRtu::FunctionCode function, quint8 slaveAddress,
+void ModbusRtu::_readRegisters(FunctionCode function, quint8 slaveAddress,
 							   quint16 startReg, quint16 count)
 {
 	Q_ASSERT(mState == Idle);
-	QByteArray frame;
-	frame.reserve(8);
-	frame.append(static_cast<char>(slaveAddress));
-	frame.append(static_cast<char>(function));
-	frame.append(static_cast<char>(msb(startReg)));
-	frame.append(static_cast<char>(lsb(startReg)));
-	frame.append(static_cast<char>(msb(count)));
-	frame.append(static_cast<char>(lsb(count)));
-	send(frame);
+	mTxFrame[0] = slaveAddress;
+	mTxFrame[1] = static_cast<quint8>(function);
+	mTxFrame[2] = msb(startReg);
+	mTxFrame[3] = lsb(startReg);
+	mTxFrame[4] = msb(count);
+	mTxFrame[5] = lsb(count);
+	send();
 }
 
-void ModbusRtu::_writeRegister(ModbusRtu::FunctionCode function, quint8 slaveAddress, quint16 reg,
+void ModbusRtu::_writeRegister(FunctionCode function, quint8 slaveAddress, quint16 reg,
 							   quint16 value)
 {
 	Q_ASSERT(mState == Idle);
-	QByteArray frame;
-	frame.reserve(8);
-	frame.append(static_cast<char>(slaveAddress));
-	frame.append(static_cast<char>(function));
-	frame.append(static_cast<char>(msb(reg)));
-	frame.append(static_cast<char>(lsb(reg)));
-	frame.append(static_cast<char>(msb(value)));
-	frame.append(static_cast<char>(lsb(value)));
-	send(frame);
+	mTxFrame[0] = slaveAddress;
+	mTxFrame[1] = static_cast<quint8>(function);
+	mTxFrame[2] = msb(reg);
+	mTxFrame[3] = lsb(reg);
+	mTxFrame[4] = msb(value);
+	mTxFrame[5] = lsb(value);
+	send();
 }
 
-void ModbusRtu::send(QByteArray &data)
+void ModbusRtu::send()
 {
 	Q_ASSERT(mState == Idle);
-	quint16 crc = Crc16::getValue(data);
-	data.append(static_cast<char>(msb(crc)));
-	data.append(static_cast<char>(lsb(crc)));
-	// Modbus requires a pause between sending of 3.5 times the interval needed
-	// to send a character. We use 4 characters here, just in case...
-	// We also assume 10 bits per caracter (8 data bits, 1 stop bit and 1 parity
-	// bit). Keep in mind that overestimating the character time does not hurt
-	// (a lot), but underestimating does.
-	// Then number of bits devided by the the baudrate (unit: bits/second) gives
-	// us the time in seconds. usleep wants time in microseconds, so we have to
-	// multiply by 1 million.
-	usleep((4 * 10 * 1000 * 1000) / mSerialPort->baudrate);
-	veSerialPutBuf(mSerialPort, reinterpret_cast<un8 *>(data.data()),
-				   static_cast<un32>(data.size()));
-	mTimer->start();
-	mState = Address;
-	mCurrentSlave = static_cast<quint8>(data[0]);
+	quint16 crc = Crc16::getValue(mTxFrame, TxFrameSize - 2);
+	mTxFrame[TxFrameSize - 2] = msb(crc);
+	mTxFrame[TxFrameSize - 1] = lsb(crc);
+	mCurrentSlave = mTxFrame[0];
+	mState = Gap;
+	transmit();
+}
+
+void ModbusRtu::transmit()
+{
+	Q_ASSERT(mState == Gap);
+	// Do not block the event loop while waiting for the inter-frame silence.
+	// Most of the time the interval has already passed while the previous
+	// response was being processed, so we can send at once.
+	qint64 wait = mBusIdleAt - mBusClock.nsecsElapsed();
+	if (wait > 0) {
+		// QTimer has a resolution of 1ms, so round up.
+		mGapTimer->start(static_cast<int>((wait + 999999) / 1000000));
+		return;
+	}
+	mTransport->write(mTxFrame, TxFrameSize);
+	markBusActivity(TxFrameSize);
+	mRequestSentAt = mBusClock.nsecsElapsed();
+	// The timeout starts when the request is sent, so we have to add the time
+	// needed to transfer request and response. Round up to whole ms.
+	qint64 transferTime = (TxFrameSize + getResponseSize()) * mCharTime;
+	mTimer->start(mCurrentTimeout +
+				  static_cast<int>((transferTime + 999999) / 1000000));
+	mState = WaitForResponse;
+}
+
+void ModbusRtu::markBusActivity(int pendingChars)
+{
+	// The last character of the frame will be on the wire after
+	// `pendingChars` character times. We use 4 characters for the silent
+	// interval here (instead of 3.5), just in case...
+	mBusIdleAt = mBusClock.nsecsElapsed() + (pendingChars + 4) * mCharTime;
+}
+
+int ModbusRtu::getResponseSize() const
+{
+	switch (mTxFrame[1]) {
+	case ReadHoldingRegisters:
+	case ReadInputRegisters:
+		// Address, function, byte count, data and CRC.
+		return 5 + 2 * toUInt16(mTxFrame[4], mTxFrame[5]);
+	default:
+		// Write requests are echoed by the device.
+		return TxFrameSize;
+	}
 }
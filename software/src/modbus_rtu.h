@@ -1,103 +1,55 @@
 #ifndef MODBUS_RTU_H
 #define MODBUS_RTU_H
 
-#include <QByteArray>
-#include <QList>
-#include <QMetaType>
-#include <QMutex>
-#include <QObject>
-extern "C" {
-	#include <velib/platform/serial.h>
-}
+#include <QElapsedTimer>
 #include "crc16.h"
+#include "modbus.h"
 
+class ModbusTransport;
 class QTimer;
 
-Q_DECLARE_METATYPE(QList<quint16>)
-
 /*!
  * Partial implementation of the Modbus RTU protocol.
  *
- * Supported functions: `ReadHoldingRegisters`, `ReadInputRegisters`,
- * and `WriteSingleRegister`.
- *
- * Communication is implemented asynchronously. It is allowed to add multiple
- * request at once. They will be queued and sent to the device whenever it is
- * ready (ie. all previous requests have been handled).
+ * The frames are sent over a `ModbusTransport`, which is normally a serial
+ * port, but may also be a TCP connection to an Ethernet to RS485 gateway.
+ * Only one request is sent at a time. The next request will be sent once the
+ * response to the previous one has been received (or a timeout occurred).
  */
-class ModbusRtu : public QObject
+class ModbusRtu : public Modbus
 {
 	Q_OBJECT
 public:
-	enum FunctionCode
-	{
-		ReadCoils						= 1,
-		ReadDiscreteInputs				= 2,
-		ReadHoldingRegisters			= 3,
-		ReadInputRegisters				= 4,
-		WriteSingleCoil					= 5,
-		WriteSingleRegister				= 6,
-		WriteMultipleCoils				= 15,
-		WriteMultipleRegisters			= 16,
-		ReadFileRecord					= 20,
-		WriteFileRecord					= 21,
-		MaskWriteRegister				= 22,
-		ReadWriteMultipleRegisters		= 23,
-		ReadFIFOQueue					= 24,
-		EncapsulatedInterfaceTransport	= 43,
-	};
-
-	enum ExceptionCode
-	{
-		NoExeption							= 0,
-		IllegalFunction						= 1,
-		IllegalDataAddress					= 2,
-		IllegalDataValue					= 3,
-		SlaveDeviceFailure					= 4,
-		Acknowledge							= 5,
-		SlaveDeviceBusy						= 6,
-		MemoryParityError					= 7,
-		GatewayPathUnavailable				= 10,
-		GatewayTargetDeviceFailedToRespond	= 11
-	};
-
-	enum ErrorType {
-		CrcError,
-		Timeout,
-		Exception,
-		Unsupported
-	};
-
-	ModbusRtu(const QString &portName, int baudrate, int timeout, QObject *parent = 0);
-
-	~ModbusRtu();
-
-	void readRegisters(FunctionCode function, quint8 slaveAddress,
-					   quint16 startReg, quint16 count);
-
-	void writeRegister(FunctionCode function, quint8 slaveAddress,
-					   quint16 reg, quint16 value);
+	/*!
+	 * Creates a modbus RTU connection.
+	 * @param transport The connection to use. This object takes ownership of
+	 * the transport.
+	 */
+	ModbusRtu(ModbusTransport *transport, const ModbusTimeouts &timeouts, QObject *parent = 0);
 
-signals:
-	void readCompleted(int function, quint8 slaveAddress, const QList<quint16> &values);
-
-	void writeCompleted(int function, quint8 slaveAddress, quint16 address, quint16 value);
-
-	void errorReceived(int errorType, quint8 slaveAddress, int exception);
-
-	void serialEvent(const char *description);
+protected:
+	virtual void onRequestQueued();
 
 private slots:
 	void onTimeout();
 
-	void processPacket();
+	void onDataReceived(const quint8 *data, int size);
 
-	void onReadyRead();
-
-	void onError();
+	void onGapElapsed();
 
 private:
-	void handleByteRead(quint8 b);
+	void handleBytesRead(const quint8 *bytes, int count);
+
+	void parseResponse();
+
+	/*!
+	 * Checks whether `frame` may be the start of the response to the current
+	 * request, using the slave address, function code and byte count.
+	 * @param size The number of bytes available in `frame`.
+	 * @return The length of the response frame including CRC, 0 if more data
+	 * is needed to decide, or -1 if `frame` is not the start of a response.
+	 */
+	int getFrameLength(const quint8 *frame, int size) const;
 
 	void resetStateEngine();
 
@@ -109,40 +61,54 @@ private:
 	void _writeRegister(FunctionCode function, quint8 slaveAddress,
 						quint16 reg, quint16 value);
 
-	void send(QByteArray &data);
+	void send();
+
+	void transmit();
+
+	void markBusActivity(int pendingChars);
+
+	/*!
+	 * Returns the size of the response to the current request, assuming it is
+	 * not an exception.
+	 */
+	int getResponseSize() const;
 
 	enum ReadState {
 		Idle,
-		Address,
-		Function,
-		ByteCount,
-		StartAddressMsb,
-		StartAddressLsb,
-		Data,
-		CrcMsb,
-		CrcLsb
+		Gap,
+		WaitForResponse
 	};
 
-	VeSerialPort *mSerialPort;
+	ModbusTransport *mTransport;
 	QTimer *mTimer;
-	struct Cmd {
-		ModbusRtu::FunctionCode function;
-		quint8 slaveAddress;
-		quint16 reg;
-		quint16 value;
-	};
-	QList<Cmd> mPendingCommands;
+	/// Used to postpone the next frame until the bus has been silent long enough.
+	QTimer *mGapTimer;
+	QElapsedTimer mBusClock;
+	/// Time (relative to `mBusClock`) at which the bus will have been silent
+	/// for the inter-frame interval, in nanoseconds.
+	qint64 mBusIdleAt;
+	/// Time needed to send a single character, in nanoseconds.
+	qint64 mCharTime;
+	/// Time (relative to `mBusClock`) at which the current request was sent,
+	/// in nanoseconds.
+	qint64 mRequestSentAt;
+	/// All supported requests have the same size: address, function, 2
+	/// 16-bit values and CRC.
+	static const int TxFrameSize = 8;
+	/// Maximum size of a Modbus RTU frame.
+	static const int MaxFrameSize = 256;
+	quint8 mTxFrame[TxFrameSize];
 	quint8 mCurrentSlave;
+	/// Response timeout of the current request in ms.
+	int mCurrentTimeout;
 
-	// State engine
 	ReadState mState;
-	FunctionCode mFunction;
-	quint8 mCount;
-	quint16 mStartAddress;
-	quint16 mCrc;
-	Crc16 mCrcBuilder;
-	bool mAddToCrc;
-	QByteArray mData;
+	/// Data received since the current request was sent.
+	quint8 mRxBuffer[MaxFrameSize];
+	int mRxCount;
+	/// Set when a frame with an invalid CRC was received in response to the
+	/// current request.
+	bool mCrcErrorFound;
 };
 
 #endif // MODBUS_RTU_H
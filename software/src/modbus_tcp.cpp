@@ -0,0 +1,145 @@
+#include <QsLog.h>
+#include <QTimer>
+#include <string.h>
+#include "defines.h"
+#include "modbus_tcp.h"
+#include "modbus_transport.h"
+
+ModbusTcp::ModbusTcp(ModbusTransport *transport, const ModbusTimeouts &timeouts,
+					 QObject *parent):
+	Modbus(timeouts, parent),
+	mTransport(transport),
+	mTimer(new QTimer(this)),
+	mNextTransactionId(0),
+	mActiveCount(0),
+	mRxCount(0)
+{
+	mTransport->setParent(this);
+	connect(mTransport, SIGNAL(dataReceived(const quint8 *, int)),
+			this, SLOT(onDataReceived(const quint8 *, int)));
+	connect(mTransport, SIGNAL(errorOccurred(QString)),
+			this, SIGNAL(serialEvent(QString)));
+	mClock.start();
+	mTimer->setSingleShot(true);
+	connect(mTimer, SIGNAL(timeout()), this, SLOT(onTimeout()));
+}
+
+void ModbusTcp::onRequestQueued()
+{
+	sendPending();
+	updateTimer();
+}
+
+void ModbusTcp::onTimeout()
+{
+	qint64 now = mClock.elapsed();
+	for (int i=0; i<mActiveCount;) {
+		if (mActive[i].deadline > now) {
+			++i;
+			continue;
+		}
+		// Remove the transaction before reporting the error, because the
+		// listener may send a new request.
+		quint8 slaveAddress = mActive[i].slaveAddress;
+		mActive[i] = mActive[--mActiveCount];
+		reportError(slaveAddress, Timeout, 0);
+		i = 0;
+	}
+	sendPending();
+	updateTimer();
+}
+
+void ModbusTcp::onDataReceived(const quint8 *data, int size)
+{
+	while (size > 0) {
+		int count = qMin(size, MaxFrameSize - mRxCount);
+		memcpy(mRxBuffer + mRxCount, data, count);
+		mRxCount += count;
+		data += count;
+		size -= count;
+		int pos = 0;
+		while (mRxCount - pos >= HeaderSize) {
+			const quint8 *frame = mRxBuffer + pos;
+			quint16 protocolId = toUInt16(frame[2], frame[3]);
+			int length = toUInt16(frame[4], frame[5]);
+			if (protocolId != 0 || length < 2 || length > MaxFrameSize - 6) {
+				// TCP does not lose data, so there is no way to recover from
+				// this, other than setting up a new connection.
+				mRxCount = 0;
+				emit serialEvent("Invalid Modbus TCP header received");
+				return;
+			}
+			int frameSize = 6 + length;
+			if (mRxCount - pos < frameSize)
+				break;
+			processFrame(frame, frameSize);
+			pos += frameSize;
+		}
+		mRxCount -= pos;
+		memmove(mRxBuffer, mRxBuffer + pos, mRxCount);
+	}
+	sendPending();
+	updateTimer();
+}
+
+void ModbusTcp::sendPending()
+{
+	Request request;
+	while (mActiveCount < MaxActiveTransactions && takeRequest(request)) {
+		Transaction &t = mActive[mActiveCount++];
+		t.slaveAddress = request.slaveAddress;
+		t.function = request.function;
+		t.reg = request.reg;
+		t.value = request.value;
+		t.id = mNextTransactionId++;
+		t.sentAt = mClock.elapsed();
+		t.deadline = t.sentAt + requestTimeout(request);
+		quint8 frame[HeaderSize + 5];
+		frame[0] = msb(t.id);
+		frame[1] = lsb(t.id);
+		frame[2] = 0; // Protocol identifier
+		frame[3] = 0;
+		frame[4] = 0; // Length of the remainder of the frame
+		frame[5] = 6;
+		frame[6] = t.slaveAddress;
+		frame[7] = static_cast<quint8>(t.function);
+		frame[8] = msb(t.reg);
+		frame[9] = lsb(t.reg);
+		frame[10] = msb(t.value);
+		frame[11] = lsb(t.value);
+		mTransport->write(frame, sizeof(frame));
+	}
+}
+
+void ModbusTcp::processFrame(const quint8 *frame, int size)
+{
+	quint16 id = toUInt16(frame[0], frame[1]);
+	for (int i=0; i<mActiveCount; ++i) {
+		if (mActive[i].id == id) {
+			Transaction t = mActive[i];
+			mActive[i] = mActive[--mActiveCount];
+			if (frame[6] != t.slaveAddress) {
+				reportError(t.slaveAddress, ProtocolError, frame[6]);
+				return;
+			}
+			addResponseTime(t.slaveAddress, mClock.elapsed() - t.sentAt);
+			processPdu(t.slaveAddress, t.function, frame + HeaderSize, size - HeaderSize,
+					   t.value);
+			return;
+		}
+	}
+	// Probably the response to a request which has timed out already.
+	QLOG_DEBUG() << "Modbus TCP response with unknown transaction ID" << id;
+}
+
+void ModbusTcp::updateTimer()
+{
+	if (mActiveCount == 0) {
+		mTimer->stop();
+		return;
+	}
+	qint64 deadline = mActive[0].deadline;
+	for (int i=1; i<mActiveCount; ++i)
+		deadline = qMin(deadline, mActive[i].deadline);
+	mTimer->start(static_cast<int>(qMax(Q_INT64_C(0), deadline - mClock.elapsed())));
+}
@@ -0,0 +1,74 @@
+#ifndef MODBUS_TCP_H
+#define MODBUS_TCP_H
+
+#include <QElapsedTimer>
+#include "modbus.h"
+
+class ModbusTransport;
+class QTimer;
+
+/*!
+ * Partial implementation of the Modbus TCP protocol.
+ *
+ * Unlike Modbus RTU, multiple requests may be outstanding at the same time.
+ * Responses are matched with their request using the transaction identifier
+ * in the MBAP header. This way the latency of a gateway (or the device) does
+ * not add up when polling multiple slaves.
+ */
+class ModbusTcp : public Modbus
+{
+	Q_OBJECT
+public:
+	/*!
+	 * Creates a modbus TCP connection.
+	 * @param transport The connection to use. This object takes ownership of
+	 * the transport.
+	 */
+	ModbusTcp(ModbusTransport *transport, const ModbusTimeouts &timeouts, QObject *parent = 0);
+
+protected:
+	virtual void onRequestQueued();
+
+private slots:
+	void onTimeout();
+
+	void onDataReceived(const quint8 *data, int size);
+
+private:
+	struct Transaction {
+		quint16 id;
+		quint8 slaveAddress;
+		FunctionCode function;
+		quint16 reg;
+		/// Register count (read) or value (write)
+		quint16 value;
+		/// Time (relative to `mClock`) at which the request was sent, in ms.
+		qint64 sentAt;
+		/// Time (relative to `mClock`) at which the request times out, in ms.
+		qint64 deadline;
+	};
+
+	void sendPending();
+
+	void processFrame(const quint8 *frame, int size);
+
+	void updateTimer();
+
+	/// Maximum number of requests waiting for a response.
+	static const int MaxActiveTransactions = 4;
+	/// Size of the MBAP header, including the unit identifier.
+	static const int HeaderSize = 7;
+	/// Maximum size of a Modbus TCP frame.
+	static const int MaxFrameSize = 260;
+
+	ModbusTransport *mTransport;
+	QTimer *mTimer;
+	QElapsedTimer mClock;
+	quint16 mNextTransactionId;
+	Transaction mActive[MaxActiveTransactions];
+	int mActiveCount;
+	quint8 mRxBuffer[MaxFrameSize];
+	int mRxCount;
+};
+
+#endif // MODBUS_TCP_H
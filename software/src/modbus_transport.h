@@ -0,0 +1,41 @@
+#ifndef MODBUS_TRANSPORT_H
+#define MODBUS_TRANSPORT_H
+
+#include <QObject>
+
+/*!
+ * Byte stream used by the `Modbus` implementations to talk to the device(s).
+ */
+class ModbusTransport : public QObject
+{
+	Q_OBJECT
+public:
+	ModbusTransport(QObject *parent = 0):
+		QObject(parent)
+	{
+	}
+
+	virtual void write(const quint8 *data, int size) = 0;
+
+	/*!
+	 * Returns the time needed to send a single character, in nanoseconds.
+	 * This is used to compute the silent interval required between Modbus RTU
+	 * frames. Returns 0 if the transport does not need a silent interval.
+	 */
+	virtual qint64 charTime() const = 0;
+
+signals:
+	/*!
+	 * Emitted when data has been received. `data` is only valid while the
+	 * signal is being handled, so this signal should not be connected using a
+	 * queued connection.
+	 */
+	void dataReceived(const quint8 *data, int size);
+
+	/*!
+	 * Emitted when the connection has been lost or could not be established.
+	 */
+	void errorOccurred(const QString &description);
+};
+
+#endif // MODBUS_TRANSPORT_H
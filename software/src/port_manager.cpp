@@ -0,0 +1,196 @@
+#include <QFile>
+#include <QFileSystemWatcher>
+#include <QsLog.h>
+#include <QTextStream>
+#include <QTimer>
+#include "ac_sensor_mediator.h"
+#include "defines.h"
+#include "port_manager.h"
+
+/// Delay before the first retry of a failed port, doubled after each failure.
+static const int MinRetryInterval = 1000;  // 1 second in ms
+static const int ZigbeeMinRetryInterval = 4 * 1000;  // 4 seconds in ms
+static const int MaxRetryInterval = 60 * 1000;  // 1 minute in ms
+static const int ZigbeeMaxRetryInterval = 2 * 60 * 1000;  // 2 minutes in ms
+
+PortManager::PortManager(const ModbusTimeouts &timeouts, bool isZigbee, VeQItem *settingsRoot, QObject *parent):
+	QObject(parent),
+	mTimeouts(timeouts),
+	mIsZigbee(isZigbee),
+	mSettingsRoot(settingsRoot),
+	mWatcher(new QFileSystemWatcher(this)),
+	mRetryTimer(new QTimer(this))
+{
+	connect(mWatcher, SIGNAL(fileChanged(QString)), this, SLOT(onPortsFileChanged()));
+	mRetryTimer->setSingleShot(true);
+	connect(mRetryTimer, SIGNAL(timeout()), this, SLOT(onRetryTimer()));
+}
+
+void PortManager::setPorts(const QStringList &ports)
+{
+	mFixedPorts = ports;
+	updatePorts();
+}
+
+void PortManager::setPortsFile(const QString &path)
+{
+	if (!mPortsFile.isEmpty())
+		mWatcher->removePath(mPortsFile);
+	mPortsFile = path;
+	mFilePorts.clear();
+	if (!mPortsFile.isEmpty())
+		mWatcher->addPath(mPortsFile);
+	if (mPortsFile.isEmpty())
+		updatePorts();
+	else
+		onPortsFileChanged();
+}
+
+void PortManager::updatePorts()
+{
+	QStringList ports = mFixedPorts + mFilePorts;
+	foreach (const QString &portName, mPorts) {
+		if (!ports.contains(portName))
+			removePort(portName);
+	}
+	foreach (const QString &portName, ports)
+		addPort(portName);
+}
+
+void PortManager::addPort(const QString &portName)
+{
+	if (mPorts.contains(portName))
+		return;
+	mPorts.append(portName);
+	startPort(portName);
+}
+
+void PortManager::removePort(const QString &portName)
+{
+	if (!mPorts.removeOne(portName))
+		return;
+	QLOG_INFO() << "Removing port" << portName;
+	mRetries.remove(portName);
+	AcSensorMediator *m = mMediators.value(portName);
+	if (m != 0)
+		stopPort(m);
+}
+
+void PortManager::onPortsFileChanged()
+{
+	if (mPortsFile.isEmpty())
+		return;
+	// Editors often replace the file instead of modifying it, which removes
+	// it from the watcher.
+	if (!mWatcher->files().contains(mPortsFile))
+		mWatcher->addPath(mPortsFile);
+	QFile file(mPortsFile);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		QLOG_ERROR() << "Could not open ports file" << mPortsFile;
+		return;
+	}
+	QStringList ports;
+	QTextStream in(&file);
+	while (!in.atEnd()) {
+		QString line = in.readLine().trimmed();
+		if (line.isEmpty() || line.startsWith('#'))
+			continue;
+		ports.append(line);
+	}
+	mFilePorts = ports;
+	updatePorts();
+}
+
+void PortManager::onConnectionLost()
+{
+	AcSensorMediator *m = static_cast<AcSensorMediator *>(sender());
+	QLOG_WARN() << "No energy meters found on" << m->portName();
+	retryPort(m);
+}
+
+void PortManager::onSerialEvent(const QString &description)
+{
+	AcSensorMediator *m = static_cast<AcSensorMediator *>(sender());
+	QLOG_ERROR() << "Serial port" << m->portName() << ':' << description;
+	retryPort(m);
+}
+
+void PortManager::onDeviceConnected()
+{
+	AcSensorMediator *m = static_cast<AcSensorMediator *>(sender());
+	QMap<QString, RetryState>::iterator it = mRetries.find(m->portName());
+	if (it == mRetries.end())
+		return;
+	QLOG_INFO() << "Port" << m->portName() << "recovered after"
+				<< monotonicTime() - it->lostAt << "ms and" << it->failures << "retries";
+	mRetries.erase(it);
+}
+
+void PortManager::onRetryTimer()
+{
+	qint64 now = monotonicTime();
+	foreach (const QString &portName, mPorts) {
+		QMap<QString, RetryState>::const_iterator it = mRetries.find(portName);
+		if (!mMediators.contains(portName) && (it == mRetries.end() || it->retryAt <= now))
+			startPort(portName);
+	}
+	startRetryTimer();
+}
+
+void PortManager::retryPort(AcSensorMediator *mediator)
+{
+	QString portName = mediator->portName();
+	stopPort(mediator);
+	qint64 now = monotonicTime();
+	QMap<QString, RetryState>::iterator it = mRetries.find(portName);
+	if (it == mRetries.end()) {
+		RetryState state;
+		state.failures = 0;
+		state.lostAt = now;
+		it = mRetries.insert(portName, state);
+	}
+	int interval = qMin(
+		(mIsZigbee ? ZigbeeMinRetryInterval : MinRetryInterval) << qMin(it->failures, 16),
+		mIsZigbee ? ZigbeeMaxRetryInterval : MaxRetryInterval);
+	++it->failures;
+	it->retryAt = now + interval;
+	QLOG_INFO() << "Retrying port" << portName << "in" << interval << "ms";
+	startRetryTimer();
+}
+
+void PortManager::startRetryTimer()
+{
+	qint64 retryAt = -1;
+	for (QMap<QString, RetryState>::const_iterator it = mRetries.begin();
+		 it != mRetries.end(); ++it) {
+		if (!mMediators.contains(it.key()) && (retryAt < 0 || it->retryAt < retryAt))
+			retryAt = it->retryAt;
+	}
+	if (retryAt < 0) {
+		mRetryTimer->stop();
+		return;
+	}
+	mRetryTimer->start(static_cast<int>(qMax(Q_INT64_C(0), retryAt - monotonicTime())));
+}
+
+void PortManager::startPort(const QString &portName)
+{
+	Q_ASSERT(!mMediators.contains(portName));
+	QLOG_INFO() << "Connecting to" << portName;
+	AcSensorMediator *m = new AcSensorMediator(portName, mTimeouts, mIsZigbee, mSettingsRoot,
+											   this);
+	connect(m, SIGNAL(connectionLost()), this, SLOT(onConnectionLost()));
+	connect(m, SIGNAL(serialEvent(QString)), this, SLOT(onSerialEvent(QString)));
+	connect(m, SIGNAL(deviceConnected()), this, SLOT(onDeviceConnected()));
+	mMediators.insert(portName, m);
+}
+
+void PortManager::stopPort(AcSensorMediator *mediator)
+{
+	mMediators.remove(mediator->portName());
+	// This function may be called from a signal emitted by the mediator, so
+	// we cannot delete it right away. Disconnect first, so we will not
+	// receive any signals from it anymore.
+	mediator->disconnect(this);
+	mediator->deleteLater();
+}
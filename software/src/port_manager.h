@@ -0,0 +1,102 @@
+#ifndef PORT_MANAGER_H
+#define PORT_MANAGER_H
+
+#include <QMap>
+#include <QObject>
+#include <QStringList>
+#include "modbus.h"
+
+class AcSensorMediator;
+class QFileSystemWatcher;
+class QTimer;
+class VeQItem;
+
+/*!
+ * Manages a set of communication ports within a single process.
+ *
+ * Each port gets its own `AcSensorMediator` (and thus its own `Modbus` connection),
+ * while the D-Bus connections and the `VeQItem` trees are shared. Ports can
+ * be added and removed at runtime without affecting the other ports.
+ *
+ * If a ports file is set, the ports listed in that file (one port per line,
+ * empty lines and lines starting with '#' are ignored) are served as well,
+ * and the file is monitored for changes.
+ *
+ * When all devices on a port are lost, or the port itself fails, the mediator
+ * of the port is removed and created again after a while, as long as the port
+ * is still in the list of ports. The delay starts short, so a brief glitch
+ * is recovered quickly, and doubles with each consecutive failure. The time
+ * between the failure and the first energy meter being published again is
+ * logged.
+ */
+class PortManager : public QObject
+{
+	Q_OBJECT
+public:
+	PortManager(const ModbusTimeouts &timeouts, bool isZigbee, VeQItem *settingsRoot, QObject *parent = 0);
+
+	QStringList ports() const
+	{
+		return mPorts;
+	}
+
+	/*!
+	 * Sets the list of ports that should be served, in addition to the ports
+	 * from the ports file. Mediators will be created for new ports and
+	 * removed for ports no longer in the list.
+	 */
+	void setPorts(const QStringList &ports);
+
+	void setPortsFile(const QString &path);
+
+private slots:
+	void onPortsFileChanged();
+
+	void onConnectionLost();
+
+	void onSerialEvent(const QString &description);
+
+	void onDeviceConnected();
+
+	void onRetryTimer();
+
+private:
+	void updatePorts();
+
+	void addPort(const QString &portName);
+
+	void removePort(const QString &portName);
+
+	void startPort(const QString &portName);
+
+	void stopPort(AcSensorMediator *mediator);
+
+	/// Stops the port, and schedules a retry.
+	void retryPort(AcSensorMediator *mediator);
+
+	void startRetryTimer();
+
+	struct RetryState {
+		/// Number of consecutive failures.
+		int failures;
+		/// Time (see `monotonicTime`) at which the port should be started again.
+		qint64 retryAt;
+		/// Time (see `monotonicTime`) of the first of the consecutive failures.
+		qint64 lostAt;
+	};
+
+	ModbusTimeouts mTimeouts;
+	bool mIsZigbee;
+	VeQItem *mSettingsRoot;
+	QStringList mPorts;
+	QStringList mFixedPorts;
+	QStringList mFilePorts;
+	QMap<QString, AcSensorMediator *> mMediators;
+	/// Ports which have failed since they last had an energy meter connected.
+	QMap<QString, RetryState> mRetries;
+	QString mPortsFile;
+	QFileSystemWatcher *mWatcher;
+	QTimer *mRetryTimer;
+};
+
+#endif // PORT_MANAGER_H
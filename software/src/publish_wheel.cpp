@@ -0,0 +1,118 @@
+#include <QCoreApplication>
+#include <QPointer>
+#include <QTimer>
+#include "dbus_bridge.h"
+#include "publish_wheel.h"
+
+PublishWheel::PublishWheel(QObject *parent):
+	QObject(parent),
+	mCurrentSlot(0),
+	mCount(0),
+	mTimer(new QTimer(this))
+{
+	mTimer->setInterval(TickInterval);
+	connect(mTimer, SIGNAL(timeout()), this, SLOT(onTick()));
+}
+
+PublishWheel *PublishWheel::instance()
+{
+	// Deleted with the application. Bridges deleted after that will get a
+	// new (empty) wheel.
+	static QPointer<PublishWheel> wheel;
+	if (wheel.isNull())
+		wheel = new PublishWheel(QCoreApplication::instance());
+	return wheel;
+}
+
+void PublishWheel::add(DBusBridge *bridge, int item, int period)
+{
+	Entry entry;
+	entry.bridge = bridge;
+	entry.item = item;
+	entry.ticks = qMax(1, (period + TickInterval - 1) / TickInterval);
+	insert(entry);
+	if (mCount++ == 0)
+		mTimer->start();
+}
+
+void PublishWheel::remove(DBusBridge *bridge, int item)
+{
+	// Items which are running right now (see onTick) have been inserted
+	// again already, so they are only marked here.
+	for (int i=0; i<mDue.size(); ++i) {
+		if (mDue[i].bridge == bridge && mDue[i].item == item)
+			mDue[i].bridge = 0;
+	}
+	for (int s=0; s<SlotCount; ++s) {
+		QVector<Entry> &entries = mSlots[s];
+		for (int i=0; i<entries.size(); ++i) {
+			if (entries[i].bridge == bridge && entries[i].item == item) {
+				entries.remove(i);
+				if (--mCount == 0)
+					mTimer->stop();
+				return;
+			}
+		}
+	}
+}
+
+void PublishWheel::remove(DBusBridge *bridge)
+{
+	for (int i=0; i<mDue.size(); ++i) {
+		if (mDue[i].bridge == bridge)
+			mDue[i].bridge = 0;
+	}
+	mDueBridges.removeAll(bridge);
+	for (int s=0; s<SlotCount; ++s) {
+		QVector<Entry> &entries = mSlots[s];
+		for (int i=entries.size() - 1; i>=0; --i) {
+			if (entries[i].bridge == bridge) {
+				entries.remove(i);
+				--mCount;
+			}
+		}
+	}
+	if (mCount == 0)
+		mTimer->stop();
+}
+
+void PublishWheel::onTick()
+{
+	mCurrentSlot = (mCurrentSlot + 1) % SlotCount;
+	// Move the due items out of the slot first, because they are inserted
+	// again before they are run, possibly in the same slot.
+	QVector<Entry> &entries = mSlots[mCurrentSlot];
+	int kept = 0;
+	for (int i=0; i<entries.size(); ++i) {
+		Entry &entry = entries[i];
+		if (entry.rounds > 0) {
+			--entry.rounds;
+			entries[kept++] = entry;
+		} else {
+			mDue.append(entry);
+		}
+	}
+	entries.resize(kept);
+	for (int i=0; i<mDue.size(); ++i)
+		insert(mDue[i]);
+	// The bridges may remove items (or themselves) while publishing.
+	for (int i=0; i<mDue.size(); ++i) {
+		Entry entry = mDue[i];
+		if (entry.bridge == 0)
+			continue;
+		if (!mDueBridges.contains(entry.bridge))
+			mDueBridges.append(entry.bridge);
+		entry.bridge->publishDue(entry.item);
+	}
+	mDue.resize(0);
+	// All changes of a bridge in this tick are sent as a single signal.
+	for (int i=0; i<mDueBridges.size(); ++i)
+		mDueBridges[i]->sendItemsChanged();
+	mDueBridges.resize(0);
+}
+
+void PublishWheel::insert(Entry &entry)
+{
+	entry.rounds = (entry.ticks - 1) / SlotCount;
+	mSlots[(mCurrentSlot + entry.ticks) % SlotCount].append(entry);
+}
@@ -0,0 +1,74 @@
+#ifndef PUBLISH_WHEEL_H
+#define PUBLISH_WHEEL_H
+
+#include <QObject>
+#include <QVector>
+
+class DBusBridge;
+class QTimer;
+
+/*!
+ * Timer wheel which tells the `DBusBridge` objects when to publish the
+ * changes of their items.
+ *
+ * All bridges share a single timer, which ticks every `TickInterval` ms while
+ * any item is scheduled. Each item is kept in the slot of the wheel in which
+ * it is due next, together with the number of turns the wheel has to make
+ * before that. Publish periods are rounded up to a whole number of ticks.
+ * Adding an item, and running a due item, costs constant time, independent
+ * of the number of bridges and items. A tick only visits the items of a
+ * single slot.
+ *
+ * Bridges are created in the main thread, so this object must only be used
+ * from the main thread.
+ */
+class PublishWheel : public QObject
+{
+	Q_OBJECT
+public:
+	/// Resolution of the publish periods in ms.
+	static const int TickInterval = 250;
+
+	static PublishWheel *instance();
+
+	/*!
+	 * Schedules `DBusBridge::publishDue(item)` to be called every `period` ms
+	 * (at least one tick).
+	 */
+	void add(DBusBridge *bridge, int item, int period);
+
+	/// Removes a single item scheduled with `add`.
+	void remove(DBusBridge *bridge, int item);
+
+	/// Removes all items of `bridge`.
+	void remove(DBusBridge *bridge);
+
+private slots:
+	void onTick();
+
+private:
+	struct Entry {
+		DBusBridge *bridge;
+		int item;
+		int ticks;
+		/// Number of times the slot must be passed before the item is due.
+		int rounds;
+	};
+
+	explicit PublishWheel(QObject *parent = 0);
+
+	void insert(Entry &entry);
+
+	static const int SlotCount = 64;
+
+	QVector<Entry> mSlots[SlotCount];
+	/// Items due in the current tick.
+	QVector<Entry> mDue;
+	/// Bridges with items due in the current tick.
+	QVector<DBusBridge *> mDueBridges;
+	int mCurrentSlot;
+	int mCount;
+	QTimer *mTimer;
+};
+
+#endif // PUBLISH_WHEEL_H
@@ -0,0 +1,250 @@
+#include <QDomDocument>
+#include <QFile>
+#include <QList>
+#include <QsLog.h>
+#include <QStringList>
+#include "modbus.h"
+#include "register_maps.h"
+
+// A value takes 2 registers, so a read with all values must fit in a request.
+Q_STATIC_ASSERT(2 * MaxRegCount <= Modbus::MaxRegisterCount);
+
+/// Limits of the read period, in ms.
+static const int MinPeriod = 10;
+static const int MaxPeriod = 3600 * 1000;
+
+static QList<RegisterMap> registerMaps;
+
+static void logError(const QDomElement &element, const QString &message)
+{
+	QLOG_ERROR() << "Register maps, line" << element.lineNumber() << ':' << message;
+}
+
+/// Parses an integer attribute. Hexadecimal values (0x...) are supported.
+static bool getInt(const QDomElement &element, const QString &name, int minValue,
+				   int maxValue, int &value)
+{
+	bool ok = false;
+	value = element.attribute(name).toInt(&ok, 0);
+	if (!ok || value < minValue || value > maxValue) {
+		logError(element, QString("%1 should be a number between %2 and %3").
+				 arg(name).arg(minValue).arg(maxValue));
+		return false;
+	}
+	return true;
+}
+
+bool RegisterMaps::load(const QString &fileName)
+{
+	QFile file(fileName);
+	if (!file.open(QIODevice::ReadOnly)) {
+		QLOG_ERROR() << "Could not open register maps" << fileName;
+		return false;
+	}
+	QDomDocument doc;
+	QString errorMessage;
+	int errorLine = 0;
+	if (!doc.setContent(&file, &errorMessage, &errorLine)) {
+		QLOG_ERROR() << "Could not parse register maps" << fileName
+					 << "line" << errorLine << ':' << errorMessage;
+		return false;
+	}
+	QList<RegisterMap> maps;
+	for (QDomElement e = doc.documentElement().firstChildElement("map"); !e.isNull();
+		 e = e.nextSiblingElement("map")) {
+		RegisterMap map;
+		if (!parseMap(e, map))
+			return false;
+		maps.append(map);
+	}
+	if (maps.isEmpty()) {
+		QLOG_ERROR() << "No register maps found in" << fileName;
+		return false;
+	}
+	registerMaps = maps;
+	QLOG_INFO() << "Loaded" << maps.size() << "register maps from" << fileName;
+	return true;
+}
+
+const RegisterMap *RegisterMaps::find(int deviceType, MeasuringSystem system)
+{
+	for (int i=0; i<registerMaps.size(); ++i) {
+		const RegisterMap &map = registerMaps.at(i);
+		if (deviceType >= map.minDeviceId && deviceType <= map.maxDeviceId &&
+			(map.system == AnySystem || map.system == system)) {
+			return &map;
+		}
+	}
+	return 0;
+}
+
+AcSensor::ProtocolTypes RegisterMaps::protocolType(int deviceType)
+{
+	for (int i=0; i<registerMaps.size(); ++i) {
+		const RegisterMap &map = registerMaps.at(i);
+		if (deviceType >= map.minDeviceId && deviceType <= map.maxDeviceId)
+			return map.protocol;
+	}
+	return AcSensor::Unknown;
+}
+
+bool RegisterMaps::parseMap(const QDomElement &element, RegisterMap &map)
+{
+	map.name = element.attribute("name");
+
+	QString protocol = element.attribute("protocol");
+	if (protocol == "em24") {
+		map.protocol = AcSensor::Em24Protocol;
+	} else if (protocol == "et112") {
+		map.protocol = AcSensor::Et112Protocol;
+	} else if (protocol == "em340") {
+		map.protocol = AcSensor::Em340Protocol;
+	} else {
+		logError(element, "Unknown protocol: " + protocol);
+		return false;
+	}
+
+	QStringList ids = element.attribute("deviceIds").split('-');
+	bool ok1 = false;
+	bool ok2 = false;
+	map.minDeviceId = ids.first().trimmed().toInt(&ok1, 0);
+	map.maxDeviceId = ids.last().trimmed().toInt(&ok2, 0);
+	if (ids.size() > 2 || !ok1 || !ok2 || map.minDeviceId > map.maxDeviceId) {
+		logError(element, "deviceIds should be a number or a range (eg. 71-73)");
+		return false;
+	}
+
+	QString system = element.attribute("system");
+	if (system.isEmpty()) {
+		map.system = AnySystem;
+	} else if (system == "multiphase") {
+		map.system = MultiPhaseSystem;
+	} else if (system == "singlephase") {
+		map.system = SinglePhaseSystem;
+	} else if (system == "piggyback") {
+		map.system = PiggybackSystem;
+	} else {
+		logError(element, "Unknown system: " + system);
+		return false;
+	}
+
+	for (QDomElement e = element.firstChildElement("read"); !e.isNull();
+		 e = e.nextSiblingElement("read")) {
+		CompositeCommand command;
+		if (!parseCommand(e, command))
+			return false;
+		map.commands.append(command);
+	}
+	if (map.commands.isEmpty()) {
+		logError(element, "No registers to read in map " + map.name);
+		return false;
+	}
+	return true;
+}
+
+bool RegisterMaps::parseCommand(const QDomElement &element, CompositeCommand &command)
+{
+	if (!getInt(element, "reg", 0, 0xFFFF, command.reg) ||
+		!getInt(element, "period", MinPeriod, MaxPeriod, command.period))
+		return false;
+	int count = 0;
+	for (QDomElement e = element.firstChildElement("value"); !e.isNull();
+		 e = e.nextSiblingElement("value")) {
+		if (count == MaxRegCount) {
+			logError(e, QString("No more than %1 values allowed per read").arg(MaxRegCount));
+			return false;
+		}
+		RegisterCommand &action = command.actions[count];
+		if (!parseValue(e, action))
+			return false;
+		if (action.action != Dummy) {
+			for (int i=0; i<count; ++i) {
+				const RegisterCommand &other = command.actions[i];
+				if (other.action != Dummy && qAbs(other.regOffset - action.regOffset) < 2) {
+					logError(e, QString("Value at offset %1 overlaps value at offset %2").
+							 arg(action.regOffset).arg(other.regOffset));
+					return false;
+				}
+			}
+		}
+		++count;
+	}
+	if (count == 0) {
+		logError(element, "No values in read");
+		return false;
+	}
+	command.actionCount = count;
+	command.count = 0;
+	for (int i=0; i<count; ++i)
+		command.count = qMax(command.count, command.actions[i].regOffset + 2);
+	if (command.reg + command.count > 0x10000) {
+		logError(element, "Read exceeds the register address range");
+		return false;
+	}
+	for (int i=count; i<MaxRegCount; ++i) {
+		RegisterCommand &ra = command.actions[i];
+		ra.regOffset = 0;
+		ra.action = None;
+		ra.phase = MultiPhase;
+		ra.factor = 0;
+		ra.msbFirst = false;
+	}
+	return true;
+}
+
+bool RegisterMaps::parseValue(const QDomElement &element, RegisterCommand &action)
+{
+	// A value takes 2 registers, and all registers must fit in one request.
+	if (!getInt(element, "offset", 0, Modbus::MaxRegisterCount - 2, action.regOffset))
+		return false;
+
+	QString quantity = element.attribute("quantity");
+	if (quantity == "power") {
+		action.action = Power;
+	} else if (quantity == "voltage") {
+		action.action = Voltage;
+	} else if (quantity == "current") {
+		action.action = Current;
+	} else if (quantity == "positive-energy") {
+		action.action = PositiveEnergy;
+	} else if (quantity == "negative-energy") {
+		action.action = NegativeEnergy;
+	} else if (quantity == "dummy") {
+		action.action = Dummy;
+	} else {
+		logError(element, "Unknown quantity: " + quantity);
+		return false;
+	}
+
+	QString phase = element.attribute("phase");
+	if (phase == "total") {
+		action.phase = MultiPhase;
+	} else if (phase == "l1") {
+		action.phase = PhaseL1;
+	} else if (phase == "l2") {
+		action.phase = PhaseL2;
+	} else if (phase == "l3") {
+		action.phase = PhaseL3;
+	} else {
+		logError(element, "Unknown phase: " + phase);
+		return false;
+	}
+
+	action.factor = 1;
+	if (element.hasAttribute("scale")) {
+		bool ok = false;
+		action.factor = element.attribute("scale").toDouble(&ok);
+		if (!ok) {
+			logError(element, "Invalid scale: " + element.attribute("scale"));
+			return false;
+		}
+	}
+
+	QString wordOrder = element.attribute("wordOrder", "lsw");
+	if (wordOrder != "lsw" && wordOrder != "msw") {
+		logError(element, "wordOrder should be lsw or msw");
+		return false;
+	}
+	action.msbFirst = wordOrder == "msw";
+	return true;
+}
@@ -0,0 +1,107 @@
+#ifndef REGISTER_MAPS_H
+#define REGISTER_MAPS_H
+
+#include <QString>
+#include <QVector>
+#include "ac_sensor.h"
+#include "defines.h"
+
+class QDomElement;
+
+/// Maximum number of values read with a single `CompositeCommand`.
+static const int MaxRegCount = 5;
+
+/*!
+ * A single 32 bit value retrieved from the energy meter.
+ */
+struct RegisterCommand {
+	int regOffset;
+	ParameterType action;
+	Phase phase;
+	/// The register value is multiplied by this factor.
+	double factor;
+	/// True if the most significant word is sent first.
+	bool msbFirst;
+};
+
+/*!
+ * A group of registers read with a single request.
+ */
+struct CompositeCommand {
+	int reg;
+	/// Target time between reads of the registers, in ms.
+	int period;
+	/// Number of registers read, computed from the offsets of the values.
+	int count;
+	/// Number of entries used in `actions`.
+	int actionCount;
+	/// Entries not used have `action` set to `None`.
+	RegisterCommand actions[MaxRegCount];
+};
+
+/*!
+ * Wiring of the energy meter, used to select a register map.
+ */
+enum MeasuringSystem {
+	AnySystem,
+	MultiPhaseSystem,
+	SinglePhaseSystem,
+	/// Single phase, with a PV inverter on L2.
+	PiggybackSystem
+};
+
+struct RegisterMap {
+	QString name;
+	AcSensor::ProtocolTypes protocol;
+	int minDeviceId;
+	int maxDeviceId;
+	MeasuringSystem system;
+	QVector<CompositeCommand> commands;
+};
+
+/*!
+ * The register maps of the supported energy meters.
+ *
+ * The maps are read from an XML file at startup. The format is described in
+ * register_maps.xml, which is compiled into the application as a resource.
+ * The parsed maps have the same layout as the static tables used before, so
+ * acquisition is not slowed down. The maps are checked while loading: the
+ * values of a read may not overlap (except `dummy` values, which are only
+ * used to extend the read), and the register count of each read is computed
+ * once, so it does not have to be derived from the values on each request.
+ *
+ * The maps must be loaded before the serial port threads are started, and
+ * may not be changed afterwards, because they are used from those threads
+ * without locking.
+ */
+class RegisterMaps
+{
+public:
+	/*!
+	 * Loads the register maps from file, replacing the maps loaded before.
+	 * @retval false if the file could not be read or contains errors. The
+	 * errors are logged, and the maps are not changed.
+	 */
+	static bool load(const QString &fileName);
+
+	/*!
+	 * Returns the first map for the device type and measuring system, or 0 if
+	 * there is none.
+	 */
+	static const RegisterMap *find(int deviceType, MeasuringSystem system);
+
+	/*!
+	 * Returns the protocol of the first map for the device type, or
+	 * `AcSensor::Unknown`.
+	 */
+	static AcSensor::ProtocolTypes protocolType(int deviceType);
+
+private:
+	static bool parseMap(const QDomElement &element, RegisterMap &map);
+
+	static bool parseCommand(const QDomElement &element, CompositeCommand &command);
+
+	static bool parseValue(const QDomElement &element, RegisterCommand &action);
+};
+
+#endif // REGISTER_MAPS_H
@@ -0,0 +1,130 @@
+#include <QCoreApplication>
+#include <QsLog.h>
+#include <QSocketNotifier>
+#include <unistd.h>
+#include "serial_transport.h"
+
+/// The transport calling into velib from the current thread, if any. Each
+/// port has its own thread, so this tells `pltExit` which port has failed.
+static __thread SerialTransport *currentTransport = 0;
+
+/*!
+ * Marks the transport as the one calling into velib, for as long as this
+ * object exists.
+ */
+class VelibCall
+{
+public:
+	VelibCall(SerialTransport *transport):
+		mPrevious(currentTransport)
+	{
+		currentTransport = transport;
+	}
+
+	~VelibCall()
+	{
+		currentTransport = mPrevious;
+	}
+
+private:
+	SerialTransport *mPrevious;
+};
+
+extern "C"
+{
+// This function is called by the serial port API from velib when the device is
+// disconnected from the serial port. The failure is reported as a serial event
+// of the port, so the port can be retried without stopping the other ports.
+void pltExit(int ret)
+{
+	if (currentTransport == 0) {
+		QLOG_ERROR() << "Serial port failure outside of a port, exiting";
+		QCoreApplication::exit(ret);
+		return;
+	}
+	currentTransport->reportFailure(ret);
+}
+}
+
+SerialTransport::SerialTransport(const QString &portName, int baudrate, QObject *parent):
+	ModbusTransport(parent),
+	mSerialPort(veSerialAllocate(portName.toLatin1().data())),
+	mBaudrate(baudrate),
+	mFailed(false)
+{
+	VelibCall call(this);
+	veSerialSetBaud(mSerialPort, static_cast<un32>(baudrate));
+	veSerialSetKind(mSerialPort, 0); // Requires external event pump
+	veSerialOpen(mSerialPort, 0);
+
+	QSocketNotifier *readNotifier =
+		new QSocketNotifier(mSerialPort->fh, QSocketNotifier::Read, this);
+	connect(readNotifier, SIGNAL(activated(int)), this, SLOT(onReadyRead()));
+
+	QSocketNotifier *errorNotifier =
+		new QSocketNotifier(mSerialPort->fh, QSocketNotifier::Exception, this);
+	connect(errorNotifier, SIGNAL(activated(int)), this, SLOT(onError()));
+}
+
+SerialTransport::~SerialTransport()
+{
+	VelibCall call(this);
+	veSerialClose(mSerialPort);
+	VeSerialPortFree(mSerialPort);
+}
+
+void SerialTransport::write(const quint8 *data, int size)
+{
+	VelibCall call(this);
+	veSerialPutBuf(mSerialPort, const_cast<un8 *>(data), static_cast<un32>(size));
+}
+
+qint64 SerialTransport::charTime() const
+{
+	// We assume 10 bits per character (8 data bits, 1 stop bit and 1 parity
+	// bit). Keep in mind that overestimating the character time does not hurt
+	// (a lot), but underestimating does.
+	return (10 * Q_INT64_C(1000000000)) / static_cast<qint64>(mBaudrate);
+}
+
+void SerialTransport::onReadyRead()
+{
+	quint8 buf[64];
+	bool first = true;
+	for (;;) {
+		ssize_t len = read(mSerialPort->fh, buf, sizeof(buf));
+		if (len < 0) {
+			emit errorOccurred("serial read failure");
+			return;
+		}
+		if (first && len == 0) {
+			emit errorOccurred("Ready for reading but read 0 bytes. Device removed?");
+			return;
+		}
+		if (len > 0)
+			emit dataReceived(buf, static_cast<int>(len));
+		if (len < static_cast<int>(sizeof(buf)))
+			break;
+		first = false;
+	}
+}
+
+void SerialTransport::onError()
+{
+	emit errorOccurred("Serial error");
+}
+
+void SerialTransport::onFailure(int ret)
+{
+	emit errorOccurred(QString("Serial port failure (%1)").arg(ret));
+}
+
+void SerialTransport::reportFailure(int ret)
+{
+	if (mFailed)
+		return;
+	mFailed = true;
+	// We are inside a velib call here, possibly from the constructor, before
+	// anyone is connected to our signals.
+	QMetaObject::invokeMethod(this, "onFailure", Qt::QueuedConnection, Q_ARG(int, ret));
+}
@@ -0,0 +1,46 @@
+#ifndef SERIAL_TRANSPORT_H
+#define SERIAL_TRANSPORT_H
+
+extern "C" {
+	#include <velib/platform/serial.h>
+}
+#include "modbus_transport.h"
+
+/*!
+ * Transport using a (RS485) serial port.
+ *
+ * If velib gives up on the port (see `pltExit`), `errorOccurred` is emitted,
+ * like for any other error of the port.
+ */
+class SerialTransport : public ModbusTransport
+{
+	Q_OBJECT
+public:
+	SerialTransport(const QString &portName, int baudrate, QObject *parent = 0);
+
+	~SerialTransport();
+
+	virtual void write(const quint8 *data, int size);
+
+	virtual qint64 charTime() const;
+
+	/*!
+	 * Called by velib (see `pltExit`) when the serial device has
+	 * disappeared. `errorOccurred` will be emitted once, from the event loop.
+	 */
+	void reportFailure(int ret);
+
+private slots:
+	void onReadyRead();
+
+	void onError();
+
+	void onFailure(int ret);
+
+private:
+	VeSerialPort *mSerialPort;
+	int mBaudrate;
+	bool mFailed;
+};
+
+#endif // SERIAL_TRANSPORT_H
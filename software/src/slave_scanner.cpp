@@ -0,0 +1,130 @@
+#include <QsLog.h>
+#include <QStringList>
+#include <QTimer>
+#include "slave_scanner.h"
+
+/// Device ID register, present on all supported energy meters.
+static const quint16 RegDeviceId = 0x000B;
+/// Number of times an address is probed before it is considered empty.
+static const int ProbeRounds = 2;
+
+static int firstScanAddress = 1;
+static int lastScanAddress = 2;
+
+SlaveScanner::SlaveScanner(Modbus *modbus, int timeout, int rescanInterval, QObject *parent):
+	QObject(parent),
+	mModbus(modbus),
+	mTimeout(timeout),
+	mRescanTimer(new QTimer(this)),
+	mFinished(false),
+	mRound(0),
+	mPendingCount(0)
+{
+	for (int a=firstScanAddress; a<=lastScanAddress; ++a)
+		mProbes.append(new Probe(this, a));
+	mRescanTimer->setSingleShot(true);
+	mRescanTimer->setInterval(rescanInterval);
+	connect(mRescanTimer, SIGNAL(timeout()), this, SLOT(onRescanTimer()));
+}
+
+SlaveScanner::~SlaveScanner()
+{
+	qDeleteAll(mProbes);
+}
+
+void SlaveScanner::setAddressRange(int firstAddress, int lastAddress)
+{
+	firstScanAddress = firstAddress;
+	lastScanAddress = lastAddress;
+}
+
+void SlaveScanner::start()
+{
+	mStopwatch.start();
+	for (int a=firstScanAddress; a<=lastScanAddress; ++a)
+		mRemaining.append(a);
+	startRound();
+}
+
+void SlaveScanner::onRescanTimer()
+{
+	mRound = 0;
+	startRound();
+}
+
+void SlaveScanner::startRound()
+{
+	++mRound;
+	mPendingCount = mRemaining.size();
+	// Rescans should not delay the measurements of the meters found already.
+	Modbus::Priority priority = mFinished ? Modbus::LowPriority : Modbus::NormalPriority;
+	foreach (int a, mRemaining) {
+		quint8 address = static_cast<quint8>(a);
+		mModbus->setListener(address, mProbes[a - firstScanAddress]);
+		mModbus->readRegisters(Modbus::ReadHoldingRegisters, address, RegDeviceId, 1,
+							   priority, mTimeout);
+	}
+}
+
+void SlaveScanner::onProbeCompleted(int slaveAddress, bool found)
+{
+	if (found) {
+		// Release the address before anyone else starts using it.
+		mModbus->setListener(static_cast<quint8>(slaveAddress), 0);
+		mRemaining.removeOne(slaveAddress);
+		mFound.append(slaveAddress);
+		if (mFinished) {
+			QLOG_INFO() << "Found slave address" << slaveAddress << "on"
+						<< mModbus->objectName();
+		}
+		emit slaveFound(slaveAddress);
+	}
+	--mPendingCount;
+	if (mPendingCount > 0)
+		return;
+	if (mRound < ProbeRounds && !mRemaining.isEmpty()) {
+		startRound();
+		return;
+	}
+	foreach (int a, mRemaining)
+		mModbus->setListener(static_cast<quint8>(a), 0);
+	if (!mFinished) {
+		mFinished = true;
+		QStringList found;
+		foreach (int a, mFound)
+			found.append(QString::number(a));
+		QLOG_INFO() << "Scanned slave addresses" << firstScanAddress << '-' << lastScanAddress
+					<< "on" << mModbus->objectName() << "in" << mStopwatch.elapsed() << "ms,"
+					<< "found:" << (found.isEmpty() ? QString("none") : found.join(","));
+		emit finished(mFound.size());
+	}
+	// Without any device on the port, the port is considered lost, and
+	// rescanning is left to the owner of the port.
+	if (mFound.isEmpty() || mRemaining.isEmpty()) {
+		deleteLater();
+		return;
+	}
+	mRescanTimer->start();
+}
+
+void SlaveScanner::Probe::onReadCompleted(int function, const RegisterView &registers)
+{
+	Q_UNUSED(function)
+	Q_UNUSED(registers)
+	mScanner->onProbeCompleted(mSlaveAddress, true);
+}
+
+void SlaveScanner::Probe::onWriteCompleted(int function, quint16 address, quint16 value)
+{
+	Q_UNUSED(function)
+	Q_UNUSED(address)
+	Q_UNUSED(value)
+}
+
+void SlaveScanner::Probe::onErrorReceived(int errorType, int exception)
+{
+	Q_UNUSED(exception)
+	// An exception means there is a device at the address, even if it is not
+	// an energy meter. It is identified by the updater.
+	mScanner->onProbeCompleted(mSlaveAddress, errorType == Modbus::Exception);
+}
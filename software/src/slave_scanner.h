@@ -0,0 +1,106 @@
+#ifndef SLAVE_SCANNER_H
+#define SLAVE_SCANNER_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include "modbus.h"
+
+class QTimer;
+
+/*!
+ * Finds the energy meters connected to a port.
+ *
+ * All addresses in the scan range (see `setAddressRange`) are probed by
+ * reading the device ID register. The probes of all addresses are queued at
+ * once, so with modbus TCP they are sent in parallel, and the short probe
+ * timeout (see `ModbusTimeouts`) is used. Addresses which did not respond are
+ * probed again in the next round, up to `ProbeRounds` rounds.
+ *
+ * `slaveFound` is emitted as soon as an address responds, so measurements on
+ * that address can start while the scan continues. If devices have been
+ * found, addresses which are still silent after the scan are scanned again
+ * every `rescanInterval` ms (with low priority), so a meter which is powered
+ * up later will be found as well. The scanner lives in the thread of the
+ * `Modbus` object, and deletes itself when all addresses have responded, or
+ * when no device has been found.
+ */
+class SlaveScanner : public QObject
+{
+	Q_OBJECT
+public:
+	/*!
+	 * @param timeout The response timeout of the probes in ms.
+	 * @param rescanInterval Time between scans of the silent addresses in ms.
+	 */
+	SlaveScanner(Modbus *modbus, int timeout, int rescanInterval, QObject *parent = 0);
+
+	~SlaveScanner();
+
+	/*!
+	 * Sets the range of slave addresses probed by all scanners. The default
+	 * range is 1-2. Must be called before the serial port threads are started.
+	 */
+	static void setAddressRange(int firstAddress, int lastAddress);
+
+public slots:
+	void start();
+
+signals:
+	/*!
+	 * Emitted when a device has responded to a probe. The scanner is no
+	 * longer listening to the address when this signal is emitted.
+	 */
+	void slaveFound(int slaveAddress);
+
+	/*!
+	 * Emitted once, when all addresses have been probed for the first time.
+	 * Addresses will be scanned again later if `count` is not zero.
+	 * @param count The number of devices found.
+	 */
+	void finished(int count);
+
+private slots:
+	void onRescanTimer();
+
+private:
+	class Probe : public ModbusListener
+	{
+	public:
+		Probe(SlaveScanner *scanner, int slaveAddress):
+			mScanner(scanner),
+			mSlaveAddress(slaveAddress)
+		{
+		}
+
+		virtual void onReadCompleted(int function, const RegisterView &registers);
+
+		virtual void onWriteCompleted(int function, quint16 address, quint16 value);
+
+		virtual void onErrorReceived(int errorType, int exception);
+
+	private:
+		SlaveScanner *mScanner;
+		int mSlaveAddress;
+	};
+
+	void startRound();
+
+	void onProbeCompleted(int slaveAddress, bool found);
+
+	Modbus *mModbus;
+	int mTimeout;
+	QTimer *mRescanTimer;
+	/// Set once `finished` has been emitted.
+	bool mFinished;
+	/// One probe per address in the scan range.
+	QList<Probe *> mProbes;
+	/// Addresses which have not responded yet.
+	QList<int> mRemaining;
+	QList<int> mFound;
+	int mRound;
+	int mPendingCount;
+	QElapsedTimer mStopwatch;
+};
+
+#endif // SLAVE_SCANNER_H
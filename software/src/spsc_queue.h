@@ -0,0 +1,59 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <QAtomicInt>
+
+/*!
+ * Fixed size, lock-free queue with a single producer and a single consumer.
+ *
+ * `push` may only be called from the producer thread, `pop` only from the
+ * consumer thread. The queue can hold `Capacity - 1` items.
+ */
+template<typename T, int Capacity>
+class SpscQueue
+{
+public:
+	SpscQueue():
+		mHead(0),
+		mTail(0)
+	{
+	}
+
+	/*!
+	 * Adds an item to the queue.
+	 * @retval false if the queue was full. The item is dropped in this case.
+	 */
+	bool push(const T &item)
+	{
+		int tail = mTail.load();
+		int next = (tail + 1) % Capacity;
+		if (next == mHead.loadAcquire())
+			return false;
+		mItems[tail] = item;
+		mTail.storeRelease(next);
+		return true;
+	}
+
+	/*!
+	 * Removes the oldest item from the queue.
+	 * @retval false if the queue was empty.
+	 */
+	bool pop(T &item)
+	{
+		int head = mHead.load();
+		if (head == mTail.loadAcquire())
+			return false;
+		item = mItems[head];
+		mHead.storeRelease((head + 1) % Capacity);
+		return true;
+	}
+
+private:
+	T mItems[Capacity];
+	/// Index of the oldest item. Written by the consumer only.
+	QAtomicInt mHead;
+	/// Index of the first free slot. Written by the producer only.
+	QAtomicInt mTail;
+};
+
+#endif // SPSC_QUEUE_H
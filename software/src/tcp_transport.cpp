@@ -0,0 +1,63 @@
+#include <QsLog.h>
+#include <QTcpSocket>
+#include <QTimer>
+#include "tcp_transport.h"
+
+TcpTransport::TcpTransport(const QString &hostName, quint16 port, QObject *parent):
+	ModbusTransport(parent),
+	mSocket(new QTcpSocket(this)),
+	mHostName(hostName),
+	mPort(port)
+{
+	connect(mSocket, SIGNAL(connected()), this, SLOT(onConnected()));
+	connect(mSocket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+	connect(mSocket, SIGNAL(error(QAbstractSocket::SocketError)),
+			this, SLOT(onError(QAbstractSocket::SocketError)));
+	QTimer::singleShot(0, this, SLOT(onConnect()));
+}
+
+void TcpTransport::write(const quint8 *data, int size)
+{
+	// Data written while the connection is being set up will be buffered by
+	// the socket.
+	mSocket->write(reinterpret_cast<const char *>(data), size);
+}
+
+qint64 TcpTransport::charTime() const
+{
+	return 0;
+}
+
+void TcpTransport::onConnect()
+{
+	QLOG_INFO() << "Connecting to" << mHostName << ':' << mPort;
+	mSocket->connectToHost(mHostName, mPort);
+}
+
+void TcpTransport::onConnected()
+{
+	// Requests are small, and we want them to be sent at once.
+	mSocket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+	QLOG_INFO() << "Connected to" << mHostName << ':' << mPort;
+}
+
+void TcpTransport::onReadyRead()
+{
+	quint8 buf[256];
+	for (;;) {
+		qint64 len = mSocket->read(reinterpret_cast<char *>(buf), sizeof(buf));
+		if (len < 0) {
+			emit errorOccurred("TCP read failure");
+			return;
+		}
+		if (len == 0)
+			break;
+		emit dataReceived(buf, static_cast<int>(len));
+	}
+}
+
+void TcpTransport::onError(QAbstractSocket::SocketError error)
+{
+	Q_UNUSED(error);
+	emit errorOccurred(mSocket->errorString());
+}
@@ -0,0 +1,42 @@
+#ifndef TCP_TRANSPORT_H
+#define TCP_TRANSPORT_H
+
+#include <QAbstractSocket>
+#include "modbus_transport.h"
+
+class QTcpSocket;
+
+/*!
+ * Transport using a TCP connection, either to a Modbus TCP device or to an
+ * Ethernet to RS485 gateway.
+ *
+ * The connection is set up once the event loop of the thread owning the
+ * object is running, so the object may be moved to another thread after
+ * construction.
+ */
+class TcpTransport : public ModbusTransport
+{
+	Q_OBJECT
+public:
+	TcpTransport(const QString &hostName, quint16 port, QObject *parent = 0);
+
+	virtual void write(const quint8 *data, int size);
+
+	virtual qint64 charTime() const;
+
+private slots:
+	void onConnect();
+
+	void onConnected();
+
+	void onReadyRead();
+
+	void onError(QAbstractSocket::SocketError error);
+
+private:
+	QTcpSocket *mSocket;
+	QString mHostName;
+	quint16 mPort;
+};
+
+#endif // TCP_TRANSPORT_H
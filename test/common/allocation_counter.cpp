@@ -0,0 +1,44 @@
+#include <new>
+#include <stdlib.h>
+#include <QtGlobal>
+#include "allocation_counter.h"
+
+static bool countAllocations = false;
+static int allocationCount = 0;
+
+void *operator new(size_t size)
+{
+	if (countAllocations)
+		++allocationCount;
+	void *p = malloc(size == 0 ? 1 : size);
+	if (p == 0)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) Q_DECL_NOTHROW
+{
+	free(p);
+}
+
+void operator delete[](void *p) Q_DECL_NOTHROW
+{
+	free(p);
+}
+
+void startCounting()
+{
+	allocationCount = 0;
+	countAllocations = true;
+}
+
+int stopCounting()
+{
+	countAllocations = false;
+	return allocationCount;
+}
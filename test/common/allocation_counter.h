@@ -0,0 +1,16 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+/*!
+ * Counting of heap allocations in tests. allocation_counter.cpp replaces the
+ * global `operator new` and `operator delete`, so the counts include the
+ * allocations done by Qt.
+ */
+
+/// Starts counting allocations.
+void startCounting();
+
+/// Stops counting, and returns the number of allocations since `startCounting`.
+int stopCounting();
+
+#endif // ALLOCATION_COUNTER_H
@@ -0,0 +1,70 @@
+#include "crc16.h"
+#include "defines.h"
+#include "fake_transport.h"
+#include "simulated_meter.h"
+
+FakeTransport::FakeTransport(SimulatedMeter *meter, QObject *parent):
+	ModbusTransport(parent),
+	mMeter(meter),
+	mResponseSize(0)
+{
+}
+
+void FakeTransport::write(const quint8 *data, int size)
+{
+	Q_ASSERT(size == 8);
+	Q_UNUSED(size)
+	mResponseSize = 0;
+	if (data[0] != mMeter->slaveAddress())
+		return;
+	quint8 function = data[1];
+	quint16 reg = toUInt16(data[2], data[3]);
+	quint16 value = toUInt16(data[4], data[5]);
+	int exception = Modbus::IllegalFunction;
+	int length = 0;
+	mResponse[length++] = data[0];
+	mResponse[length++] = function;
+	switch (function) {
+	case Modbus::ReadHoldingRegisters:
+	case Modbus::ReadInputRegisters:
+		exception = value > Modbus::MaxRegisterCount ?
+			Modbus::IllegalDataValue :
+			mMeter->readRegisters(reg, value, mRegisters);
+		if (exception != 0)
+			break;
+		mResponse[length++] = static_cast<quint8>(2 * value);
+		for (int i=0; i<value; ++i) {
+			mResponse[length++] = msb(mRegisters[i]);
+			mResponse[length++] = lsb(mRegisters[i]);
+		}
+		break;
+	case Modbus::WriteSingleRegister:
+		exception = mMeter->writeRegister(reg, value);
+		if (exception != 0)
+			break;
+		for (int i=2; i<6; ++i)
+			mResponse[length++] = data[i];
+		break;
+	default:
+		break;
+	}
+	if (exception != 0) {
+		length = 1;
+		mResponse[length++] = function | 0x80;
+		mResponse[length++] = static_cast<quint8>(exception);
+	}
+	quint16 crc = Crc16::getValue(mResponse, length);
+	mResponse[length++] = msb(crc);
+	mResponse[length++] = lsb(crc);
+	mResponseSize = length;
+}
+
+bool FakeTransport::respond()
+{
+	if (mResponseSize == 0)
+		return false;
+	int size = mResponseSize;
+	mResponseSize = 0;
+	emit dataReceived(mResponse, size);
+	return true;
+}
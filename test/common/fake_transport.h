@@ -0,0 +1,41 @@
+#ifndef FAKE_TRANSPORT_H
+#define FAKE_TRANSPORT_H
+
+#include "modbus.h"
+#include "modbus_transport.h"
+
+class SimulatedMeter;
+
+/*!
+ * Transport connected to a simulated energy meter. The response to a request
+ * is sent when `respond` is called, so the test decides when the modbus
+ * object receives its data. All buffers have a fixed size, so the transport
+ * does not allocate memory.
+ */
+class FakeTransport : public ModbusTransport
+{
+	Q_OBJECT
+public:
+	FakeTransport(SimulatedMeter *meter, QObject *parent = 0);
+
+	virtual void write(const quint8 *data, int size);
+
+	virtual qint64 charTime() const
+	{
+		return 0;
+	}
+
+	/*!
+	 * Sends the response to the last request.
+	 * @retval false if there is no response pending.
+	 */
+	bool respond();
+
+private:
+	SimulatedMeter *mMeter;
+	quint16 mRegisters[Modbus::MaxRegisterCount];
+	quint8 mResponse[256];
+	int mResponseSize;
+};
+
+#endif // FAKE_TRANSPORT_H
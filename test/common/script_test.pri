@@ -0,0 +1,10 @@
+# Runs the shell test $$SCRIPT with `make check`. The tests need dbus-cgwacs
+# and tools/meter_simulator to be built, and are skipped otherwise.
+TEMPLATE = aux
+
+check.commands = $$_PRO_FILE_PWD_/$$SCRIPT
+QMAKE_EXTRA_TARGETS += check
+
+DISTFILES += \
+    $$SCRIPT \
+    $$PWD/script_test.sh
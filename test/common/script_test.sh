@@ -0,0 +1,88 @@
+# Shared parts of the tests which run dbus-cgwacs against the meter simulator.
+# Sourced by the test scripts, after which the test can use:
+#
+#   WORK, LINK, LOG  temporary directory, simulator link and dbus-cgwacs log
+#   SIM_PID, CGWACS_PID  processes started by the test, stopped on exit
+#
+# Needs a D-Bus with com.victronenergy.settings (localsettings). The test is
+# skipped if that is not available (see `check_environment`).
+#
+# Environment:
+#   DBUS_ADDRESS   bus used by dbus-cgwacs (default: session)
+#   DBUS_CGWACS    path of dbus-cgwacs (default: software/dbus-cgwacs)
+#   METER_SIMULATOR path of the simulator (default: tools/meter_simulator/meter_simulator)
+
+DIR=$(cd "$(dirname "$0")/../.." && pwd)
+DBUS_ADDRESS=${DBUS_ADDRESS:-session}
+DBUS_CGWACS=${DBUS_CGWACS:-$DIR/software/dbus-cgwacs}
+METER_SIMULATOR=${METER_SIMULATOR:-$DIR/tools/meter_simulator/meter_simulator}
+
+WORK=$(mktemp -d)
+LINK=$WORK/ttyCG0
+LOG=$WORK/dbus-cgwacs.log
+SIM_PID=
+CGWACS_PID=
+
+# Stops dbus-cgwacs and the simulator.
+stop() {
+	[ -n "$CGWACS_PID" ] && kill "$CGWACS_PID" 2>/dev/null
+	[ -n "$SIM_PID" ] && kill "$SIM_PID" 2>/dev/null
+	wait 2>/dev/null
+	CGWACS_PID=
+	SIM_PID=
+}
+
+cleanup() {
+	stop
+	rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+skip() {
+	echo "SKIP: $1"
+	exit 0
+}
+
+fail() {
+	echo "FAIL: $1"
+	echo "--- dbus-cgwacs log"
+	cat "$LOG"
+	exit 1
+}
+
+# Waits (at most $2 seconds) until the log contains $1.
+wait_for_log() {
+	i=0
+	while ! grep -q "$1" "$LOG" 2>/dev/null; do
+		i=$((i + 1))
+		[ $i -gt $(($2 * 10)) ] && return 1
+		sleep 0.1
+	done
+	return 0
+}
+
+# Starts a simulated EM24 on LINK. The arguments are passed to the simulator.
+start_simulator() {
+	"$METER_SIMULATOR" --link "$LINK" --meter em24:1 "$@" >/dev/null 2>&1 &
+	SIM_PID=$!
+	i=0
+	while [ ! -e "$LINK" ]; do
+		i=$((i + 1))
+		[ $i -gt 50 ] && fail "simulator did not start"
+		sleep 0.1
+	done
+}
+
+# Skips the test if dbus-cgwacs, the simulator or localsettings is missing.
+check_environment() {
+	[ -x "$DBUS_CGWACS" ] || skip "$DBUS_CGWACS not built"
+	[ -x "$METER_SIMULATOR" ] || skip "$METER_SIMULATOR not built"
+	case "$DBUS_ADDRESS" in
+		session) BUS=--session ;;
+		system) BUS=--system ;;
+		*) BUS=--bus=$DBUS_ADDRESS ;;
+	esac
+	dbus-send $BUS --print-reply --dest=com.victronenergy.settings /Settings \
+		org.freedesktop.DBus.Introspectable.Introspect >/dev/null 2>&1 ||
+		skip "com.victronenergy.settings not found on the $DBUS_ADDRESS bus"
+}
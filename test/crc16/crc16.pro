@@ -0,0 +1,22 @@
+QT += core testlib
+QT -= gui
+
+TARGET = test_crc16
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+MOC_DIR=.moc
+OBJECTS_DIR=.obj
+
+INCLUDEPATH += \
+    ../../software/src
+
+HEADERS += \
+    ../../software/src/crc16.h \
+    ../../software/src/defines.h
+
+SOURCES += \
+    ../../software/src/crc16.cpp \
+    test_crc16.cpp
@@ -0,0 +1,145 @@
+#include <QByteArray>
+#include <QtTest>
+#include "crc16.h"
+
+/*!
+ * Straightforward bitwise implementation of the Modbus CRC16, independent of
+ * the lookup tables in crc16.cpp. The result is arranged like
+ * `Crc16::getValue`: the first byte sent in the low order byte.
+ */
+static quint16 referenceCrc(const quint8 *bytes, int count)
+{
+	quint16 crc = 0xFFFF;
+	for (int i=0; i<count; ++i) {
+		crc ^= bytes[i];
+		for (int b=0; b<8; ++b)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+	}
+	return static_cast<quint16>((crc << 8) | (crc >> 8));
+}
+
+/// The byte-at-a-time table loop, used before slice-by-8 was added.
+static quint16 byteWiseCrc(const quint8 *bytes, int count)
+{
+	Crc16 crc;
+	for (int i=0; i<count; ++i)
+		crc.add(bytes[i]);
+	return crc.getValue();
+}
+
+static QByteArray randomBytes(int count)
+{
+	QByteArray bytes(count, 0);
+	for (int i=0; i<count; ++i)
+		bytes[i] = static_cast<char>(qrand() & 0xFF);
+	return bytes;
+}
+
+static const quint8 *data(const QByteArray &bytes)
+{
+	return reinterpret_cast<const quint8 *>(bytes.constData());
+}
+
+class TestCrc16 : public QObject
+{
+	Q_OBJECT
+private slots:
+	void initTestCase()
+	{
+		qsrand(2012);
+	}
+
+	void knownMessage()
+	{
+		// Read 10 holding registers from slave 1. The CRC is sent as C5 CD.
+		const quint8 request[] = { 0x01, 0x03, 0x00, 0x00, 0x00, 0x0A };
+		QCOMPARE(Crc16::getValue(request, sizeof(request)), quint16(0xC5CD));
+		QCOMPARE(referenceCrc(request, sizeof(request)), quint16(0xC5CD));
+	}
+
+	void matchesReference()
+	{
+		for (int count=0; count<=300; ++count) {
+			for (int i=0; i<4; ++i) {
+				QByteArray bytes = randomBytes(count);
+				quint16 expected = referenceCrc(data(bytes), count);
+				QCOMPARE(byteWiseCrc(data(bytes), count), expected);
+				QCOMPARE(Crc16::getValue(data(bytes), count), expected);
+				QCOMPARE(Crc16::getValue(bytes), expected);
+			}
+		}
+	}
+
+	void addInParts()
+	{
+		// Blocks which do not start at a multiple of 8 bytes, and single bytes
+		// between blocks, must give the same result.
+		QByteArray bytes = randomBytes(300);
+		quint16 expected = referenceCrc(data(bytes), bytes.size());
+		for (int split=0; split<=bytes.size(); ++split) {
+			Crc16 crc;
+			crc.add(data(bytes), split);
+			if (split < bytes.size())
+				crc.add(data(bytes)[split]);
+			if (split + 1 < bytes.size())
+				crc.add(data(bytes) + split + 1, bytes.size() - split - 1);
+			QCOMPARE(crc.getValue(), expected);
+		}
+	}
+
+	void reset()
+	{
+		QByteArray bytes = randomBytes(100);
+		Crc16 crc;
+		crc.add(bytes);
+		crc.reset();
+		crc.add(bytes);
+		QCOMPARE(crc.getValue(), referenceCrc(data(bytes), bytes.size()));
+	}
+
+	void benchmarkByteWise()
+	{
+		QFETCH(int, count);
+		QByteArray bytes = randomBytes(count);
+		quint16 crc = 0;
+		QBENCHMARK {
+			crc ^= byteWiseCrc(data(bytes), count);
+		}
+		Q_UNUSED(crc)
+	}
+
+	void benchmarkByteWise_data()
+	{
+		addBenchmarkData();
+	}
+
+	void benchmarkSliceBy8()
+	{
+		QFETCH(int, count);
+		QByteArray bytes = randomBytes(count);
+		quint16 crc = 0;
+		QBENCHMARK {
+			crc ^= Crc16::getValue(data(bytes), count);
+		}
+		Q_UNUSED(crc)
+	}
+
+	void benchmarkSliceBy8_data()
+	{
+		addBenchmarkData();
+	}
+
+private:
+	static void addBenchmarkData()
+	{
+		QTest::addColumn<int>("count");
+		// A request, a power read, and the largest modbus RTU frame.
+		QTest::newRow("8 bytes") << 8;
+		QTest::newRow("37 bytes") << 37;
+		QTest::newRow("256 bytes") << 256;
+	}
+};
+
+QTEST_APPLESS_MAIN(TestCrc16)
+
+#include "test_crc16.moc"
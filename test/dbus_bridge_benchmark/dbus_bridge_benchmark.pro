@@ -0,0 +1,36 @@
+QT += core dbus testlib
+QT -= gui
+
+TARGET = test_dbus_bridge_benchmark
+CONFIG += console testcase link_pkgconfig
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+MOC_DIR=.moc
+OBJECTS_DIR=.obj
+
+# libdbus is used to measure the size of the signals on the bus.
+PKGCONFIG += dbus-1
+
+include(../../software/ext/qslog/QsLog.pri)
+include(../../software/ext/velib/src/qt/ve_qitems.pri)
+
+INCLUDEPATH += \
+    ../common \
+    ../../software/ext/qslog \
+    ../../software/ext/velib/inc \
+    ../../software/ext/velib/inc/velib/platform \
+    ../../software/src
+
+SOURCES += \
+    ../common/allocation_counter.cpp \
+    ../../software/src/dbus_bridge.cpp \
+    ../../software/src/publish_wheel.cpp \
+    test_dbus_bridge_benchmark.cpp
+
+HEADERS += \
+    ../common/allocation_counter.h \
+    ../../software/src/dbus_bridge.h \
+    ../../software/src/defines.h \
+    ../../software/src/publish_wheel.h
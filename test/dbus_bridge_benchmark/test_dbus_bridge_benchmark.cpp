@@ -0,0 +1,494 @@
+#include <dbus/dbus.h>
+#include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QsLog.h>
+#include <QtTest>
+#include <velib/qt/ve_qitem.hpp>
+#include <velib/qt/ve_qitems_dbus.hpp>
+#include "allocation_counter.h"
+#include "dbus_bridge.h"
+#include "publish_wheel.h"
+
+/// Number of publish periods measured on the D-Bus.
+static const int Rounds = 5;
+/// Number of publishes measured when counting allocations.
+static const int Publishes = 1000;
+
+/// Object with a single measured value, like an `AcSensorPhase`.
+class Source : public QObject
+{
+	Q_OBJECT
+	Q_PROPERTY(double value READ value WRITE setValue NOTIFY valueChanged)
+public:
+	explicit Source(QObject *parent = 0):
+		QObject(parent),
+		mValue(0)
+	{
+	}
+
+	double value() const
+	{
+		return mValue;
+	}
+
+	void setValue(double v)
+	{
+		if (mValue == v)
+			return;
+		mValue = v;
+		emit valueChanged();
+	}
+
+signals:
+	void valueChanged();
+
+private:
+	double mValue;
+};
+
+/*!
+ * Counts the signals sent by a service on the session bus, and their size on
+ * the bus. Uses libdbus, because QtDBus does not tell the size of a message.
+ * Each signal wakes up the D-Bus daemon, and each client listening to it.
+ */
+class SignalCounter
+{
+public:
+	SignalCounter():
+		mConnection(0)
+	{
+		reset();
+	}
+
+	~SignalCounter()
+	{
+		if (mConnection == 0)
+			return;
+		dbus_connection_close(mConnection);
+		dbus_connection_unref(mConnection);
+	}
+
+	/// Starts listening to the BusItem signals of `service`.
+	bool open(const QString &service)
+	{
+		DBusError error;
+		dbus_error_init(&error);
+		mConnection = dbus_bus_get_private(DBUS_BUS_SESSION, &error);
+		if (mConnection != 0) {
+			QByteArray rule = QString("type='signal',sender='%1',"
+									  "interface='com.victronenergy.BusItem'").
+				arg(service).toLatin1();
+			dbus_bus_add_match(mConnection, rule.constData(), &error);
+		}
+		bool ok = mConnection != 0 && !dbus_error_is_set(&error);
+		dbus_error_free(&error);
+		return ok;
+	}
+
+	/// Counts the signals received since the last call.
+	void poll()
+	{
+		dbus_connection_read_write(mConnection, 0);
+		DBusMessage *m = 0;
+		while ((m = dbus_connection_pop_message(mConnection)) != 0) {
+			char *buffer = 0;
+			int length = 0;
+			if (dbus_message_marshal(m, &buffer, &length))
+				dbus_free(buffer);
+			if (dbus_message_is_signal(m, "com.victronenergy.BusItem", "ItemsChanged")) {
+				++mItemsChangedCount;
+				mItemsChangedBytes += length;
+			} else if (dbus_message_is_signal(m, "com.victronenergy.BusItem",
+											  "PropertiesChanged")) {
+				++mPropertiesChangedCount;
+				mPropertiesChangedBytes += length;
+			}
+			dbus_message_unref(m);
+		}
+	}
+
+	void reset()
+	{
+		mItemsChangedCount = 0;
+		mItemsChangedBytes = 0;
+		mPropertiesChangedCount = 0;
+		mPropertiesChangedBytes = 0;
+	}
+
+	int itemsChangedCount() const
+	{
+		return mItemsChangedCount;
+	}
+
+	int itemsChangedBytes() const
+	{
+		return mItemsChangedBytes;
+	}
+
+	int propertiesChangedCount() const
+	{
+		return mPropertiesChangedCount;
+	}
+
+	int propertiesChangedBytes() const
+	{
+		return mPropertiesChangedBytes;
+	}
+
+private:
+	DBusConnection *mConnection;
+	int mItemsChangedCount;
+	int mItemsChangedBytes;
+	int mPropertiesChangedCount;
+	int mPropertiesChangedBytes;
+};
+
+/*!
+ * Benchmarks of `DBusBridge`, publishing the values of `Source` objects as
+ * items of a `BridgeItemProducer`.
+ *
+ * Unless noted otherwise, the items are not published on a D-Bus, so the
+ * benchmarks measure the cost of the bridge and the items only. The tests on
+ * the session bus are skipped if there is none.
+ */
+class TestDBusBridgeBenchmark : public QObject
+{
+	Q_OBJECT
+public:
+	TestDBusBridgeBenchmark():
+		mProducer(0),
+		mTextProducer(0),
+		mBusProducer(0),
+		mBusTextProducer(0),
+		mBridge(0),
+		mServiceCount(0)
+	{
+	}
+
+private slots:
+	void initTestCase()
+	{
+		QsLogging::Logger::instance().setLoggingLevel(QsLogging::OffLevel);
+		mProducer = new BridgeItemProducer(VeQItems::getRoot(), "pub", this);
+		mTextProducer = new VeQItemProducer(VeQItems::getRoot(), "text", this);
+		if (!QDBusConnection::sessionBus().isConnected())
+			return;
+		mBusProducer = new BridgeItemProducer(VeQItems::getRoot(), "bus", this);
+		VeQItemDbusPublisher *publisher = new VeQItemDbusPublisher(mBusProducer->services(), this);
+		publisher->open("session");
+		mBusTextProducer = new VeQItemProducer(VeQItems::getRoot(), "bustext", this);
+		publisher = new VeQItemDbusPublisher(mBusTextProducer->services(), this);
+		publisher->open("session");
+	}
+
+	void cleanup()
+	{
+		delete mBridge;
+		mBridge = 0;
+		qDeleteAll(mSources);
+		mSources.clear();
+	}
+
+	/*!
+	 * A change which is published at the end of the publish period. The
+	 * bridge only looks up the item and marks it as changed.
+	 */
+	void propertyChange()
+	{
+		QFETCH(int, itemCount);
+		createBridge(itemCount, 1000);
+		Source *source = mSources.last();
+		double v = 0;
+		QBENCHMARK {
+			source->setValue(++v);
+		}
+	}
+
+	void propertyChange_data()
+	{
+		addItemCountData();
+	}
+
+	/// A change which is published at once.
+	void publish()
+	{
+		QFETCH(int, itemCount);
+		createBridge(itemCount, 0);
+		Source *source = mSources.last();
+		double v = 0;
+		QBENCHMARK {
+			source->setValue(++v);
+		}
+		QCOMPARE(item(itemCount - 1)->getValue().toDouble(), v);
+	}
+
+	void publish_data()
+	{
+		addItemCountData();
+	}
+
+	/// A value set on the D-Bus, which is written to the property.
+	void dbusWrite()
+	{
+		QFETCH(int, itemCount);
+		createBridge(itemCount, 1000);
+		VeQItem *busItem = item(itemCount - 1);
+		double v = 0;
+		QBENCHMARK {
+			busItem->setValue(++v);
+		}
+		QCOMPARE(mSources.last()->value(), v);
+	}
+
+	void dbusWrite_data()
+	{
+		addItemCountData();
+	}
+
+	/*!
+	 * A change which is published at once, with the text formatted on demand
+	 * (the items of a `BridgeItemProducer`), or formatted and pushed to the
+	 * item with each value (other items). On the bus, the publish includes
+	 * the ItemsChanged and PropertiesChanged signals.
+	 */
+	void publishText()
+	{
+		QFETCH(bool, lazyText);
+		QFETCH(bool, onBus);
+		if (onBus && mBusProducer == 0)
+			QSKIP("No D-Bus session bus");
+		createBridge(10, 0, producer(lazyText, onBus));
+		if (onBus)
+			QVERIFY(waitForService());
+		Source *source = mSources.last();
+		double v = 0;
+		QBENCHMARK {
+			source->setValue(++v);
+		}
+	}
+
+	void publishText_data()
+	{
+		QTest::addColumn<bool>("lazyText");
+		QTest::addColumn<bool>("onBus");
+		QTest::newRow("lazy text") << true << false;
+		QTest::newRow("pushed text") << false << false;
+		QTest::newRow("lazy text, on the bus") << true << true;
+		QTest::newRow("pushed text, on the bus") << false << true;
+	}
+
+	/// Counts the allocations of a publish, with and without lazy text.
+	void publishAllocations()
+	{
+		QFETCH(bool, onBus);
+		if (onBus && mBusProducer == 0)
+			QSKIP("No D-Bus session bus");
+		int lazy = countPublishAllocations(producer(true, onBus), false, onBus);
+		cleanup();
+		int pushed = countPublishAllocations(producer(false, onBus), false, onBus);
+		QVERIFY(lazy >= 0 && pushed >= 0);
+		qDebug("Allocations per publish: %.2f with lazy text, %.2f with pushed text",
+			   double(lazy) / Publishes, double(pushed) / Publishes);
+		QVERIFY(lazy < pushed);
+	}
+
+	void publishAllocations_data()
+	{
+		QTest::addColumn<bool>("onBus");
+		QTest::newRow("off the bus") << false;
+		QTest::newRow("on the bus") << true;
+	}
+
+	/*!
+	 * A change which is published at once, read with the meta object system
+	 * (`produce`), or with a getter (`produceDouble`).
+	 */
+	void publishDouble()
+	{
+		QFETCH(bool, typed);
+		createBridge(10, 0, 0, typed);
+		Source *source = mSources.last();
+		double v = 0;
+		QBENCHMARK {
+			source->setValue(++v);
+		}
+		QCOMPARE(item(9)->getValue().toDouble(), v);
+	}
+
+	void publishDouble_data()
+	{
+		QTest::addColumn<bool>("typed");
+		QTest::newRow("produce") << false;
+		QTest::newRow("produceDouble") << true;
+	}
+
+	/// Counts the allocations of a publish, with and without a getter.
+	void publishDoubleAllocations()
+	{
+		int generic = countPublishAllocations(mProducer);
+		cleanup();
+		int typed = countPublishAllocations(mProducer, true);
+		qDebug("Allocations per publish: %.2f with produce, %.2f with produceDouble",
+			   double(generic) / Publishes, double(typed) / Publishes);
+		QVERIFY(typed <= generic);
+	}
+
+	/*!
+	 * Publishes changes of all items on the session bus, and compares the
+	 * ItemsChanged signals with the PropertiesChanged signals of the objects.
+	 * A client handling ItemsChanged gets one signal per publish period,
+	 * instead of one per item.
+	 */
+	void itemsChanged()
+	{
+		QFETCH(int, itemCount);
+		if (mBusProducer == 0)
+			QSKIP("No D-Bus session bus");
+		createBridge(itemCount, PublishWheel::TickInterval, mBusProducer);
+		SignalCounter counter;
+		QVERIFY(counter.open(mBridge->serviceName()));
+		QVERIFY(waitForService());
+		// Skip the signals sent while registering.
+		QTest::qWait(2 * PublishWheel::TickInterval);
+		counter.poll();
+		counter.reset();
+
+		for (int r=1; r<=Rounds; ++r) {
+			foreach (Source *source, mSources)
+				source->setValue(r);
+			for (int i=0; i<500 && (counter.itemsChangedCount() < r ||
+									counter.propertiesChangedCount() < r * itemCount); ++i) {
+				QTest::qWait(10);
+				counter.poll();
+			}
+		}
+		QTest::qWait(100);
+		counter.poll();
+		qDebug("%d items, per publish period: %d ItemsChanged signal(s) of %d bytes, "
+			   "%d PropertiesChanged signal(s) of %d bytes", itemCount,
+			   counter.itemsChangedCount() / Rounds, counter.itemsChangedBytes() / Rounds,
+			   counter.propertiesChangedCount() / Rounds,
+			   counter.propertiesChangedBytes() / Rounds);
+		QCOMPARE(counter.itemsChangedCount(), Rounds);
+		QVERIFY(counter.propertiesChangedCount() >= Rounds * itemCount);
+	}
+
+	void itemsChanged_data()
+	{
+		addItemCountData();
+	}
+
+	/*!
+	 * A change within the deadband of a value published at once is published
+	 * anyway when the maximum silence has passed, although there is no publish
+	 * period and the value does not change again.
+	 */
+	void maxSilenceImmediately()
+	{
+		createBridge(1, 0);
+		mBridge->setDeadband("/Value/0", 1, 0, 300);
+		Source *source = mSources.last();
+		source->setValue(10);
+		QCOMPARE(item(0)->getValue().toDouble(), 10.0);
+		source->setValue(10.5);
+		QCOMPARE(item(0)->getValue().toDouble(), 10.0);
+		QCOMPARE(mBridge->suppressedUpdates(), 1);
+		QTRY_COMPARE(item(0)->getValue().toDouble(), 10.5);
+	}
+
+private:
+	/*!
+	 * Creates a bridge publishing the value of `itemCount` new sources, at
+	 * /Value/0 and up, in a service of its own. The items are created by
+	 * `producer` (`mProducer` if 0). If `typed` is set, the values are
+	 * connected with `produceDouble`.
+	 */
+	void createBridge(int itemCount, int updateInterval, VeQItemProducer *producer = 0,
+					  bool typed = false)
+	{
+		if (producer == 0)
+			producer = mProducer;
+		VeQItem *root = producer->services()->itemGetOrCreate(
+			QString("com.victronenergy.benchmark_%1").arg(++mServiceCount));
+		mBridge = new DBusBridge(root, true);
+		mBridge->setUpdateInterval(updateInterval);
+		for (int i=0; i<itemCount; ++i) {
+			Source *source = new Source();
+			QString path = QString("/Value/%1").arg(i);
+			if (typed)
+				mBridge->produceDouble(source, "value",
+									   &dbusDoubleGetter<Source, &Source::value>, path);
+			else
+				mBridge->produce(source, "value", path);
+			mSources.append(source);
+		}
+		mBridge->registerService();
+	}
+
+	/*!
+	 * Returns the number of allocations of `Publishes` immediate publishes, or
+	 * -1 if the service could not be registered on the bus.
+	 */
+	int countPublishAllocations(VeQItemProducer *producer, bool typed = false,
+								bool onBus = false)
+	{
+		createBridge(10, 0, producer, typed);
+		if (onBus && !waitForService())
+			return -1;
+		Source *source = mSources.last();
+		// Warm up.
+		source->setValue(-1);
+		startCounting();
+		for (int i=0; i<Publishes; ++i)
+			source->setValue(i);
+		return stopCounting();
+	}
+
+	/*!
+	 * Returns the producer of items with lazy text (`BridgeItem`) or pushed
+	 * text, whose items are published on the session bus if `onBus` is set.
+	 */
+	VeQItemProducer *producer(bool lazyText, bool onBus) const
+	{
+		if (onBus)
+			return lazyText ? static_cast<VeQItemProducer *>(mBusProducer) : mBusTextProducer;
+		return lazyText ? static_cast<VeQItemProducer *>(mProducer) : mTextProducer;
+	}
+
+	/// Waits until the service of `mBridge` has been registered on the bus.
+	bool waitForService()
+	{
+		QDBusConnectionInterface *bus = QDBusConnection::sessionBus().interface();
+		for (int i=0; i<500 && !bus->isServiceRegistered(mBridge->serviceName()); ++i)
+			QTest::qWait(10);
+		return bus->isServiceRegistered(mBridge->serviceName());
+	}
+
+	VeQItem *item(int index) const
+	{
+		return mBridge->service()->itemGetOrCreate(QString("/Value/%1").arg(index));
+	}
+
+	/// The cost of all benchmarks should not depend on the number of items.
+	static void addItemCountData()
+	{
+		QTest::addColumn<int>("itemCount");
+		QTest::newRow("10 items") << 10;
+		QTest::newRow("100 items") << 100;
+		QTest::newRow("1000 items") << 1000;
+	}
+
+	BridgeItemProducer *mProducer;
+	/// Creates plain `VeQItem`s, which get their text pushed by the bridge.
+	VeQItemProducer *mTextProducer;
+	/// Producers of items published on the session bus, 0 if there is none.
+	BridgeItemProducer *mBusProducer;
+	VeQItemProducer *mBusTextProducer;
+	DBusBridge *mBridge;
+	QList<Source *> mSources;
+	int mServiceCount;
+};
+
+QTEST_GUILESS_MAIN(TestDBusBridgeBenchmark)
+
+#include "test_dbus_bridge_benchmark.moc"
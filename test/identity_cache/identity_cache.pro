@@ -0,0 +1,2 @@
+SCRIPT = test_identity_cache.sh
+include(../common/script_test.pri)
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Reports the time to the first sample without and with the identity cache.
+#
+# The energy meter is simulated with tools/meter_simulator, with the response
+# time of a zigbee link. dbus-cgwacs is started twice with the same
+# --identity-cache file. The first run starts with an empty cache, so the
+# meter is detected as without the cache, and the identity is stored. The
+# second run verifies the cached identity. Both runs log the time from the
+# start of detection to the first complete measurement, and the second run
+# must be faster.
+#
+# See test/common/script_test.sh for the environment the test needs. Set
+# LATENCY to change the response time of the simulated meter (default: 300 ms).
+
+. "$(dirname "$0")/../common/script_test.sh"
+
+LATENCY=${LATENCY:-300}
+CACHE=$WORK/identity.ini
+
+# Starts the simulator and dbus-cgwacs, and stores the time to the first
+# sample in ms in FIRST_SAMPLE.
+measure_first_sample() {
+	start_simulator --latency "$LATENCY" --jitter $((LATENCY / 10))
+	"$DBUS_CGWACS" --dbus "$DBUS_ADDRESS" --zigbee --identity-cache "$CACHE" \
+		"$LINK" >"$LOG" 2>&1 &
+	CGWACS_PID=$!
+	wait_for_log "First measurement" 60 || fail "no measurement from the energy meter"
+	FIRST_SAMPLE=$(sed -n 's/.*completed \([0-9]*\) ms after detection started.*/\1/p' \
+		"$LOG" | head -n 1)
+	# The identity is stored right after the first measurement.
+	sleep 1
+	stop
+	[ -n "$FIRST_SAMPLE" ] || fail "time to first sample not logged"
+}
+
+check_environment
+
+measure_first_sample
+COLD=$FIRST_SAMPLE
+grep -q "Serial" "$CACHE" 2>/dev/null || fail "identity not stored in the cache"
+measure_first_sample
+WARM=$FIRST_SAMPLE
+grep -q "from cache" "$LOG" || fail "identity cache not used"
+echo "Time to first sample at $LATENCY ms latency: $COLD ms without cache," \
+	"$WARM ms with cache"
+[ "$WARM" -lt "$COLD" ] || fail "the identity cache did not speed up detection"
+echo "PASS"
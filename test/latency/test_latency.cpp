@@ -0,0 +1,94 @@
+#include <QsLog.h>
+#include <QtTest>
+#include <velib/qt/ve_qitem.hpp>
+#include "ac_sensor.h"
+#include "ac_sensor_bridge.h"
+#include "ac_sensor_receiver.h"
+#include "ac_sensor_settings.h"
+#include "ac_sensor_updater.h"
+#include "dbus_bridge.h"
+#include "defines.h"
+#include "fake_transport.h"
+#include "modbus_rtu.h"
+#include "register_maps.h"
+#include "simulated_meter.h"
+
+static const int SlaveAddress = 1;
+/// Response time of the simulated meter (ms).
+static const int ResponseTime = 100;
+static const int Responses = 100;
+
+/*!
+ * Checks the latency published for the values of a grid meter in low latency
+ * mode, where the power is published as soon as it has been received.
+ *
+ * The meter is simulated with a `FakeTransport`, which is answered
+ * `ResponseTime` ms after each request. The power is requested again as soon
+ * as the previous read has completed, so each power value is `ResponseTime`
+ * ms old when it is published.
+ */
+class TestLatency : public QObject
+{
+	Q_OBJECT
+private slots:
+	void initTestCase()
+	{
+		QsLogging::Logger::instance().setLoggingLevel(QsLogging::OffLevel);
+		qRegisterMetaType<ConnectionState>();
+		QVERIFY(RegisterMaps::load(":/register_maps.xml"));
+		new BridgeItemProducer(VeQItems::getRoot(), "pub", this);
+	}
+
+	void immediatelyPublished()
+	{
+		SimulatedMeter meter(SimulatedMeter::Em24, SlaveAddress, "SIMEM24001");
+		FakeTransport *transport = new FakeTransport(&meter);
+		ModbusTimeouts timeouts;
+		timeouts.initial = 10 * ResponseTime;
+		timeouts.minimum = 10 * ResponseTime;
+		timeouts.maximum = 10 * ResponseTime;
+		timeouts.probe = 10 * ResponseTime;
+		ModbusRtu modbus(transport, timeouts);
+		AcSensor sensor("test", SlaveAddress);
+		AcSensor pvSensor("test", SlaveAddress);
+		AcSensorUpdater updater("test", SlaveAddress, &modbus, false);
+		AcSensorReceiver receiver(&sensor, &pvSensor, &updater);
+		updater.start();
+		for (int i=0; i<20 && transport->respond(); ++i)
+			;
+		QCOMPARE(sensor.connectionState(), Detected);
+
+		AcSensorSettings *settings = receiver.settings();
+		QVERIFY(settings != 0);
+		settings->setIsMultiPhase(true);
+		settings->setServiceType("grid");
+		settings->setLowLatency(true);
+		// Publish every change.
+		settings->setPowerDeadband(0);
+		AcSensorBridge bridge(&sensor, settings, false);
+		receiver.startMeasurements();
+		QCoreApplication::sendPostedEvents(&updater, QEvent::MetaCall);
+
+		for (int i=0; i<Responses; ++i) {
+			QTest::qWait(ResponseTime);
+			transport->respond();
+		}
+		QCOMPARE(sensor.connectionState(), Connected);
+
+		// The percentiles are recomputed every 10 seconds, and published with
+		// the update interval.
+		QMetaObject::invokeMethod(&bridge, "onUpdateLatency");
+		VeQItem *p50 = bridge.service()->itemGetOrCreate("/Mgmt/Latency/Ac/Power/P50");
+		VeQItem *p99 = bridge.service()->itemGetOrCreate("/Mgmt/Latency/Ac/Power/P99");
+		QTRY_VERIFY(p99->getValue().isValid());
+		// The percentiles are the upper bound of a histogram bucket. Had the
+		// request time of the previous sample been used, the latency would be
+		// twice the response time.
+		QVERIFY(p50->getValue().toDouble() >= ResponseTime);
+		QVERIFY(p99->getValue().toDouble() < 1.5 * ResponseTime);
+	}
+};
+
+QTEST_GUILESS_MAIN(TestLatency)
+
+#include "test_latency.moc"
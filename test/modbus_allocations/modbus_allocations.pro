@@ -0,0 +1,67 @@
+QT += core network testlib xml
+QT -= gui
+
+TARGET = test_modbus_allocations
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+MOC_DIR=.moc
+OBJECTS_DIR=.obj
+
+include(../../software/ext/qslog/QsLog.pri)
+
+INCLUDEPATH += \
+    ../common \
+    ../../software/ext/qslog \
+    ../../software/ext/velib/inc \
+    ../../software/ext/velib/inc/velib/platform \
+    ../../software/src \
+    ../../tools/meter_simulator/src
+
+# Modbus::create needs the serial and TCP transports, even though the test
+# uses its own transport.
+SOURCES += \
+    ../common/allocation_counter.cpp \
+    ../common/fake_transport.cpp \
+    ../../software/ext/velib/src/plt/serial.c \
+    ../../software/ext/velib/src/plt/posix_serial.c \
+    ../../software/ext/velib/src/plt/posix_ctx.c \
+    ../../software/src/ac_sensor.cpp \
+    ../../software/src/ac_sensor_phase.cpp \
+    ../../software/src/ac_sensor_updater.cpp \
+    ../../software/src/crc16.cpp \
+    ../../software/src/identity_cache.cpp \
+    ../../software/src/latency_statistics.cpp \
+    ../../software/src/modbus.cpp \
+    ../../software/src/modbus_rtu.cpp \
+    ../../software/src/modbus_tcp.cpp \
+    ../../software/src/register_maps.cpp \
+    ../../software/src/serial_transport.cpp \
+    ../../software/src/tcp_transport.cpp \
+    ../../tools/meter_simulator/src/simulated_meter.cpp \
+    test_modbus_allocations.cpp
+
+HEADERS += \
+    ../common/allocation_counter.h \
+    ../common/fake_transport.h \
+    ../../software/src/ac_sensor.h \
+    ../../software/src/ac_sensor_phase.h \
+    ../../software/src/ac_sensor_updater.h \
+    ../../software/src/crc16.h \
+    ../../software/src/defines.h \
+    ../../software/src/identity_cache.h \
+    ../../software/src/latency_statistics.h \
+    ../../software/src/modbus.h \
+    ../../software/src/modbus_rtu.h \
+    ../../software/src/modbus_tcp.h \
+    ../../software/src/modbus_transport.h \
+    ../../software/src/register_maps.h \
+    ../../software/src/serial_transport.h \
+    ../../software/src/spsc_queue.h \
+    ../../software/src/tcp_transport.h \
+    ../../tools/meter_simulator/src/simulated_meter.h
+
+RESOURCES += \
+    ../../software/register_maps.qrc
@@ -0,0 +1,301 @@
+#include <QsLog.h>
+#include <QtTest>
+#include "ac_sensor_updater.h"
+#include "allocation_counter.h"
+#include "defines.h"
+#include "fake_transport.h"
+#include "modbus_rtu.h"
+#include "register_maps.h"
+#include "simulated_meter.h"
+
+/// Number of transactions measured, after the warm up.
+static const int Transactions = 1000;
+static const int SlaveAddress = 1;
+
+/*!
+ * Sends a new read request as soon as the previous one has completed, like
+ * the acquisition of an `AcSensorUpdater` in low latency mode.
+ */
+class RepeatingReader : public ModbusListener
+{
+public:
+	RepeatingReader(Modbus *modbus):
+		mModbus(modbus),
+		mReadCount(0),
+		mErrorCount(0)
+	{
+		mModbus->setListener(SlaveAddress, this);
+	}
+
+	~RepeatingReader()
+	{
+		mModbus->setListener(SlaveAddress, 0);
+	}
+
+	void read()
+	{
+		// Power of all phases on an EM24.
+		mModbus->readRegisters(Modbus::ReadHoldingRegisters, SlaveAddress, 0x0012, 6,
+							   Modbus::HighPriority);
+	}
+
+	int readCount() const
+	{
+		return mReadCount;
+	}
+
+	int errorCount() const
+	{
+		return mErrorCount;
+	}
+
+	virtual void onReadCompleted(int function, const RegisterView &registers)
+	{
+		Q_UNUSED(function)
+		if (registers.size() == 6)
+			++mReadCount;
+		read();
+	}
+
+	virtual void onWriteCompleted(int function, quint16 address, quint16 value)
+	{
+		Q_UNUSED(function)
+		Q_UNUSED(address)
+		Q_UNUSED(value)
+	}
+
+	virtual void onErrorReceived(int errorType, int exception)
+	{
+		Q_UNUSED(errorType)
+		Q_UNUSED(exception)
+		++mErrorCount;
+	}
+
+private:
+	Modbus *mModbus;
+	int mReadCount;
+	int mErrorCount;
+};
+
+/*!
+ * Takes the measured values from an `AcSensorUpdater`, like the
+ * `AcSensorReceiver` does, and keeps track of its connection state.
+ */
+class UpdaterMonitor : public QObject
+{
+	Q_OBJECT
+public:
+	UpdaterMonitor(AcSensorUpdater *updater, QObject *parent = 0):
+		QObject(parent),
+		mUpdater(updater),
+		mConnectionState(Disconnected),
+		mNotificationCount(0),
+		mSampleCount(0)
+	{
+		connect(updater, SIGNAL(measurementsAvailable()),
+				this, SLOT(onMeasurementsAvailable()), Qt::QueuedConnection);
+		connect(updater, SIGNAL(connectionStateChanged(ConnectionState)),
+				this, SLOT(onConnectionStateChanged(ConnectionState)));
+	}
+
+	ConnectionState connectionState() const
+	{
+		return mConnectionState;
+	}
+
+	int notificationCount() const
+	{
+		return mNotificationCount;
+	}
+
+	int sampleCount() const
+	{
+		return mSampleCount;
+	}
+
+private slots:
+	void onMeasurementsAvailable()
+	{
+		++mNotificationCount;
+		mUpdater->clearMeasurementsPending();
+		MeasurementSample sample;
+		while (mUpdater->measurements()->pop(sample))
+			++mSampleCount;
+	}
+
+	void onConnectionStateChanged(ConnectionState state)
+	{
+		mConnectionState = state;
+	}
+
+private:
+	AcSensorUpdater *mUpdater;
+	ConnectionState mConnectionState;
+	int mNotificationCount;
+	int mSampleCount;
+};
+
+/// Used to measure the allocations of a queued signal.
+class Notifier : public QObject
+{
+	Q_OBJECT
+public:
+	void notify()
+	{
+		emit notified();
+	}
+
+signals:
+	void notified();
+
+public slots:
+	void onNotified()
+	{
+	}
+};
+
+/*!
+ * Counts the heap allocations done by the modbus code and the acquisition of
+ * an `AcSensorUpdater` once they have reached a steady state.
+ *
+ * The only allocations expected are done by Qt: starting the response timer
+ * of each request, and posting the `measurementsAvailable` signal to the
+ * receiving thread. Their cost is measured separately, so the tests do not
+ * depend on the Qt version.
+ */
+class TestModbusAllocations : public QObject
+{
+	Q_OBJECT
+private slots:
+	void initTestCase()
+	{
+		QsLogging::Logger::instance().setLoggingLevel(QsLogging::OffLevel);
+		qRegisterMetaType<ConnectionState>();
+		QVERIFY(RegisterMaps::load(":/register_maps.xml"));
+	}
+
+	void modbusTransactions()
+	{
+		SimulatedMeter meter(SimulatedMeter::Em24, SlaveAddress, "SIMEM24001");
+		FakeTransport *transport = new FakeTransport(&meter);
+		ModbusRtu modbus(transport, timeouts());
+		RepeatingReader reader(&modbus);
+		reader.read();
+		// Warm up, so the buffers of the request queue are allocated.
+		for (int i=0; i<10; ++i)
+			QVERIFY(transport->respond());
+
+		startCounting();
+		for (int i=0; i<Transactions; ++i)
+			transport->respond();
+		int allocations = stopCounting();
+
+		QCOMPARE(reader.readCount(), Transactions + 10);
+		QCOMPARE(reader.errorCount(), 0);
+		QCOMPARE(allocations, timerAllocations(Transactions));
+	}
+
+	void acquisition()
+	{
+		SimulatedMeter meter(SimulatedMeter::Em24, SlaveAddress, "SIMEM24001");
+		FakeTransport *transport = new FakeTransport(&meter);
+		ModbusRtu modbus(transport, timeouts());
+		AcSensorUpdater updater("test", SlaveAddress, &modbus, false);
+		UpdaterMonitor monitor(&updater);
+		// Power reads are sent back to back in low latency mode, so the
+		// acquisition timer is not used.
+		updater.setGridMeter(true);
+		updater.setLowLatency(true);
+		updater.start();
+		respondAll(transport, 20);
+		QCOMPARE(monitor.connectionState(), Detected);
+		updater.startMeasurements(true, false);
+		// Setup of the meter, and the first read of all values.
+		for (int i=0; i<50 && monitor.connectionState() != Connected; ++i) {
+			QVERIFY(transport->respond());
+			QCoreApplication::sendPostedEvents(&monitor, QEvent::MetaCall);
+		}
+		QCOMPARE(monitor.connectionState(), Connected);
+		for (int i=0; i<10; ++i) {
+			QVERIFY(transport->respond());
+			QCoreApplication::sendPostedEvents(&monitor, QEvent::MetaCall);
+		}
+		int notificationCount = monitor.notificationCount();
+		int sampleCount = monitor.sampleCount();
+
+		startCounting();
+		for (int i=0; i<Transactions; ++i) {
+			transport->respond();
+			QCoreApplication::sendPostedEvents(&monitor, QEvent::MetaCall);
+		}
+		int allocations = stopCounting();
+
+		QCOMPARE(monitor.connectionState(), Connected);
+		// Each response yields values, which are passed through the queue
+		// and announced with a single queued signal.
+		QCOMPARE(monitor.notificationCount() - notificationCount, Transactions);
+		QVERIFY(monitor.sampleCount() - sampleCount >= Transactions);
+		QCOMPARE(allocations, timerAllocations(Transactions) +
+				 queuedSignalAllocations(Transactions));
+	}
+
+private:
+	static ModbusTimeouts timeouts()
+	{
+		ModbusTimeouts t;
+		t.initial = 250;
+		t.minimum = 100;
+		t.maximum = 1000;
+		t.probe = 100;
+		return t;
+	}
+
+	/// Sends responses until no request is pending (at most `maxCount`).
+	static void respondAll(FakeTransport *transport, int maxCount)
+	{
+		for (int i=0; i<maxCount && transport->respond(); ++i)
+			;
+	}
+
+	/*!
+	 * Returns the number of allocations Qt needs to start and stop a single
+	 * shot timer `count` times. `ModbusRtu` starts its response timer for
+	 * each request.
+	 */
+	static int timerAllocations(int count)
+	{
+		QTimer timer;
+		timer.setSingleShot(true);
+		timer.start(1000);
+		timer.stop();
+		startCounting();
+		for (int i=0; i<count; ++i) {
+			timer.start(1000);
+			timer.stop();
+		}
+		return stopCounting();
+	}
+
+	/*!
+	 * Returns the number of allocations Qt needs to emit and deliver a queued
+	 * signal `count` times.
+	 */
+	static int queuedSignalAllocations(int count)
+	{
+		Notifier notifier;
+		connect(&notifier, SIGNAL(notified()), &notifier, SLOT(onNotified()),
+				Qt::QueuedConnection);
+		notifier.notify();
+		QCoreApplication::sendPostedEvents(&notifier, QEvent::MetaCall);
+		startCounting();
+		for (int i=0; i<count; ++i) {
+			notifier.notify();
+			QCoreApplication::sendPostedEvents(&notifier, QEvent::MetaCall);
+		}
+		return stopCounting();
+	}
+};
+
+QTEST_GUILESS_MAIN(TestModbusAllocations)
+
+#include "test_modbus_allocations.moc"
@@ -0,0 +1,43 @@
+QT += core network testlib
+QT -= gui
+
+TARGET = test_modbus_tcp
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+MOC_DIR=.moc
+OBJECTS_DIR=.obj
+
+include(../../software/ext/qslog/QsLog.pri)
+
+INCLUDEPATH += \
+    ../../software/ext/qslog \
+    ../../software/ext/velib/inc \
+    ../../software/ext/velib/inc/velib/platform \
+    ../../software/src
+
+# Modbus::create needs the serial transport, even though the test only uses
+# TCP.
+SOURCES += \
+    ../../software/ext/velib/src/plt/serial.c \
+    ../../software/ext/velib/src/plt/posix_serial.c \
+    ../../software/ext/velib/src/plt/posix_ctx.c \
+    ../../software/src/crc16.cpp \
+    ../../software/src/modbus.cpp \
+    ../../software/src/modbus_rtu.cpp \
+    ../../software/src/modbus_tcp.cpp \
+    ../../software/src/serial_transport.cpp \
+    ../../software/src/tcp_transport.cpp \
+    test_modbus_tcp.cpp
+
+HEADERS += \
+    ../../software/src/crc16.h \
+    ../../software/src/defines.h \
+    ../../software/src/modbus.h \
+    ../../software/src/modbus_rtu.h \
+    ../../software/src/modbus_tcp.h \
+    ../../software/src/modbus_transport.h \
+    ../../software/src/serial_transport.h \
+    ../../software/src/tcp_transport.h
@@ -0,0 +1,306 @@
+#include <QsLog.h>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QtTest>
+#include "defines.h"
+#include "modbus.h"
+
+/// Size of a read request: MBAP header, function code, register and count.
+static const int RequestSize = 12;
+static const int SlaveCount = 6;
+
+/*!
+ * A request as received by the test server.
+ */
+struct TcpRequest {
+	quint16 id;
+	quint16 protocolId;
+	quint16 length;
+	quint8 unitId;
+	quint8 function;
+	quint16 reg;
+	quint16 count;
+};
+
+/*!
+ * Stores the register values of all read responses received for a single
+ * slave.
+ */
+class ReadRecorder : public ModbusListener
+{
+public:
+	ReadRecorder():
+		mErrorCount(0),
+		mLastErrorType(-1)
+	{
+	}
+
+	QList<QVector<quint16> > reads() const
+	{
+		return mReads;
+	}
+
+	int errorCount() const
+	{
+		return mErrorCount;
+	}
+
+	int lastErrorType() const
+	{
+		return mLastErrorType;
+	}
+
+	virtual void onReadCompleted(int function, const RegisterView &registers)
+	{
+		Q_UNUSED(function)
+		QVector<quint16> values;
+		for (int i=0; i<registers.size(); ++i)
+			values.append(registers[i]);
+		mReads.append(values);
+	}
+
+	virtual void onWriteCompleted(int function, quint16 address, quint16 value)
+	{
+		Q_UNUSED(function)
+		Q_UNUSED(address)
+		Q_UNUSED(value)
+	}
+
+	virtual void onErrorReceived(int errorType, int exception)
+	{
+		Q_UNUSED(exception)
+		++mErrorCount;
+		mLastErrorType = errorType;
+	}
+
+private:
+	QList<QVector<quint16> > mReads;
+	int mErrorCount;
+	int mLastErrorType;
+};
+
+/*!
+ * Tests `ModbusTcp` (created with a tcp:// port name) against a `QTcpServer`
+ * playing the part of a Modbus TCP device or gateway.
+ *
+ * The server answers read requests with the register addresses as values, so
+ * the test can tell which request a response belongs to.
+ */
+class TestModbusTcp : public QObject
+{
+	Q_OBJECT
+public:
+	TestModbusTcp():
+		mSocket(0),
+		mModbus(0)
+	{
+	}
+
+private slots:
+	void initTestCase()
+	{
+		QsLogging::Logger::instance().setLoggingLevel(QsLogging::OffLevel);
+	}
+
+	void init()
+	{
+		QVERIFY(mServer.listen(QHostAddress::LocalHost));
+		ModbusTimeouts timeouts;
+		// Long enough for the requests never to time out during the test.
+		timeouts.initial = 10000;
+		timeouts.minimum = 10000;
+		timeouts.maximum = 10000;
+		timeouts.probe = 10000;
+		mModbus = Modbus::create(QString("tcp://127.0.0.1:%1").arg(mServer.serverPort()),
+								 timeouts);
+		for (int i=0; i<SlaveCount; ++i)
+			mModbus->setListener(slaveAddress(i), &mRecorders[i]);
+		QTRY_VERIFY(mServer.hasPendingConnections());
+		mSocket = mServer.nextPendingConnection();
+		QVERIFY(mSocket != 0);
+	}
+
+	void cleanup()
+	{
+		delete mModbus;
+		mModbus = 0;
+		delete mSocket;
+		mSocket = 0;
+		mServer.close();
+		for (int i=0; i<SlaveCount; ++i)
+			mRecorders[i] = ReadRecorder();
+	}
+
+	void mbapFraming()
+	{
+		read(0, 0x0012, 6);
+		read(1, 0x0034, 2);
+		QList<TcpRequest> requests = receiveRequests(2);
+		QCOMPARE(requests.size(), 2);
+		for (int i=0; i<requests.size(); ++i) {
+			const TcpRequest &r = requests[i];
+			QCOMPARE(r.protocolId, quint16(0));
+			// Unit identifier, function code, register and count.
+			QCOMPARE(r.length, quint16(6));
+			QCOMPARE(r.function, quint8(Modbus::ReadHoldingRegisters));
+		}
+		QCOMPARE(requests[0].unitId, slaveAddress(0));
+		QCOMPARE(requests[0].reg, quint16(0x0012));
+		QCOMPARE(requests[0].count, quint16(6));
+		QCOMPARE(requests[1].unitId, slaveAddress(1));
+		QCOMPARE(requests[1].reg, quint16(0x0034));
+		QCOMPARE(requests[1].count, quint16(2));
+		QVERIFY(requests[0].id != requests[1].id);
+
+		// A response split over single byte segments, followed by a whole
+		// response.
+		QByteArray response = createResponse(requests[0]);
+		for (int i=0; i<response.size(); ++i)
+			send(response.mid(i, 1));
+		send(createResponse(requests[1]));
+		QTRY_COMPARE(mRecorders[1].reads().size(), 1);
+		checkReads(0, 0x0012, 6);
+		checkReads(1, 0x0034, 2);
+	}
+
+	void transactionIdMatching()
+	{
+		read(0, 0x0100, 2);
+		QList<TcpRequest> requests = receiveRequests(1);
+		QCOMPARE(requests.size(), 1);
+		// A response to a request which is not active (eg. one which has
+		// timed out) must be ignored.
+		TcpRequest unknown = requests[0];
+		unknown.id = static_cast<quint16>(unknown.id + 100);
+		send(createResponse(unknown) + createResponse(requests[0]));
+		QTRY_COMPARE(mRecorders[0].reads().size(), 1);
+		QTest::qWait(50);
+		QCOMPARE(mRecorders[0].reads().size(), 1);
+		QCOMPARE(mRecorders[0].errorCount(), 0);
+		checkReads(0, 0x0100, 2);
+	}
+
+	void functionMismatch()
+	{
+		read(0, 0x0200, 2);
+		QList<TcpRequest> requests = receiveRequests(1);
+		QCOMPARE(requests.size(), 1);
+		// A response with the right transaction ID, but to another function,
+		// is a protocol error and not a read.
+		TcpRequest other = requests[0];
+		other.function = Modbus::ReadInputRegisters;
+		send(createResponse(other));
+		QTRY_COMPARE(mRecorders[0].errorCount(), 1);
+		QCOMPARE(mRecorders[0].lastErrorType(), int(Modbus::ProtocolError));
+		QCOMPARE(mRecorders[0].reads().size(), 0);
+	}
+
+	void outOfOrderResponses()
+	{
+		for (int i=0; i<SlaveCount; ++i)
+			read(i, static_cast<quint16>(0x0100 * (i + 1)), 2);
+		// At most 4 requests may be outstanding.
+		QList<TcpRequest> requests = receiveRequests(4);
+		QCOMPARE(requests.size(), 4);
+		QTest::qWait(50);
+		QCOMPARE(mSocket->bytesAvailable(), Q_INT64_C(0));
+
+		// Answer in reverse order. The last 2 responses are sent at once.
+		send(createResponse(requests[3]));
+		QTRY_COMPARE(mSocket->bytesAvailable(), qint64(RequestSize));
+		send(createResponse(requests[2]));
+		send(createResponse(requests[1]) + createResponse(requests[0]));
+		requests = receiveRequests(SlaveCount - 4);
+		QCOMPARE(requests.size(), SlaveCount - 4);
+		send(createResponse(requests[1]) + createResponse(requests[0]));
+
+		for (int i=0; i<SlaveCount; ++i) {
+			QTRY_COMPARE(mRecorders[i].reads().size(), 1);
+			checkReads(i, static_cast<quint16>(0x0100 * (i + 1)), 2);
+		}
+	}
+
+private:
+	static quint8 slaveAddress(int index)
+	{
+		return static_cast<quint8>(index + 1);
+	}
+
+	void read(int index, quint16 reg, quint16 count)
+	{
+		mModbus->readRegisters(Modbus::ReadHoldingRegisters, slaveAddress(index), reg, count);
+	}
+
+	/*!
+	 * Waits until `count` requests have been received. Returns the requests
+	 * received, which may be less than `count` after a timeout.
+	 */
+	QList<TcpRequest> receiveRequests(int count)
+	{
+		QList<TcpRequest> requests;
+		for (int i=0; i<500 && mSocket->bytesAvailable() < count * RequestSize; ++i)
+			QTest::qWait(10);
+		while (requests.size() < count && mSocket->bytesAvailable() >= RequestSize) {
+			QByteArray f = mSocket->read(RequestSize);
+			TcpRequest r;
+			r.id = toUInt16(f, 0);
+			r.protocolId = toUInt16(f, 2);
+			r.length = toUInt16(f, 4);
+			r.unitId = static_cast<quint8>(f[6]);
+			r.function = static_cast<quint8>(f[7]);
+			r.reg = toUInt16(f, 8);
+			r.count = toUInt16(f, 10);
+			requests.append(r);
+		}
+		return requests;
+	}
+
+	/// Returns a response with the register addresses as values.
+	static QByteArray createResponse(const TcpRequest &request)
+	{
+		QByteArray f;
+		int length = 3 + 2 * request.count;
+		f.append(static_cast<char>(msb(request.id)));
+		f.append(static_cast<char>(lsb(request.id)));
+		f.append('\0');
+		f.append('\0');
+		f.append(static_cast<char>(msb(length)));
+		f.append(static_cast<char>(lsb(length)));
+		f.append(static_cast<char>(request.unitId));
+		f.append(static_cast<char>(request.function));
+		f.append(static_cast<char>(2 * request.count));
+		for (int i=0; i<request.count; ++i) {
+			quint16 value = static_cast<quint16>(request.reg + i);
+			f.append(static_cast<char>(msb(value)));
+			f.append(static_cast<char>(lsb(value)));
+		}
+		return f;
+	}
+
+	void send(const QByteArray &data)
+	{
+		mSocket->write(data);
+		mSocket->flush();
+		// Give the client a chance to receive each write as a separate segment.
+		QTest::qWait(5);
+	}
+
+	void checkReads(int index, quint16 reg, int count)
+	{
+		QList<QVector<quint16> > reads = mRecorders[index].reads();
+		QCOMPARE(reads.size(), 1);
+		QCOMPARE(reads[0].size(), count);
+		for (int i=0; i<count; ++i)
+			QCOMPARE(reads[0][i], static_cast<quint16>(reg + i));
+		QCOMPARE(mRecorders[index].errorCount(), 0);
+	}
+
+	QTcpServer mServer;
+	QTcpSocket *mSocket;
+	Modbus *mModbus;
+	ReadRecorder mRecorders[SlaveCount];
+};
+
+QTEST_GUILESS_MAIN(TestModbusTcp)
+
+#include "test_modbus_tcp.moc"
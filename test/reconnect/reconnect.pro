@@ -0,0 +1,2 @@
+SCRIPT = test_reconnect.sh
+include(../common/script_test.pri)
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Checks that dbus-cgwacs recovers from a lost serial port without restarting.
+#
+# The energy meter is simulated with tools/meter_simulator. The simulator is
+# stopped for a while, which makes the pseudo terminal disappear, and started
+# again on the same link. dbus-cgwacs (with --keep-running) must publish the
+# meter again within the backoff bound: the port is retried after 1, 2, 4, ...
+# seconds, so the first retry after the port is back happens within
+# 2 * DOWNTIME + 1 second. Detection of the meter may take DETECTION ms more.
+#
+# See test/common/script_test.sh for the environment the test needs.
+
+. "$(dirname "$0")/../common/script_test.sh"
+
+DOWNTIME=3000
+MIN_RETRY_INTERVAL=1000
+DETECTION=5000
+BOUND=$((2 * DOWNTIME + MIN_RETRY_INTERVAL + DETECTION))
+
+check_environment
+
+start_simulator
+"$DBUS_CGWACS" --dbus "$DBUS_ADDRESS" --keep-running "$LINK" >"$LOG" 2>&1 &
+CGWACS_PID=$!
+wait_for_log "Device found" 30 || fail "energy meter not found"
+
+kill "$SIM_PID"
+wait "$SIM_PID" 2>/dev/null
+SIM_PID=
+wait_for_log "Retrying port" 10 || fail "lost port not detected"
+sleep $((DOWNTIME / 1000))
+start_simulator
+
+wait_for_log "recovered after" $((BOUND / 1000 + 5)) || fail "port did not recover"
+kill -0 "$CGWACS_PID" 2>/dev/null || fail "dbus-cgwacs terminated"
+RECOVERY=$(sed -n 's/.*recovered after \([0-9]*\) ms.*/\1/p' "$LOG" | head -n 1)
+echo "Recovered after $RECOVERY ms (bound $BOUND ms)"
+[ "$RECOVERY" -le "$BOUND" ] || fail "recovery took longer than $BOUND ms"
+echo "PASS"
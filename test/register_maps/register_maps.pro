@@ -0,0 +1,35 @@
+QT += core testlib xml
+QT -= gui
+
+TARGET = test_register_maps
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+MOC_DIR=.moc
+OBJECTS_DIR=.obj
+
+include(../../software/ext/qslog/QsLog.pri)
+
+INCLUDEPATH += \
+    ../../software/ext/qslog \
+    ../../software/src
+
+# Run the test as part of the build, so a malformed register_maps.xml breaks
+# the build instead of the acquisition at runtime. A cross compiled test
+# cannot run on the build host.
+!cross_compile: QMAKE_POST_LINK = ./$$TARGET
+
+SOURCES += \
+    ../../software/src/register_maps.cpp \
+    test_register_maps.cpp
+
+HEADERS += \
+    ../../software/src/ac_sensor.h \
+    ../../software/src/defines.h \
+    ../../software/src/modbus.h \
+    ../../software/src/register_maps.h
+
+RESOURCES += \
+    ../../software/register_maps.qrc
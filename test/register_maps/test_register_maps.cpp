@@ -0,0 +1,99 @@
+#include <QTemporaryFile>
+#include <QtTest>
+#include "modbus.h"
+#include "register_maps.h"
+
+Q_DECLARE_METATYPE(MeasuringSystem)
+
+/*!
+ * Loads the register maps compiled into dbus-cgwacs, and checks that every
+ * supported meter has a map for each way it can be wired.
+ */
+class TestRegisterMaps : public QObject
+{
+	Q_OBJECT
+private slots:
+	void initTestCase()
+	{
+		QVERIFY(RegisterMaps::load(":/register_maps.xml"));
+	}
+
+	void shippedMaps_data()
+	{
+		QTest::addColumn<int>("deviceType");
+		QTest::addColumn<MeasuringSystem>("system");
+		QTest::addColumn<int>("protocol");
+
+		QTest::newRow("EM24, multi phase") << 71 << MultiPhaseSystem << int(AcSensor::Em24Protocol);
+		QTest::newRow("EM24, single phase") << 73 << SinglePhaseSystem << int(AcSensor::Em24Protocol);
+		QTest::newRow("EM24, piggyback") << 72 << PiggybackSystem << int(AcSensor::Em24Protocol);
+		QTest::newRow("ET112") << 102 << SinglePhaseSystem << int(AcSensor::Et112Protocol);
+		QTest::newRow("ET112, last id") << 121 << MultiPhaseSystem << int(AcSensor::Et112Protocol);
+		QTest::newRow("EM340, multi phase") << 330 << MultiPhaseSystem << int(AcSensor::Em340Protocol);
+		QTest::newRow("EM340, single phase") << 345 << SinglePhaseSystem << int(AcSensor::Em340Protocol);
+		QTest::newRow("EM340, piggyback") << 340 << PiggybackSystem << int(AcSensor::Em340Protocol);
+	}
+
+	void shippedMaps()
+	{
+		QFETCH(int, deviceType);
+		QFETCH(MeasuringSystem, system);
+		QFETCH(int, protocol);
+
+		const RegisterMap *map = RegisterMaps::find(deviceType, system);
+		QVERIFY(map != 0);
+		QCOMPARE(int(map->protocol), protocol);
+		QCOMPARE(int(RegisterMaps::protocolType(deviceType)), protocol);
+		QVERIFY(!map->commands.isEmpty());
+		foreach (const CompositeCommand &command, map->commands) {
+			QVERIFY(command.actionCount > 0 && command.actionCount <= MaxRegCount);
+			QVERIFY(command.count > 0 && command.count <= Modbus::MaxRegisterCount);
+		}
+	}
+
+	void unknownDevice()
+	{
+		QVERIFY(RegisterMaps::find(1, MultiPhaseSystem) == 0);
+		QCOMPARE(RegisterMaps::protocolType(1), AcSensor::Unknown);
+	}
+
+	void malformedMap_data()
+	{
+		QTest::addColumn<QByteArray>("xml");
+
+		QTest::newRow("not xml") << QByteArray("<maps><map>");
+		QTest::newRow("no maps") << QByteArray("<maps/>");
+		QTest::newRow("unknown protocol") << QByteArray(
+			"<maps><map name=\"x\" protocol=\"em99\" deviceIds=\"1\">"
+			"<read reg=\"0\" period=\"100\"><value offset=\"0\" quantity=\"power\" phase=\"total\"/></read>"
+			"</map></maps>");
+		QTest::newRow("overlapping values") << QByteArray(
+			"<maps><map name=\"x\" protocol=\"em24\" deviceIds=\"1\">"
+			"<read reg=\"0\" period=\"100\">"
+			"<value offset=\"0\" quantity=\"power\" phase=\"total\"/>"
+			"<value offset=\"1\" quantity=\"current\" phase=\"total\"/>"
+			"</read></map></maps>");
+		QTest::newRow("period too short") << QByteArray(
+			"<maps><map name=\"x\" protocol=\"em24\" deviceIds=\"1\">"
+			"<read reg=\"0\" period=\"1\"><value offset=\"0\" quantity=\"power\" phase=\"total\"/></read>"
+			"</map></maps>");
+	}
+
+	void malformedMap()
+	{
+		QFETCH(QByteArray, xml);
+
+		QTemporaryFile file;
+		QVERIFY(file.open());
+		file.write(xml);
+		file.close();
+		QVERIFY(!RegisterMaps::load(file.fileName()));
+		// The maps loaded before are kept.
+		QVERIFY(RegisterMaps::find(71, MultiPhaseSystem) != 0);
+		QVERIFY(RegisterMaps::find(1, MultiPhaseSystem) == 0);
+	}
+};
+
+QTEST_GUILESS_MAIN(TestRegisterMaps)
+
+#include "test_register_maps.moc"
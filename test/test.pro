@@ -0,0 +1,12 @@
+# Unit tests and benchmarks. Build with qmake and run `make check`.
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    crc16 \
+    dbus_bridge_benchmark \
+    identity_cache \
+    latency \
+    modbus_allocations \
+    modbus_tcp \
+    reconnect \
+    register_maps
@@ -0,0 +1,34 @@
+QT += core
+QT -= gui
+
+TARGET = meter_simulator
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+MOC_DIR=.moc
+OBJECTS_DIR=.obj
+
+include(../../software/ext/qslog/QsLog.pri)
+
+INCLUDEPATH += \
+    ../../software/src \
+    ../../software/ext/qslog
+
+HEADERS += \
+    ../../software/src/crc16.h \
+    ../../software/src/defines.h \
+    src/bus_simulator.h \
+    src/pty_port.h \
+    src/simulated_meter.h
+
+SOURCES += \
+    ../../software/src/crc16.cpp \
+    src/bus_simulator.cpp \
+    src/main.cpp \
+    src/pty_port.cpp \
+    src/simulated_meter.cpp
+
+DISTFILES += \
+    Readme.md
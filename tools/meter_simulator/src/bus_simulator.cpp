@@ -0,0 +1,179 @@
+#include <QsLog.h>
+#include <QTimer>
+#include <stdlib.h>
+#include "bus_simulator.h"
+#include "crc16.h"
+#include "defines.h"
+#include "pty_port.h"
+#include "simulated_meter.h"
+
+static const int ReadHoldingRegisters = 3;
+static const int ReadInputRegisters = 4;
+static const int WriteSingleRegister = 6;
+static const int IllegalFunction = 1;
+static const int IllegalDataValue = 3;
+static const int MaxRegisterCount = 125;
+static const int StatisticsInterval = 60 * 1000;
+
+/// Returns a random number in [0, 1).
+static double randomFraction()
+{
+	return qrand() / (RAND_MAX + 1.0);
+}
+
+BusSimulator::BusSimulator(PtyPort *port, const BusParameters &parameters,
+						   QObject *parent):
+	QObject(parent),
+	mPort(port),
+	mParameters(parameters),
+	mResponseTimer(new QTimer(this)),
+	mStatisticsTimer(new QTimer(this)),
+	mRequestCount(0),
+	mDroppedCount(0),
+	mCorruptedCount(0),
+	mIgnoredCount(0)
+{
+	connect(mPort, SIGNAL(dataReceived(QByteArray)),
+			this, SLOT(onDataReceived(QByteArray)));
+	mResponseTimer->setSingleShot(true);
+#if QT_VERSION >= 0x050000
+	// Qt 4 has no timer types: its timers are always precise.
+	mResponseTimer->setTimerType(Qt::PreciseTimer);
+#endif
+	connect(mResponseTimer, SIGNAL(timeout()), this, SLOT(onResponseDue()));
+	connect(mStatisticsTimer, SIGNAL(timeout()), this, SLOT(onReportStatistics()));
+	mStatisticsTimer->start(StatisticsInterval);
+}
+
+bool BusSimulator::addMeter(SimulatedMeter *meter)
+{
+	if (mMeters.contains(meter->slaveAddress()))
+		return false;
+	meter->setParent(this);
+	mMeters.insert(meter->slaveAddress(), meter);
+	return true;
+}
+
+void BusSimulator::onDataReceived(const QByteArray &data)
+{
+	mRxBuffer.append(data);
+	// A pseudo terminal does not preserve the silent interval between
+	// frames, so we look for 8 bytes with a valid CRC instead. If the CRC is
+	// wrong we skip a byte, just like a real slave will eventually resync.
+	while (mRxBuffer.size() >= RequestSize) {
+		const quint8 *frame = reinterpret_cast<const quint8 *>(mRxBuffer.constData());
+		quint16 crc = toUInt16(frame[RequestSize - 2], frame[RequestSize - 1]);
+		if (crc != Crc16::getValue(frame, RequestSize - 2)) {
+			mRxBuffer.remove(0, 1);
+			continue;
+		}
+		processRequest(frame);
+		mRxBuffer.remove(0, RequestSize);
+	}
+}
+
+void BusSimulator::onResponseDue()
+{
+	mPort->write(mResponse);
+	mResponse.clear();
+}
+
+void BusSimulator::onReportStatistics()
+{
+	QLOG_INFO() << "Requests:" << mRequestCount << "dropped:" << mDroppedCount
+				<< "corrupted:" << mCorruptedCount << "ignored (bus busy):" << mIgnoredCount;
+}
+
+void BusSimulator::processRequest(const quint8 *frame)
+{
+	quint8 slaveAddress = frame[0];
+	SimulatedMeter *meter = mMeters.value(slaveAddress);
+	if (meter == 0)
+		return;
+	++mRequestCount;
+	if (!mResponse.isEmpty()) {
+		++mIgnoredCount;
+		QLOG_DEBUG() << "Request for" << slaveAddress << "ignored: bus busy";
+		return;
+	}
+	if (randomFraction() < mParameters.dropRate) {
+		++mDroppedCount;
+		QLOG_DEBUG() << "Request for" << slaveAddress << "dropped";
+		return;
+	}
+	quint8 function = frame[1];
+	quint16 reg = toUInt16(frame[2], frame[3]);
+	quint16 value = toUInt16(frame[4], frame[5]);
+	switch (function) {
+	case ReadHoldingRegisters:
+	case ReadInputRegisters:
+	{
+		quint16 values[MaxRegisterCount];
+		int exception = value > MaxRegisterCount ? IllegalDataValue :
+			meter->readRegisters(reg, value, values);
+		if (exception != 0) {
+			sendException(slaveAddress, function, exception);
+			return;
+		}
+		QByteArray pdu;
+		pdu.append(static_cast<char>(function));
+		pdu.append(static_cast<char>(2 * value));
+		for (int i=0; i<value; ++i) {
+			pdu.append(static_cast<char>(msb(values[i])));
+			pdu.append(static_cast<char>(lsb(values[i])));
+		}
+		scheduleResponse(pdu, slaveAddress);
+		break;
+	}
+	case WriteSingleRegister:
+	{
+		int exception = meter->writeRegister(reg, value);
+		if (exception != 0) {
+			sendException(slaveAddress, function, exception);
+			return;
+		}
+		QLOG_INFO() << "Slave" << slaveAddress << "register" << hex << reg
+					<< "set to" << dec << value;
+		// The response is an echo of the request.
+		scheduleResponse(QByteArray(reinterpret_cast<const char *>(frame + 1), 5),
+						 slaveAddress);
+		break;
+	}
+	default:
+		sendException(slaveAddress, function, IllegalFunction);
+		break;
+	}
+}
+
+void BusSimulator::sendException(quint8 slaveAddress, quint8 function, int exception)
+{
+	QByteArray pdu;
+	pdu.append(static_cast<char>(function | 0x80));
+	pdu.append(static_cast<char>(exception));
+	scheduleResponse(pdu, slaveAddress);
+}
+
+void BusSimulator::scheduleResponse(const QByteArray &pdu, quint8 slaveAddress)
+{
+	mResponse.clear();
+	mResponse.append(static_cast<char>(slaveAddress));
+	mResponse.append(pdu);
+	quint16 crc = Crc16::getValue(mResponse);
+	mResponse.append(static_cast<char>(msb(crc)));
+	mResponse.append(static_cast<char>(lsb(crc)));
+	if (randomFraction() < mParameters.crcErrorRate) {
+		++mCorruptedCount;
+		int i = qrand() % mResponse.size();
+		mResponse[i] = static_cast<char>(mResponse[i] ^ (1 << (qrand() % 8)));
+		QLOG_DEBUG() << "Response for" << slaveAddress << "corrupted";
+	}
+	int delay = mParameters.latency;
+	if (mParameters.jitter > 0)
+		delay += qrand() % (2 * mParameters.jitter + 1) - mParameters.jitter;
+	if (mParameters.baudRate > 0) {
+		// 10 bits per character (start bit, 8 data bits, stop bit).
+		int chars = RequestSize + mResponse.size();
+		delay += (chars * 10 * 1000 + mParameters.baudRate - 1) / mParameters.baudRate;
+	}
+	mResponseTimer->start(qMax(0, delay));
+}
@@ -0,0 +1,79 @@
+#ifndef BUS_SIMULATOR_H
+#define BUS_SIMULATOR_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+
+class PtyPort;
+class QTimer;
+class SimulatedMeter;
+
+/*!
+ * Parameters used to simulate a (less than perfect) RS485 bus.
+ */
+struct BusParameters {
+	/// Baud rate used to compute the time needed to transfer request and
+	/// response. 0 disables the transfer delay.
+	int baudRate;
+	/// Average time (ms) between the request and the response.
+	int latency;
+	/// Maximum deviation (ms) from `latency`.
+	int jitter;
+	/// Fraction of the responses with a corrupted byte.
+	double crcErrorRate;
+	/// Fraction of the requests which are not answered.
+	double dropRate;
+};
+
+/*!
+ * Modbus RTU slave side of a pseudo terminal.
+ *
+ * Requests are passed to the `SimulatedMeter` with the corresponding slave
+ * address. Like a real bus only one response can be sent at a time: requests
+ * received while a response is pending are ignored.
+ */
+class BusSimulator : public QObject
+{
+	Q_OBJECT
+public:
+	BusSimulator(PtyPort *port, const BusParameters &parameters, QObject *parent = 0);
+
+	/*!
+	 * Adds a meter to the bus. This object takes ownership of the meter.
+	 * @retval false if there is already a meter with the same slave address.
+	 */
+	bool addMeter(SimulatedMeter *meter);
+
+private slots:
+	void onDataReceived(const QByteArray &data);
+
+	void onResponseDue();
+
+	void onReportStatistics();
+
+private:
+	void processRequest(const quint8 *frame);
+
+	void sendException(quint8 slaveAddress, quint8 function, int exception);
+
+	void scheduleResponse(const QByteArray &pdu, quint8 slaveAddress);
+
+	/// All requests sent by dbus-cgwacs have the same size: address,
+	/// function, 2 16-bit values and CRC.
+	static const int RequestSize = 8;
+
+	PtyPort *mPort;
+	BusParameters mParameters;
+	QHash<quint8, SimulatedMeter *> mMeters;
+	QByteArray mRxBuffer;
+	QByteArray mResponse;
+	QTimer *mResponseTimer;
+	QTimer *mStatisticsTimer;
+	int mRequestCount;
+	int mDroppedCount;
+	int mCorruptedCount;
+	int mIgnoredCount;
+};
+
+#endif // BUS_SIMULATOR_H
@@ -0,0 +1,130 @@
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QsLog.h>
+#include <QStringList>
+#include "bus_simulator.h"
+#include "pty_port.h"
+#include "simulated_meter.h"
+
+void initLogger(QsLogging::Level logLevel)
+{
+	QsLogging::Logger &logger = QsLogging::Logger::instance();
+	QsLogging::DestinationPtr debugDestination(
+			QsLogging::DestinationFactory::MakeDebugOutputDestination());
+	logger.addDestination(debugDestination);
+	logger.setIncludeTimestamp(false);
+	logger.setLoggingLevel(logLevel);
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	initLogger(QsLogging::InfoLevel);
+
+	QString linkPath;
+	QStringList meterSpecs;
+	BusParameters parameters;
+	parameters.baudRate = 9600;
+	parameters.latency = 40;
+	parameters.jitter = 10;
+	parameters.crcErrorRate = 0;
+	parameters.dropRate = 0;
+	QStringList args = app.arguments();
+	args.pop_front();
+
+	while (!args.isEmpty()) {
+		QString arg = args.takeFirst();
+
+		if (arg == "-h" || arg == "--help") {
+			QLOG_INFO() << app.arguments().first();
+			QLOG_INFO() << "\t-h, --help";
+			QLOG_INFO() << "\t Show this message.";
+			QLOG_INFO() << "\t-d level, --debug level";
+			QLOG_INFO() << "\t Set log level";
+			QLOG_INFO() << "\t--link path";
+			QLOG_INFO() << "\t Create a symlink to the pseudo terminal (eg. /tmp/ttyCG0)";
+			QLOG_INFO() << "\t--meter type:address[:serial]";
+			QLOG_INFO() << "\t Add a meter. Type is em24, et112 or em340. May be repeated.";
+			QLOG_INFO() << "\t Default: em24:1";
+			QLOG_INFO() << "\t--baudrate baud";
+			QLOG_INFO() << "\t Simulated baud rate, used to delay responses (default 9600, 0 = none)";
+			QLOG_INFO() << "\t--latency milliseconds";
+			QLOG_INFO() << "\t Average response time of the meters (default 40)";
+			QLOG_INFO() << "\t--jitter milliseconds";
+			QLOG_INFO() << "\t Maximum deviation from the average response time (default 10)";
+			QLOG_INFO() << "\t--crc-error-rate fraction";
+			QLOG_INFO() << "\t Fraction of the responses with a corrupted byte (default 0)";
+			QLOG_INFO() << "\t--drop-rate fraction";
+			QLOG_INFO() << "\t Fraction of the requests which are not answered (default 0)";
+			exit(1);
+		} else if (arg == "-d" || arg == "--debug") {
+			if (!args.isEmpty()) {
+				arg = args.takeFirst();
+				QsLogging::Logger &logger = QsLogging::Logger::instance();
+				QsLogging::Level logLevel = static_cast<QsLogging::Level>(qBound(
+					static_cast<int>(QsLogging::TraceLevel),
+					arg.toInt(),
+					static_cast<int>(QsLogging::OffLevel)));
+				logger.setLoggingLevel(logLevel);
+			}
+		} else if (arg == "--link") {
+			if (!args.isEmpty())
+				linkPath = args.takeFirst();
+		} else if (arg == "--meter") {
+			if (!args.isEmpty())
+				meterSpecs.append(args.takeFirst());
+		} else if (arg == "--baudrate") {
+			if (!args.isEmpty())
+				parameters.baudRate = qMax(0, args.takeFirst().toInt());
+		} else if (arg == "--latency") {
+			if (!args.isEmpty())
+				parameters.latency = qBound(0, args.takeFirst().toInt(), 60000);
+		} else if (arg == "--jitter") {
+			if (!args.isEmpty())
+				parameters.jitter = qBound(0, args.takeFirst().toInt(), 60000);
+		} else if (arg == "--crc-error-rate") {
+			if (!args.isEmpty())
+				parameters.crcErrorRate = qBound(0.0, args.takeFirst().toDouble(), 1.0);
+		} else if (arg == "--drop-rate") {
+			if (!args.isEmpty())
+				parameters.dropRate = qBound(0.0, args.takeFirst().toDouble(), 1.0);
+		}
+	}
+
+	if (meterSpecs.isEmpty())
+		meterSpecs.append("em24:1");
+
+	qsrand(static_cast<uint>(QDateTime::currentMSecsSinceEpoch()));
+
+	PtyPort port;
+	if (!port.open(linkPath))
+		return 2;
+	BusSimulator bus(&port, parameters);
+
+	foreach (const QString &spec, meterSpecs) {
+		QStringList parts = spec.split(':');
+		SimulatedMeter::Type type;
+		bool ok = false;
+		int address = parts.size() >= 2 ? parts[1].toInt(&ok) : 0;
+		if (!ok || address < 1 || address > 247 ||
+			!SimulatedMeter::parseType(parts[0], type)) {
+			QLOG_ERROR() << "Invalid meter:" << spec;
+			return 2;
+		}
+		QString serial = parts.size() >= 3 ?
+			parts[2] :
+			QString("SIM%1%2").arg(parts[0].toUpper()).arg(address, 3, 10, QChar('0'));
+		if (!bus.addMeter(new SimulatedMeter(type, static_cast<quint8>(address), serial))) {
+			QLOG_ERROR() << "Duplicate slave address:" << address;
+			return 2;
+		}
+		QLOG_INFO() << "Simulating" << parts[0] << "at address" << address
+					<< "serial" << serial;
+	}
+
+	QLOG_INFO() << "Serving meters on" << port.portName()
+				<< (linkPath.isEmpty() ? QString() : "(" + linkPath + ")");
+
+	return app.exec();
+}
@@ -0,0 +1,99 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <QFile>
+#include <QsLog.h>
+#include <QSocketNotifier>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "pty_port.h"
+
+PtyPort::PtyPort(QObject *parent):
+	QObject(parent),
+	mMasterFd(-1),
+	mSlaveFd(-1),
+	mNotifier(0)
+{
+}
+
+PtyPort::~PtyPort()
+{
+	close();
+}
+
+bool PtyPort::open(const QString &linkPath)
+{
+	Q_ASSERT(mMasterFd < 0);
+	mMasterFd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (mMasterFd < 0 || grantpt(mMasterFd) != 0 || unlockpt(mMasterFd) != 0) {
+		QLOG_ERROR() << "Could not create pseudo terminal:" << strerror(errno);
+		close();
+		return false;
+	}
+	mPortName = QString::fromLocal8Bit(ptsname(mMasterFd));
+	mSlaveFd = ::open(ptsname(mMasterFd), O_RDWR | O_NOCTTY);
+	if (mSlaveFd < 0) {
+		QLOG_ERROR() << "Could not open" << mPortName << ':' << strerror(errno);
+		close();
+		return false;
+	}
+	// Modbus frames are binary data, so disable all processing by the line
+	// discipline (echo, CR/LF conversion, ...).
+	struct termios tio;
+	tcgetattr(mSlaveFd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(mSlaveFd, TCSANOW, &tio);
+	fcntl(mMasterFd, F_SETFL, fcntl(mMasterFd, F_GETFL) | O_NONBLOCK);
+
+	if (!linkPath.isEmpty()) {
+		QFile::remove(linkPath);
+		if (!QFile::link(mPortName, linkPath)) {
+			QLOG_ERROR() << "Could not create symlink" << linkPath;
+			close();
+			return false;
+		}
+		mLinkPath = linkPath;
+	}
+
+	mNotifier = new QSocketNotifier(mMasterFd, QSocketNotifier::Read, this);
+	connect(mNotifier, SIGNAL(activated(int)), this, SLOT(onReadyRead()));
+	return true;
+}
+
+void PtyPort::write(const QByteArray &data)
+{
+	if (mMasterFd < 0)
+		return;
+	if (::write(mMasterFd, data.constData(), data.size()) != data.size())
+		QLOG_WARN() << "Could not write to" << mPortName << ':' << strerror(errno);
+}
+
+void PtyPort::onReadyRead()
+{
+	char buf[256];
+	for (;;) {
+		ssize_t n = ::read(mMasterFd, buf, sizeof(buf));
+		if (n <= 0)
+			break;
+		emit dataReceived(QByteArray(buf, static_cast<int>(n)));
+	}
+}
+
+void PtyPort::close()
+{
+	delete mNotifier;
+	mNotifier = 0;
+	if (!mLinkPath.isEmpty()) {
+		QFile::remove(mLinkPath);
+		mLinkPath.clear();
+	}
+	if (mSlaveFd >= 0) {
+		::close(mSlaveFd);
+		mSlaveFd = -1;
+	}
+	if (mMasterFd >= 0) {
+		::close(mMasterFd);
+		mMasterFd = -1;
+	}
+}
@@ -0,0 +1,59 @@
+#ifndef PTY_PORT_H
+#define PTY_PORT_H
+
+#include <QByteArray>
+#include <QObject>
+
+class QSocketNotifier;
+
+/*!
+ * The master side of a pseudo terminal.
+ *
+ * The slave side (eg. /dev/pts/3) can be used by dbus-cgwacs like a normal
+ * serial port. Optionally a symlink to the slave is created, so the port name
+ * does not change between runs.
+ */
+class PtyPort : public QObject
+{
+	Q_OBJECT
+public:
+	PtyPort(QObject *parent = 0);
+
+	~PtyPort();
+
+	/*!
+	 * Creates the pseudo terminal.
+	 * @param linkPath If not empty, a symlink to the slave side will be
+	 * created at this location. An existing file will be replaced.
+	 */
+	bool open(const QString &linkPath);
+
+	/*!
+	 * Returns the name of the slave side of the terminal.
+	 */
+	QString portName() const
+	{
+		return mPortName;
+	}
+
+	void write(const QByteArray &data);
+
+signals:
+	void dataReceived(const QByteArray &data);
+
+private slots:
+	void onReadyRead();
+
+private:
+	void close();
+
+	int mMasterFd;
+	/// We keep the slave side open ourselves. Otherwise reading from the
+	/// master fails with EIO while dbus-cgwacs is not running.
+	int mSlaveFd;
+	QSocketNotifier *mNotifier;
+	QString mPortName;
+	QString mLinkPath;
+};
+
+#endif // PTY_PORT_H
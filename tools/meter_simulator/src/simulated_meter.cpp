@@ -0,0 +1,204 @@
+#include <cmath>
+#include <QTimer>
+#include "simulated_meter.h"
+
+static const int UpdateInterval = 200;
+/// Period of the simulated power fluctuation in seconds.
+static const double PowerPeriod = 60;
+/// Average power per phase. L2 feeds back to the grid, so the negative
+/// energy counters are tested as well.
+static const double BasePower[3] = { 1500, -800, 300 };
+static const double PowerAmplitude = 500;
+static const double NominalVoltage = 230;
+
+static const int IllegalDataAddress = 2;
+static const int IllegalDataValue = 3;
+
+SimulatedMeter::SimulatedMeter(Type type, quint8 slaveAddress, const QString &serial,
+							   QObject *parent):
+	QObject(parent),
+	mType(type),
+	mSlaveAddress(slaveAddress),
+	mUpdateTimer(new QTimer(this)),
+	mLastUpdate(0)
+{
+	for (int i=0; i<3; ++i) {
+		mPositiveEnergy[i] = 1000 + 100 * i;
+		mNegativeEnergy[i] = 200 + 10 * i;
+	}
+	// Measurement area. Block reads may include registers between the values
+	// we use, so make all of them available.
+	for (int r=0; r<0x0070; ++r)
+		mRegisters[r] = 0;
+	mRegisters[RegFirmwareVersion] = 0x0103;
+	switch (type) {
+	case Em24:
+		// Maximum block size according to the EM24 protocol specification.
+		mMaxRegCount = 11;
+		mRegisters[RegDeviceId] = 71;
+		mRegisters[RegEm24VersionCode] = 0;
+		mRegisters[RegEm24FrontSelector] = 0;
+		mRegisters[RegEm24PhaseSequence] = 0;
+		// Start with a setup dbus-cgwacs does not want, so the setup code
+		// is exercised as well.
+		mRegisters[RegApplication] = 5;
+		mRegisters[RegMeasurementSystem] = 0;
+		setSerial(RegEm24Serial, serial);
+		break;
+	case Et112:
+		mMaxRegCount = 50;
+		mRegisters[RegDeviceId] = 120;
+		mRegisters[RegEm112MeasurementMode] = 0;
+		setSerial(RegEm112Serial, serial);
+		break;
+	case Em340:
+		mMaxRegCount = 50;
+		mRegisters[RegDeviceId] = 340;
+		mRegisters[RegEm340PhaseSequence] = 0;
+		mRegisters[RegEm112MeasurementMode] = 0;
+		mRegisters[RegEm340MeasurementSystem] = 0;
+		setSerial(RegEm112Serial, serial);
+		break;
+	}
+	mClock.start();
+	onUpdate();
+	connect(mUpdateTimer, SIGNAL(timeout()), this, SLOT(onUpdate()));
+	mUpdateTimer->start(UpdateInterval);
+}
+
+bool SimulatedMeter::parseType(const QString &name, Type &type)
+{
+	QString n = name.toLower();
+	if (n == "em24") {
+		type = Em24;
+	} else if (n == "et112") {
+		type = Et112;
+	} else if (n == "em340") {
+		type = Em340;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+int SimulatedMeter::readRegisters(quint16 startReg, quint16 count, quint16 *values) const
+{
+	if (count == 0 || count > mMaxRegCount)
+		return IllegalDataValue;
+	for (int i=0; i<count; ++i) {
+		QHash<quint16, quint16>::const_iterator it =
+			mRegisters.find(static_cast<quint16>(startReg + i));
+		if (it == mRegisters.end())
+			return IllegalDataAddress;
+		values[i] = it.value();
+	}
+	return 0;
+}
+
+int SimulatedMeter::writeRegister(quint16 reg, quint16 value)
+{
+	switch (reg) {
+	case RegApplication:
+	case RegMeasurementSystem:
+		if (mType != Em24)
+			return IllegalDataAddress;
+		break;
+	case RegEm112MeasurementMode:
+		if (mType == Em24)
+			return IllegalDataAddress;
+		break;
+	case RegEm340MeasurementSystem:
+		if (mType != Em340)
+			return IllegalDataAddress;
+		break;
+	default:
+		return IllegalDataAddress;
+	}
+	mRegisters[reg] = value;
+	return 0;
+}
+
+void SimulatedMeter::onUpdate()
+{
+	qint64 now = mClock.elapsed();
+	double hours = (now - mLastUpdate) / 3600e3;
+	mLastUpdate = now;
+	double t = now / 1000.0;
+
+	double power[3];
+	double voltage[3];
+	double current[3];
+	for (int i=0; i<3; ++i) {
+		double angle = 2 * M_PI * (t / PowerPeriod + i / 3.0);
+		power[i] = BasePower[i] + PowerAmplitude * sin(angle);
+		voltage[i] = NominalVoltage + 2 * sin(angle / 7);
+		current[i] = qAbs(power[i]) / voltage[i];
+		if (power[i] >= 0)
+			mPositiveEnergy[i] += power[i] * hours / 1000;
+		else
+			mNegativeEnergy[i] -= power[i] * hours / 1000;
+	}
+
+	switch (mType) {
+	case Et112:
+		setInt32(0x0000, voltage[0], 0.1);
+		setInt32(0x0002, current[0], 1e-3);
+		setInt32(0x0004, power[0], 0.1);
+		setInt32(0x0010, mPositiveEnergy[0], 0.1);
+		setInt32(0x0020, mNegativeEnergy[0], 0.1);
+		break;
+	case Em24:
+	case Em340:
+	{
+		double totalPower = 0;
+		double totalVoltage = 0;
+		double totalPositive = 0;
+		double totalNegative = 0;
+		for (int i=0; i<3; ++i) {
+			setInt32(0x0000 + 2 * i, voltage[i], 0.1);
+			setInt32(0x000C + 2 * i, current[i], 1e-3);
+			setInt32(0x0012 + 2 * i, power[i], 0.1);
+			totalPower += power[i];
+			totalVoltage += voltage[i];
+			totalPositive += mPositiveEnergy[i];
+			totalNegative += mNegativeEnergy[i];
+		}
+		setInt32(0x0024, totalVoltage / 3, 0.1);
+		setInt32(0x0028, totalPower, 0.1);
+		if (mType == Em24) {
+			setInt32(0x003E, totalPositive, 0.1);
+			for (int i=0; i<3; ++i)
+				setInt32(0x0046 + 2 * i, mPositiveEnergy[i], 0.1);
+			setInt32(0x005C, totalNegative, 0.1);
+		} else {
+			setInt32(0x0034, totalPositive, 0.1);
+			for (int i=0; i<3; ++i)
+				setInt32(0x0040 + 2 * i, mPositiveEnergy[i], 0.1);
+			setInt32(0x004E, totalNegative, 0.1);
+			for (int i=0; i<3; ++i)
+				setInt32(0x0060 + 2 * i, mNegativeEnergy[i], 0.1);
+		}
+		break;
+	}
+	}
+}
+
+void SimulatedMeter::setInt32(quint16 reg, double value, double factor)
+{
+	// Least significant word first, see AcSensorUpdater::getDouble.
+	qint32 v = static_cast<qint32>(qRound(value / factor));
+	quint32 u = static_cast<quint32>(v);
+	mRegisters[reg] = static_cast<quint16>(u & 0xFFFF);
+	mRegisters[reg + 1] = static_cast<quint16>(u >> 16);
+}
+
+void SimulatedMeter::setSerial(quint16 reg, const QString &serial)
+{
+	// 7 registers with 2 characters each, padded with zeros.
+	QByteArray s = serial.toLatin1().left(14);
+	s.append(QByteArray(14 - s.size(), '\0'));
+	for (int i=0; i<7; ++i) {
+		mRegisters[reg + i] = static_cast<quint16>(
+			(static_cast<quint8>(s[2 * i]) << 8) | static_cast<quint8>(s[2 * i + 1]));
+	}
+}
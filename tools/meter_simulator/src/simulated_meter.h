@@ -0,0 +1,91 @@
+#ifndef SIMULATED_METER_H
+#define SIMULATED_METER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+
+class QTimer;
+
+/*!
+ * Register map of a single Carlo Gavazzi energy meter.
+ *
+ * Only the registers used by dbus-cgwacs are available. Reading any other
+ * register yields an `IllegalDataAddress` exception, like a real meter. The
+ * measured values follow a slow sine wave, and the energy counters are
+ * derived from the power.
+ */
+class SimulatedMeter : public QObject
+{
+	Q_OBJECT
+public:
+	enum Type {
+		Em24,
+		Et112,
+		Em340
+	};
+
+	SimulatedMeter(Type type, quint8 slaveAddress, const QString &serial,
+				   QObject *parent = 0);
+
+	/*!
+	 * Converts a meter type as given on the command line (em24, et112,
+	 * em340) to a `Type`.
+	 * @retval false if the name is unknown.
+	 */
+	static bool parseType(const QString &name, Type &type);
+
+	quint8 slaveAddress() const
+	{
+		return mSlaveAddress;
+	}
+
+	/*!
+	 * Copies `count` registers starting at `startReg` to `values`.
+	 * @return 0 on success, or the modbus exception code.
+	 */
+	int readRegisters(quint16 startReg, quint16 count, quint16 *values) const;
+
+	/*!
+	 * Changes the value of a setup register.
+	 * @return 0 on success, or the modbus exception code.
+	 */
+	int writeRegister(quint16 reg, quint16 value);
+
+private slots:
+	void onUpdate();
+
+private:
+	enum Registers {
+		RegDeviceId = 0x000B,
+		RegEm340PhaseSequence = 0x0032,
+		RegEm24PhaseSequence = 0x0036,
+		RegEm340MeasurementSystem = 0x1002,
+		RegApplication = 0x1101,
+		RegMeasurementSystem = 0x1102,
+		RegEm112MeasurementMode = 0x1103,
+		RegEm24Serial = 0x1300,
+		RegEm24VersionCode = 0x0302,
+		RegFirmwareVersion = 0x0303,
+		RegEm24FrontSelector = 0x0304,
+		RegEm112Serial = 0x5000,
+	};
+
+	void setInt32(quint16 reg, double value, double factor);
+
+	void setSerial(quint16 reg, const QString &serial);
+
+	Type mType;
+	quint8 mSlaveAddress;
+	int mMaxRegCount;
+	/// Contains all supported registers.
+	QHash<quint16, quint16> mRegisters;
+	QTimer *mUpdateTimer;
+	QElapsedTimer mClock;
+	qint64 mLastUpdate;
+	/// Energy counters per phase (kWh)
+	double mPositiveEnergy[3];
+	double mNegativeEnergy[3];
+};
+
+#endif // SIMULATED_METER_H